@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <array>
 #include <fstream>
 #include <iostream>
@@ -17,7 +18,12 @@ public:
 		bios_file.read(reinterpret_cast<char*>(m_rom.data()), m_bios_size);
 	}
 	
-	const std::span<const std::byte> read(uint32_t offset, uint32_t bytes) const;
+	template<typename T>
+	T read(uint32_t offset) const {
+		T value {};
+		std::memcpy(&value, m_rom.data() + offset, sizeof(T));
+		return value;
+	}
 
 	uint32_t rom_size() const { return m_bios_size; }
 	uint32_t memory_region() const { return m_memory_region_start; }
@@ -1,115 +1,166 @@
 #include "Bus.h"
 
-#include <span>
+#include <algorithm>
+#include <cstring>
 
 #include "Logger.h"
 #include "Memory.h"
 
-std::span<const std::byte> Bus::read_memory(uint32_t address, uint32_t bytes) const {
-	uint32_t physical_address { to_physical_address(address) };
-	if (Memory::Map::bios.contains(physical_address)){
-		return m_bios.read(Memory::Map::bios.offset(physical_address), bytes);
+Bus::Bus(Bios& bios, Ram& ram, Gpu& gpu, Timers& timers, Interrupt_controller& interrupts, Dma& dma)
+	: m_bios { bios }, m_ram { ram }, m_gpu { gpu }, m_timers { timers }, m_interrupts { interrupts }, m_dma { dma },
+	m_read_pages(page_count), m_write_pages(page_count), m_page_handlers(page_count, Page_handler::unmapped)
+{
+	// Without host mirrors every mirror's pages point at the one copy of ram
+	for (uint32_t mirror { 0 }; mirror < Ram::mirror_count; mirror++) {
+		std::byte* memory { m_ram.mirror(mirror) };
+		map_host_pages(Memory::Map::ram.start() + mirror * Ram::ram_size, Ram::ram_size, memory, memory);
 	}
+	// Bios is read only, writes go to the slow path to be reported
+	map_host_pages(Memory::Map::bios.start(), Memory::Map::bios.size(), m_bios.get_memory().data(), nullptr);
+	map_pages(Memory::Map::bios.start(), Memory::Map::bios.size(), Page_handler::bios);
+
+	map_pages(Memory::Map::scratchpad.start(), Memory::Map::scratchpad.size(), Page_handler::scratchpad);
+	map_pages(Memory::Map::expansion_region_1.start(), Memory::Map::expansion_region_1.size(), Page_handler::expansion_region_1);
+	// All the hardware registers share a handful of pages
+	map_pages(Memory::Map::mem_control_1.start(), Memory::Map::expansion_region_2.end() - Memory::Map::mem_control_1.start(), Page_handler::io_ports);
+}
+
+// Every page touching the range is given the handler
+void Bus::map_pages(uint32_t physical_address, uint32_t size, Page_handler handler) {
+	uint32_t first_page { physical_address >> page_shift };
+	uint32_t last_page { (physical_address + size - 1) >> page_shift };
+	std::fill(m_page_handlers.begin() + first_page, m_page_handlers.begin() + last_page + 1, handler);
+}
+
+// Points the pages of the range straight at host memory. A null pointer
+// leaves that direction on the slow path. The range must be page aligned.
+void Bus::map_host_pages(uint32_t physical_address, uint32_t size, const std::byte* read, std::byte* write) {
+	map_pages(physical_address, size, Page_handler::host_memory);
+	for (uint32_t offset { 0 }; offset < size; offset += page_size) {
+		uint32_t page { (physical_address + offset) >> page_shift };
+		m_read_pages[page] = read ? read + offset : nullptr;
+		m_write_pages[page] = write ? write + offset : nullptr;
+	}
+}
+
+template<typename T>
+T Bus::read_slow(uint32_t physical_address) const {
+	Page_handler handler { physical_address < physical_memory_size
+		? m_page_handlers[physical_address >> page_shift]
+		: Page_handler::io_ports };
+
+	if (handler == Page_handler::scratchpad && Memory::Map::scratchpad.contains(physical_address)) {
+		T value {};
+		std::memcpy(&value, m_scratchpad.data() + Memory::Map::scratchpad.offset(physical_address), sizeof(T));
+		return value;
+	}
+
+	// Nothing is plugged in, so the bus floats high
+	if (handler == Page_handler::expansion_region_1) {
+		return static_cast<T>(0xffffffff);
+	}
+
+	if (handler != Page_handler::io_ports) {
+		LOG_ERROR("[BUS] Unknown read: {:x}", physical_address);
+		std::exit(1);
+	}
+
+	uint32_t shift { (physical_address & 0x3) * 8 };
+	return static_cast<T>(read_io(physical_address & ~0x3u) >> shift);
+}
 
-	if (Memory::Map::ram.contains(physical_address)) {
-		return m_ram.read(Memory::Map::ram.offset(physical_address), bytes);
+template<typename T>
+void Bus::write_slow(uint32_t physical_address, T value) {
+	Page_handler handler { physical_address < physical_memory_size
+		? m_page_handlers[physical_address >> page_shift]
+		: Page_handler::io_ports };
+
+	if (handler == Page_handler::bios) {
+		LOG_ERROR("[BUS] Illegal write to Read Only Memory");
+	} else if (handler == Page_handler::scratchpad && Memory::Map::scratchpad.contains(physical_address)) {
+		std::memcpy(m_scratchpad.data() + Memory::Map::scratchpad.offset(physical_address), &value, sizeof(T));
+	} else if (handler == Page_handler::expansion_region_1) {
+		LOG_WARNING("[BUS] Ignoring write to expansion region 1");
+	} else if (handler != Page_handler::io_ports) {
+		LOG_ERROR("Write to unknown memory region({:x})", physical_address);
+		std::exit(1);
+	} else {
+		uint32_t shift { (physical_address & 0x3) * 8 };
+		uint32_t lanes { static_cast<uint32_t>(static_cast<T>(~0u)) << shift };
+		write_io(physical_address & ~0x3u, static_cast<uint32_t>(value) << shift, lanes);
 	}
+}
+
+template uint8_t Bus::read_slow<uint8_t>(uint32_t) const;
+template uint16_t Bus::read_slow<uint16_t>(uint32_t) const;
+template uint32_t Bus::read_slow<uint32_t>(uint32_t) const;
+template void Bus::write_slow<uint8_t>(uint32_t, uint8_t);
+template void Bus::write_slow<uint16_t>(uint32_t, uint16_t);
+template void Bus::write_slow<uint32_t>(uint32_t, uint32_t);
 
+uint32_t Bus::read_io(uint32_t physical_address) const {
 	if (Memory::Map::gpu.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] Requesting GPU response at address (0x" << std::hex << physical_address << ")";
-		Logger::log(Logger::Level::warning, ss.str());
-		return m_gpu.get_response(physical_address);
+		LOG_DEBUG("[BUS] Requesting GPU response at address (0x{:x})", physical_address);
+		return m_gpu.read(physical_address);
 	}
 
 	if (Memory::Map::irq_control.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] IRQ Control: reading 0x" << std::hex << physical_address;
-		Logger::log(Logger::Level::info, ss.str());
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return m_interrupts.read(physical_address);
 	}
 
 	if (Memory::Map::timers.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] Timer: reading 0x" << std::hex << physical_address;
-		Logger::log(Logger::Level::info, ss.str());
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return m_timers.read(physical_address);
 	}
 
 	if (Memory::Map::dma.contains(physical_address)) {
-		Logger::log(Logger::Level::info, "[BUS] Reading DMA.");
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return m_dma.read(physical_address);
 	}
 
 	if (Memory::Map::cache_control.contains(physical_address)) {
-		return std::as_bytes(std::span{ &dummy_variable, 1});
-	}
-
-	if (Memory::Map::expansion_region_1.contains(physical_address)) {
-		return std::as_bytes(std::span{ &m_no_expansion, 1 });
+		return dummy_variable;
 	}
 
 	if (Memory::Map::expansion_region_2.contains(physical_address)) {
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return dummy_variable;
 	}
 
 	if (Memory::Map::mem_control_1.contains(physical_address)) {
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return dummy_variable;
 	}
 
 	if (Memory::Map::mem_control_2.contains(physical_address)) {
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return dummy_variable;
 	}
 
 	if (Memory::Map::spu.contains(physical_address)) {
-		return std::as_bytes(std::span{ &dummy_variable, 1});
+		return dummy_variable;
 	}
 
 	// If we have made it this far, then there is a read to an unknown area of memory
-	std::stringstream ss;
-	ss << "[BUS] Unknown read: " << std::hex << physical_address;
-	Logger::log(Logger::Level::error, ss.str());
+	LOG_ERROR("[BUS] Unknown read: {:x}", physical_address);
 	std::exit(1);
 }
 
-void Bus::write_memory(uint32_t address, std::span<const std::byte> data) {
-	uint32_t physical_address { to_physical_address(address) };
-	if (Memory::Map::bios.contains(physical_address)){
-		Logger::log(Logger::Level::error, "[BUS] Illegal write to Read Only Memory");
-	} else if (Memory::Map::ram.contains(physical_address)) {
-		m_ram.write(Memory::Map::ram.offset(physical_address), data);
-	} else if (Memory::Map::gpu.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] Writing GPU address (0x" << std::hex << physical_address << ")";
-		uint32_t word {};
-		std::memcpy(&word, data.data(), sizeof(word));
-		ss << " Command: 0x" << word;
-		Logger::log(Logger::Level::warning, ss.str());
-
-		m_gpu.receive_command(word);
+void Bus::write_io(uint32_t physical_address, uint32_t value, uint32_t lanes) {
+	if (Memory::Map::gpu.contains(physical_address)) {
+		LOG_DEBUG("[BUS] Writing GPU address (0x{:x}) Command: 0x{:x}", physical_address, value);
+
+		m_gpu.write(physical_address, value);
 	} else if (Memory::Map::irq_control.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] IRQ Control: Ignoring write to 0x" << std::hex << physical_address;
-		Logger::log(Logger::Level::info, ss.str());
+		m_interrupts.write(physical_address, value, lanes);
 	} else if (Memory::Map::timers.contains(physical_address)) {
-		std::stringstream ss;
-		ss << "[BUS] Timer: Ignoring write to 0x" << std::hex << physical_address;
-		Logger::log(Logger::Level::info, ss.str());
+		m_timers.write(physical_address, value);
 	} else if (Memory::Map::dma.contains(physical_address)) {
-		Logger::log(Logger::Level::warning, "[BUS] Ignoring write to dma.");
+		m_dma.write(physical_address, value, lanes);
 	} else if (Memory::Map::cache_control.contains(physical_address)) {
-		Logger::log(Logger::Level::warning, "[BUS] Ignoring write to cache control");
-	} else if (Memory::Map::expansion_region_1.contains(physical_address)) {
-		Logger::log(Logger::Level::warning, "[BUS] Ignoring write to expansion region 1");
+		LOG_WARNING("[BUS] Ignoring write to cache control");
 	} else if (Memory::Map::expansion_region_2.contains(physical_address)) {
-		Logger::log(Logger::Level::warning, "[BUS] Ignoring write to expansion region 2");
+		LOG_WARNING("[BUS] Ignoring write to expansion region 2");
 	} else if (Memory::Map::mem_control_1.contains(physical_address)) {
 	} else if (Memory::Map::mem_control_2.contains(physical_address)) {
 	} else if (Memory::Map::spu.contains(physical_address)) {
 	} else {
-		std::stringstream ss;
-		ss << "Write to unknown memory region" << '(' << std::hex << physical_address << ')';
-		Logger::log(Logger::Level::error, ss.str());
+		LOG_ERROR("Write to unknown memory region({:x})", physical_address);
 		std::exit(1);
 	}
 }
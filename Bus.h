@@ -4,23 +4,79 @@
 #include "Ram.h"
 
 #include <cstdint>
+#include <cstring>
 #include <span>
+#include <type_traits>
+#include <vector>
 
+#include "Dma.h"
 #include "Gpu.h"
+#include "Interrupt_controller.h"
+#include "Memory.h"
+#include "Timers.h"
 
 struct Bus {
-	std::span<const std::byte> read_memory(uint32_t address, uint32_t bytes = 0) const;
-	void write_memory(uint32_t address, std::span<const std::byte> data);
+	Bus(Bios& bios, Ram& ram, Gpu& gpu, Timers& timers, Interrupt_controller& interrupts, Dma& dma);
+
+	// Reads and writes are typed by access width: uint8_t, uint16_t or uint32_t.
+	// Ram and Bios are handled inline through the page table, everything else
+	// goes through the out of line slow path.
+	template<typename T>
+	T read(uint32_t address) const {
+		static_assert(is_access_type<T>, "Bus accesses are 8, 16 or 32 bits wide");
+		uint32_t physical_address { to_physical_address(address) };
+		if (physical_address < physical_memory_size) {
+			if (const std::byte* page { m_read_pages[physical_address >> page_shift] }) {
+				T value {};
+				std::memcpy(&value, page + (physical_address & (page_size - 1)), sizeof(T));
+				return value;
+			}
+		}
+		return read_slow<T>(physical_address);
+	}
+
+	template<typename T>
+	void write(uint32_t address, T value) {
+		static_assert(is_access_type<T>, "Bus accesses are 8, 16 or 32 bits wide");
+		uint32_t physical_address { to_physical_address(address) };
+		if (physical_address < physical_memory_size) {
+			if (std::byte* page { m_write_pages[physical_address >> page_shift] }) {
+				std::memcpy(page + (physical_address & (page_size - 1)), &value, sizeof(T));
+				return;
+			}
+		}
+		write_slow<T>(physical_address, value);
+	}
 
 	static uint32_t to_physical_address(uint32_t virtual_address);
 
+	// Whether the address is Ram, the Bios or the scratchpad, which can be
+	// read, or written for Ram and the scratchpad, without side effects
+	bool is_plain_memory(uint32_t address, bool write) const {
+		uint32_t physical_address { to_physical_address(address) };
+		if (physical_address >= physical_memory_size) {
+			return false;
+		}
+		uint32_t page { physical_address >> page_shift };
+		if (write ? m_write_pages[page] != nullptr : m_read_pages[page] != nullptr) {
+			return true;
+		}
+		return m_page_handlers[page] == Page_handler::scratchpad && Memory::Map::scratchpad.contains(physical_address);
+	}
+
 	Bios& m_bios;
 	Ram& m_ram;
 	Gpu& m_gpu;
+	Timers& m_timers;
+	Interrupt_controller& m_interrupts;
+	Dma& m_dma;
 
 	static constexpr uint8_t m_no_expansion { 0xff };
 	uint32_t dummy_variable {};
 
+	// Data cache used as fast ram
+	std::array<std::byte, 1024> m_scratchpad {};
+
 	static constexpr std::array<uint32_t, 8> region_mask {
 		// KUSEG
 		0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
@@ -31,4 +87,47 @@ struct Bus {
 		// KSEG2
 		0xffffffff, 0xffffffff
 	};
+
+	// Software page table over the 512MB physical address space. Ram and Bios
+	// pages point straight at host memory. Every other page names the handler
+	// that deals with it on the slow path.
+	static constexpr uint32_t page_shift { 12 };
+	static constexpr uint32_t page_size { 1 << page_shift };
+	static constexpr uint32_t physical_memory_size { 512 * 1024 * 1024 };
+	static constexpr uint32_t page_count { physical_memory_size / page_size };
+
+	enum class Page_handler : uint8_t {
+		unmapped,
+		host_memory,
+		bios,
+		scratchpad,
+		expansion_region_1,
+		io_ports,
+	};
+
+	std::vector<const std::byte*> m_read_pages {};
+	std::vector<std::byte*> m_write_pages {};
+	std::vector<Page_handler> m_page_handlers {};
+
+	void map_pages(uint32_t physical_address, uint32_t size, Page_handler handler);
+	void map_host_pages(uint32_t physical_address, uint32_t size, const std::byte* read, std::byte* write);
+
+	template<typename T>
+	static constexpr bool is_access_type {
+		std::is_same_v<T, uint8_t> || std::is_same_v<T, uint16_t> || std::is_same_v<T, uint32_t>
+	};
+
+	// Instantiated for the three access types in Bus.cpp
+	template<typename T>
+	T read_slow(uint32_t physical_address) const;
+	template<typename T>
+	void write_slow(uint32_t physical_address, T value);
+
+	// Hardware registers are 32 bits wide and take word aligned addresses.
+	// read_slow and write_slow align narrower accesses: reads see the part of
+	// the register their address selects, writes are shifted into that part.
+	// lanes holds the bits a write reaches. The interrupt controller and DMA
+	// keep the rest of the register; other devices see it written as zero.
+	uint32_t read_io(uint32_t physical_address) const;
+	void write_io(uint32_t physical_address, uint32_t value, uint32_t lanes = 0xffffffff);
 };
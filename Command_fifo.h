@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Bounded single producer, single consumer ring of GP0 and GP1 words, from
+// the CPU thread to the GPU worker. Each side only writes its own position
+// and keeps a cached copy of the other's, so a push or pop usually touches
+// no cache line the other thread is writing.
+class Command_fifo {
+public:
+    enum class Port : uint32_t {
+        gp0,
+        gp1,
+    };
+
+    struct Entry {
+        uint32_t word {};
+        Port port {};
+    };
+
+    static constexpr uint64_t capacity { 1 << 16 };
+
+    Command_fifo() : m_entries { std::make_unique<Entry[]>(capacity) } {
+    }
+
+    // Producer side. Copies as many entries as there is room for and
+    // publishes them at once, returns how many were taken.
+    size_t push(std::span<const Entry> entries) {
+        uint64_t free { capacity - (m_write_position_local - m_read_position_cached) };
+        if (free < entries.size()) {
+            m_read_position_cached = m_read_position.load(std::memory_order_acquire);
+            free = capacity - (m_write_position_local - m_read_position_cached);
+        }
+
+        size_t count { std::min<size_t>(entries.size(), free) };
+        for (size_t i { 0 }; i < count; i++) {
+            m_entries[(m_write_position_local + i) & (capacity - 1)] = entries[i];
+        }
+        m_write_position_local += count;
+        // Sequentially consistent so the worker cannot miss it between
+        // finding the ring empty and going to sleep
+        m_write_position.store(m_write_position_local, std::memory_order_seq_cst);
+        return count;
+    }
+
+    // Consumer side. Copies out up to entries.size() entries and frees their
+    // slots, returns how many there were.
+    size_t pop(std::span<Entry> entries) {
+        if (m_write_position_cached == m_read_position_local) {
+            m_write_position_cached = m_write_position.load(std::memory_order_seq_cst);
+        }
+
+        size_t count { std::min<size_t>(entries.size(), m_write_position_cached - m_read_position_local) };
+        for (size_t i { 0 }; i < count; i++) {
+            entries[i] = m_entries[(m_read_position_local + i) & (capacity - 1)];
+        }
+        m_read_position_local += count;
+        return count;
+    }
+
+    // Consumer side. Marks everything popped so far as processed.
+    void publish_processed() {
+        m_read_position.store(m_read_position_local, std::memory_order_release);
+    }
+
+    // Total entries pushed and processed since construction
+    uint64_t pushed() const { return m_write_position.load(std::memory_order_acquire); }
+    uint64_t processed() const { return m_read_position.load(std::memory_order_acquire); }
+    // Consumer side
+    bool empty() const { return m_write_position.load(std::memory_order_seq_cst) == m_read_position_local; }
+private:
+    std::unique_ptr<Entry[]> m_entries {};
+
+    alignas(64) std::atomic<uint64_t> m_write_position {};
+    uint64_t m_write_position_local {};
+    uint64_t m_read_position_cached {};
+
+    // Only advanced once popped entries have been processed, since the
+    // producer also waits on it to know how far the GPU has got
+    alignas(64) std::atomic<uint64_t> m_read_position {};
+    uint64_t m_read_position_local {};
+    uint64_t m_write_position_cached {};
+};
@@ -1,24 +1,91 @@
 #include "Cpu.h"
 #include "Instruction.h"
 
+#include <algorithm>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <limits>
-#include <optional>
 #include <span>
 
 #include "Logger.h"
+#include "Memory.h"
+
+void Cpu::set_backend(Backend backend) {
+	if (backend == Backend::recompiler && !Recompiler::available()) {
+		LOG_WARNING("[CPU] Recompiler unavailable on this host, using the interpreter");
+		backend = Backend::interpreter;
+	}
+
+	// Cached blocks are compiled for the backend they were decoded under
+	if (backend != m_backend) {
+		m_backend = backend;
+		flush_block_cache();
+	}
+}
+
+bool Cpu::start_trace(const std::string& path) {
+	auto writer { std::make_unique<Trace_writer>(path) };
+	if (!writer->is_open()) {
+		return false;
+	}
+	m_trace_writer = std::move(writer);
+	return true;
+}
+
+uint32_t Cpu::run(uint32_t budget) {
+	m_exception_raised = false;
+	uint64_t start { m_scheduler.now() };
+	uint64_t end { start + budget };
+	while (true) {
+		uint64_t now { m_scheduler.now() };
+		uint64_t until { std::min(end, m_scheduler.next_deadline()) };
+		if (now >= until) {
+			break;
+		}
+		m_scheduler.add_cycles(fetch_decode_execute(static_cast<uint32_t>(until - now)));
+
+		if (m_exception_raised) {
+			break;
+		}
+		if (!m_breakpoints.empty() && at_breakpoint()) {
+			break;
+		}
+	}
+	return static_cast<uint32_t>(m_scheduler.now() - start);
+}
+
+uint32_t Cpu::fetch_decode_execute(uint32_t budget) {
+	if (m_interrupt_pending) {
+		take_interrupt();
+		return 1;
+	}
 
-void Cpu::fetch_decode_execute() {
 	m_current_pc = m_pc;
 	if (m_current_pc % 4 != 0) {
 		exception(Exception::load_address_error);
-		return;
+		return 1;
+	}
+
+	// Copy out of the block: the handler may invalidate the block it came from
+	// if it writes to the page the code lives in.
+	const Decoded_instruction& decoded { next_decoded_instruction() };
+
+	// Native runs are entered on sequential execution only. Anything else, or
+	// a run whose first instruction is refused, steps through the interpreter.
+	if (decoded.native
+		&& decoded.native_length <= budget
+		&& m_next_pc == m_pc + Instruction::instruction_length
+		&& !m_trace_writer
+		&& !breakpoint_in_run(m_pc, decoded.native_length)) {
+		if (uint32_t executed { execute_native(decoded) }) {
+			return executed;
+		}
 	}
 
-	m_current_instruction = Instruction(read_memory(m_pc, 4), m_pc);
+	m_current_instruction = decoded.instruction;
+	Handler handler { decoded.handler };
 
 	m_pc = m_next_pc;
 	m_next_pc += 4;
@@ -26,242 +93,348 @@ void Cpu::fetch_decode_execute() {
 	m_is_branch_delay = m_was_branch;
 	m_was_branch = false;
 
-	// load the delayed data into the temp registers.
-	// The next next instruction won't see the new values yet.
-	// Also allows for the instruction to overwrite the delay slot's data
-	// which is a thing
-	if (m_load_delay_slot) {
-		set_register(m_load_delay_slot->reg, m_load_delay_slot->data);
-		m_load_delay_slot = std::nullopt;
+	if (m_trace_writer) {
+		m_trace_record = { m_current_pc, m_current_instruction.data() };
 	}
 
-	using enum Instruction::Opcode;
-	switch (m_current_instruction.opcode()) {
-		case andi: {
-			op_andi(m_current_instruction);
-			break;
-		}
-		case and_b: {
-			op_and(m_current_instruction);
-			break;
-		}
-		case or_b: {
-			op_or(m_current_instruction);
-			break;
-		}
-		case ori: {
-			op_ori(m_current_instruction);
-			break;
-		}
-		case nor: {
-			op_nor(m_current_instruction);
-			break;
-		}
-		case Xor: {
-			op_xor(m_current_instruction);
-			// std::exit(1);
-			break;
-		}
-		case addiu: {
-			op_addiu(m_current_instruction);
-			break;
-		}
-		case addi: {
-			op_addi(m_current_instruction);
-			break;
-		}
-		case addu: {
-			op_addu(m_current_instruction);
-			break;
-		}
-		case add: {
-			op_add(m_current_instruction);
-			break;
-		}
-		case subu: {
-			op_subu(m_current_instruction);
-			break;
-		}
-		case div: {
-			op_div(m_current_instruction);
-			break;
-		}
-		case divu: {
-			op_divu(m_current_instruction);
-			break;
-		}
-		case multu: {
-			op_multu(m_current_instruction);
-			break;
-		}
-		case slt: {
-			op_slt(m_current_instruction);
-			break;
-		}
-		case sltu: {
-			op_sltu(m_current_instruction);
-			break;
-		}
-		case slti: {
-			op_slti(m_current_instruction);
-			break;
-		}
-		case sltiu: {
-			op_sltiu(m_current_instruction);
-			break;
-		}
-		case sll: {
-			op_sll(m_current_instruction);
-			break;
-		}
-		case sllv: {
-			op_sllv(m_current_instruction);
-			break;
-		}
-		case srl: {
-			op_srl(m_current_instruction);
-			break;
-		}
-		case srav: {
-			op_srav(m_current_instruction);
-			break;
-		}
-		case srlv: {
-			op_srlv(m_current_instruction);
-			break;
-		}
-		case sra: {
-			op_sra(m_current_instruction);
-			break;
-		}
-		case lw: {
-			op_lw(m_current_instruction);
-			break;
-		}
-		case lb: {
-			op_lb(m_current_instruction);
-			break;
-		}
-		case lbu: {
-			op_lbu(m_current_instruction);
-			break;
-		}
-		case lhu: {
-			op_lhu(m_current_instruction);
-			break;
-		}
-		case lh: {
-			op_lh(m_current_instruction);
-			break;
-		}
-		case lwr: {
-			op_lwr(m_current_instruction);
-			break;
-		}
-		case sw: {
-			op_sw(m_current_instruction);
-			break;
-		}
-		case sh: {
-			op_sh(m_current_instruction);
-			break;
-		}
-		case sb: {
-			op_sb(m_current_instruction);
-			break;
-		}
-		case lui: {
-			op_lui(m_current_instruction);
-			break;
-		}
-		case jump: {
-			op_jump(m_current_instruction);
-			break;
-		}
-		case jal: {
-			op_jal(m_current_instruction);
-			break;
-		}
-		case jalr: {
-			op_jalr(m_current_instruction);
-			break;
-		}
-		case jr: {
-			op_jr(m_current_instruction);
-			break;
-		}
-		case bne: {
-			op_bne(m_current_instruction);
-			break;
-		}
-		case beq: {
-			op_beq(m_current_instruction);
-			break;
-		}
-		case bgtz: {
-			op_bgtz(m_current_instruction);
-			break;
-		}
-		case bgez: {
-			op_bgez(m_current_instruction);
-			break;
-		}
-		case blez: {
-			op_blez(m_current_instruction);
-			break;
-		}
-		case bltz: {
-			op_bltz(m_current_instruction);
-			break;
-		}
-		case mflo: {
-			op_mflo(m_current_instruction);
-			break;
-		}
-		case mfhi: {
-			op_mfhi(m_current_instruction);
-			break;
-		}
-		case mtlo: {
-			op_mtlo(m_current_instruction);
-			break;
-		}
-		case mthi: {
-			op_mthi(m_current_instruction);
-			break;
-		}
-		case mtc0: {
-			op_mtc0(m_current_instruction);
-			break;
+	(this->*handler)(m_current_instruction);
+
+	// The load issued by the previous instruction lands once this one is done,
+	// so this instruction still read the old value. If this instruction wrote
+	// the register itself, set_register has already cancelled the load.
+	// An empty slot targets r0, which keeps this free of branches.
+	m_registers[static_cast<uint32_t>(m_load_delay_slot.reg)] = m_load_delay_slot.data;
+	m_registers[0] = 0;
+	m_load_delay_slot = m_next_load_delay_slot;
+	m_next_load_delay_slot = {};
+
+	if (m_trace_writer) {
+		m_trace_writer->append(m_trace_record);
+	}
+
+	return 1;
+}
+
+// A breakpoint on the first instruction is where the last run stopped, and
+// is stepped over the same way by the interpreter
+bool Cpu::breakpoint_in_run(uint32_t address, uint32_t length) const {
+	if (m_breakpoints.empty()) {
+		return false;
+	}
+	for (uint32_t i { 1 }; i < length; i++) {
+		if (m_breakpoints.contains(address + i * Instruction::instruction_length)) {
+			return true;
 		}
-		case mfc0: {
-			op_mfc0(m_current_instruction);
-			break;
+	}
+	return false;
+}
+
+// Runs a compiled run and picks up after the instructions it got through.
+// Returns how many that was, 0 if the interpreter has to run the first one.
+uint32_t Cpu::execute_native(const Decoded_instruction& decoded) {
+	// A store in the run may drop the block decoded comes from
+	uint32_t start_pc { m_pc };
+	uint32_t length { decoded.native_length };
+	bool ends_with_branch { decoded.native_branch };
+
+	m_native_state.pc = start_pc;
+	m_native_state.load_register = static_cast<uint32_t>(m_load_delay_slot.reg);
+	m_native_state.load_value = m_load_delay_slot.data;
+	uint32_t executed { decoded.native(m_registers.data(), &m_native_state) };
+	m_load_delay_slot = { static_cast<Register>(m_native_state.load_register), m_native_state.load_value };
+	if (executed == 0) {
+		return 0;
+	}
+
+	uint32_t run_bytes { executed * Instruction::instruction_length };
+	m_current_pc = start_pc + run_bytes - Instruction::instruction_length;
+	m_pc = start_pc + run_bytes;
+	m_next_pc = m_pc + Instruction::instruction_length;
+	m_is_branch_delay = false;
+	m_was_branch = false;
+	if (ends_with_branch && executed == length) {
+		m_pc = m_native_state.next_pc;
+		m_next_pc = m_pc + Instruction::instruction_length;
+	} else if (ends_with_branch && executed == length - 1) {
+		// Stopped before the delay slot, which the interpreter runs next
+		m_next_pc = m_native_state.next_pc;
+		m_was_branch = m_native_state.was_branch != 0;
+	}
+
+	// Carry on through the block, unless it was dropped
+	if (m_current_block) {
+		m_block_index += executed - 1;
+		m_block_pc = start_pc + run_bytes;
+		m_current_instruction = m_current_block->instructions[m_block_index - 1].instruction;
+	}
+
+	return executed;
+}
+
+template<typename T>
+uint64_t Cpu::native_read(void* context, uint32_t address) {
+	Cpu& cpu { *static_cast<Cpu*>(context) };
+	if (address % sizeof(T) != 0 || !cpu.m_bus.is_plain_memory(address, false)) {
+		return Recompiler::refused_read;
+	}
+	return cpu.m_bus.read<T>(address);
+}
+
+template<typename T>
+uint32_t Cpu::native_write(void* context, uint32_t address, uint32_t value) {
+	Cpu& cpu { *static_cast<Cpu*>(context) };
+	bool cache_isolated { (cpu.cop0_get_register_data(Cop0_Register::sr) & 0x10000) != 0 };
+	if (address % sizeof(T) != 0 || cache_isolated || !cpu.m_bus.is_plain_memory(address, true)) {
+		return Recompiler::write_refused;
+	}
+	cpu.m_bus.write<T>(address, static_cast<T>(value));
+
+	uint32_t physical_address { block_address(address) };
+	if (Memory::Map::ram.contains(physical_address)) {
+		const Block* block { cpu.m_current_block };
+		cpu.invalidate_blocks(physical_address);
+		// The rest of the run may have been overwritten
+		if (cpu.m_current_block != block) {
+			return Recompiler::write_stop;
 		}
-		case syscall: {
-			op_syscall(m_current_instruction);
+	}
+	return Recompiler::write_done;
+}
+
+const Recompiler::Memory_functions Cpu::m_native_memory {
+	.read_8 = &Cpu::native_read<uint8_t>,
+	.read_16 = &Cpu::native_read<uint16_t>,
+	.read_32 = &Cpu::native_read<uint32_t>,
+	.write_8 = &Cpu::native_write<uint8_t>,
+	.write_16 = &Cpu::native_write<uint16_t>,
+	.write_32 = &Cpu::native_write<uint32_t>,
+};
+
+// Returns the next instruction from the current block, or looks up (and decodes
+// if needed) the block starting at the pc when execution has left it.
+const Cpu::Decoded_instruction& Cpu::next_decoded_instruction() {
+	if (m_current_block == nullptr
+		|| m_pc != m_block_pc
+		|| m_block_index >= m_current_block->instructions.size()) {
+		m_current_block = &fetch_block(m_pc);
+		m_block_index = 0;
+	}
+
+	m_block_pc = m_pc + Instruction::instruction_length;
+	return m_current_block->instructions[m_block_index++];
+}
+
+// Ram mirrors share their blocks, so blocks are keyed by the first copy.
+uint32_t Cpu::block_address(uint32_t address) {
+	uint32_t physical_address { Bus::to_physical_address(address) };
+	if (Memory::Map::ram_mirrors.contains(physical_address)) {
+		return Memory::Map::ram.start() + (physical_address & (Memory::Map::ram.size() - 1));
+	}
+	return physical_address;
+}
+
+Cpu::Block& Cpu::fetch_block(uint32_t pc) {
+	uint32_t physical_pc { block_address(pc) };
+	if (auto it { m_block_cache.find(physical_pc) }; it != m_block_cache.end()) {
+		return it->second;
+	}
+
+	// Start over once there is no guaranteed room for another block's code
+	if (m_backend == Backend::recompiler
+		&& m_recompiler.free_space() < Recompiler::max_instruction_size * m_block_page_size / Instruction::instruction_length) {
+		flush_block_cache();
+		m_recompiler.reset();
+	}
+
+	Block block {};
+	// Only Ram and Bios hold code worth caching. Anything else gets decoded one
+	// instruction at a time so we never read past the end of a device.
+	bool cacheable { Memory::Map::ram.contains(physical_pc) || Memory::Map::bios.contains(physical_pc) };
+	uint32_t block_pc { pc };
+	bool in_delay_slot { false };
+	while (true) {
+		Instruction instruction { read_memory<uint32_t>(block_pc), block_pc };
+		block.instructions.push_back({ instruction, handler_for(instruction.opcode()) });
+		block_pc += Instruction::instruction_length;
+
+		// The block ends with the branch delay slot
+		if (in_delay_slot) {
 			break;
 		}
-		case rfe: {
-			op_rfe(m_current_instruction);
+		in_delay_slot = instruction.is_branch();
+
+		// Blocks never cross a page so a write only has to invalidate one page.
+		bool page_end { (block_pc & (m_block_page_size - 1)) == 0 };
+		if (!cacheable || page_end) {
 			break;
 		}
-		case unknown: {
-			std::stringstream ss;
-			ss << "[CPU] Unknown instruction: 0x" << std::hex << m_current_instruction.data();
-			Logger::log(Logger::Level::error, ss.str());
-			std::exit(1);
+	}
+
+	if (m_backend == Backend::recompiler) {
+		compile_block(block);
+	}
+
+	if (!cacheable) {
+		m_uncached_block = std::move(block);
+		return m_uncached_block;
+	}
+
+	// The Bios is read only, so only Ram pages need to know which blocks they hold.
+	if (Memory::Map::ram.contains(physical_pc)) {
+		m_ram_page_blocks[Memory::Map::ram.offset(physical_pc) / m_block_page_size].push_back(physical_pc);
+	}
+
+	return m_block_cache.emplace(physical_pc, std::move(block)).first->second;
+}
+
+// Drops every cached block in the Ram page the physical address belongs to.
+void Cpu::invalidate_blocks(uint32_t physical_address) {
+	auto& page_blocks { m_ram_page_blocks[Memory::Map::ram.offset(physical_address) / m_block_page_size] };
+	if (page_blocks.empty()) {
+		return;
+	}
+
+	for (uint32_t block_pc : page_blocks) {
+		auto it { m_block_cache.find(block_pc) };
+		if (&it->second == m_current_block) {
+			m_current_block = nullptr;
 		}
+		m_block_cache.erase(it);
 	}
+	page_blocks.clear();
+}
 
-	// Update the registers
-	m_registers = m_temp_registers;
-	m_cop0_registers = m_cop0_temp_registers;
+void Cpu::invalidate_ram(uint32_t physical_address, uint32_t size) {
+	uint32_t first_page { Memory::Map::ram.offset(physical_address) / m_block_page_size };
+	uint32_t last_page { Memory::Map::ram.offset(physical_address + size - 1) / m_block_page_size };
+	for (uint32_t page { first_page }; page <= last_page; page++) {
+		invalidate_blocks(Memory::Map::ram.start() + page * m_block_page_size);
+	}
+}
+
+void Cpu::flush_block_cache() {
+	m_block_cache.clear();
+	for (auto& page_blocks : m_ram_page_blocks) {
+		page_blocks.clear();
+	}
+	m_current_block = nullptr;
+}
+
+// Compiles every run of consecutive instructions the recompiler supports.
+// The native code is attached to the first instruction of the run. A branch
+// only goes in with its delay slot, which ends the block.
+void Cpu::compile_block(Block& block) {
+	auto& instructions { block.instructions };
+	std::vector<Instruction> run {};
+	for (size_t start { 0 }; start < instructions.size(); start += std::max<size_t>(run.size(), 1)) {
+		run.clear();
+		bool ends_with_branch { false };
+		for (size_t i { start }; i < instructions.size() && Recompiler::is_supported(instructions[i].instruction); i++) {
+			const Instruction& instruction { instructions[i].instruction };
+			if (instruction.is_branch()) {
+				bool has_delay_slot { i + 2 == instructions.size()
+					&& Recompiler::is_supported(instructions[i + 1].instruction)
+					&& !instructions[i + 1].instruction.is_branch() };
+				if (has_delay_slot) {
+					run.push_back(instruction);
+					run.push_back(instructions[i + 1].instruction);
+					ends_with_branch = true;
+				}
+				break;
+			}
+			run.push_back(instruction);
+		}
+
+		// A single instruction isn't worth the call
+		if (run.size() < 2) {
+			continue;
+		}
+
+		instructions[start].native = m_recompiler.compile(run);
+		instructions[start].native_length = static_cast<uint32_t>(run.size());
+		instructions[start].native_branch = ends_with_branch;
+	}
 }
 
+constexpr std::array<Cpu::Handler, Instruction::opcode_count> Cpu::build_handler_table() {
+	std::array<Handler, Instruction::opcode_count> handlers {};
+	handlers.fill(&Cpu::op_unknown);
+	auto handler = [&](Instruction::Opcode opcode, Handler function) {
+		handlers[static_cast<size_t>(opcode)] = function;
+	};
+
+	using enum Instruction::Opcode;
+	handler(andi, &Cpu::op_andi);
+	handler(and_b, &Cpu::op_and);
+	handler(or_b, &Cpu::op_or);
+	handler(ori, &Cpu::op_ori);
+	handler(nor, &Cpu::op_nor);
+	handler(Xor, &Cpu::op_xor);
+	handler(addiu, &Cpu::op_addiu);
+	handler(addi, &Cpu::op_addi);
+	handler(addu, &Cpu::op_addu);
+	handler(add, &Cpu::op_add);
+	handler(subu, &Cpu::op_subu);
+	handler(div, &Cpu::op_div);
+	handler(divu, &Cpu::op_divu);
+	handler(multu, &Cpu::op_multu);
+	handler(slt, &Cpu::op_slt);
+	handler(sltu, &Cpu::op_sltu);
+	handler(slti, &Cpu::op_slti);
+	handler(sltiu, &Cpu::op_sltiu);
+	handler(sll, &Cpu::op_sll);
+	handler(sllv, &Cpu::op_sllv);
+	handler(srl, &Cpu::op_srl);
+	handler(srav, &Cpu::op_srav);
+	handler(srlv, &Cpu::op_srlv);
+	handler(sra, &Cpu::op_sra);
+	handler(lw, &Cpu::op_lw);
+	handler(lb, &Cpu::op_lb);
+	handler(lbu, &Cpu::op_lbu);
+	handler(lhu, &Cpu::op_lhu);
+	handler(lh, &Cpu::op_lh);
+	handler(lwr, &Cpu::op_lwr);
+	handler(sw, &Cpu::op_sw);
+	handler(sh, &Cpu::op_sh);
+	handler(sb, &Cpu::op_sb);
+	handler(lui, &Cpu::op_lui);
+	handler(jump, &Cpu::op_jump);
+	handler(jal, &Cpu::op_jal);
+	handler(jalr, &Cpu::op_jalr);
+	handler(jr, &Cpu::op_jr);
+	handler(bne, &Cpu::op_bne);
+	handler(beq, &Cpu::op_beq);
+	handler(bgtz, &Cpu::op_bgtz);
+	handler(bgez, &Cpu::op_bgez);
+	handler(blez, &Cpu::op_blez);
+	handler(bltz, &Cpu::op_bltz);
+	handler(mflo, &Cpu::op_mflo);
+	handler(mfhi, &Cpu::op_mfhi);
+	handler(mtlo, &Cpu::op_mtlo);
+	handler(mthi, &Cpu::op_mthi);
+	handler(mtc0, &Cpu::op_mtc0);
+	handler(mfc0, &Cpu::op_mfc0);
+	handler(syscall, &Cpu::op_syscall);
+	handler(rfe, &Cpu::op_rfe);
+	handler(unknown, &Cpu::op_unknown);
+
+	return handlers;
+}
+
+constexpr std::array<Cpu::Handler, Instruction::opcode_count> Cpu::m_handlers { build_handler_table() };
+
 void Cpu::set_register(Register reg, uint32_t data) {
-	m_temp_registers[static_cast<uint32_t>(reg)] = data;
-	m_temp_registers[0] = 0;
+	m_registers[static_cast<uint32_t>(reg)] = data;
+	m_registers[0] = 0;
+
+	if (m_trace_writer) {
+		trace_register(reg, data);
+	}
+
+	// A direct write wins over a load landing in the same register
+	if (m_load_delay_slot.reg == reg) {
+		m_load_delay_slot = {};
+	}
 }
 
 uint32_t Cpu::get_register_data(Register reg) const {
@@ -269,45 +442,72 @@ uint32_t Cpu::get_register_data(Register reg) const {
 }
 
 void Cpu::cop0_set_register(Cop0_Register reg, uint32_t data) {
-	m_cop0_temp_registers[static_cast<uint32_t>(reg)] = data;
-	m_cop0_temp_registers[0] = 0;
-}
+	m_cop0_registers[static_cast<uint32_t>(reg)] = data;
+	m_cop0_registers[0] = 0;
 
-uint32_t Cpu::cop0_get_register_data(Cop0_Register reg) const {
-	return m_cop0_registers[static_cast<uint32_t>(reg)];
+	if (reg == Cop0_Register::sr || reg == Cop0_Register::cause) {
+		update_interrupt_pending();
+	}
 }
 
-std::span<const std::byte> Cpu::read_memory(uint32_t address, uint32_t bytes) {
-	return m_bus.read_memory(address, bytes);
+// Interrupts are taken when IEc is set and a pending CAUSE.IP bit is
+// enabled in SR.IM
+void Cpu::update_interrupt_pending() {
+	uint32_t sr { cop0_get_register_data(Cop0_Register::sr) };
+	uint32_t cause { cop0_get_register_data(Cop0_Register::cause) };
+	m_interrupt_pending = (sr & 0x1) && (sr & cause & 0xff00);
 }
 
-void Cpu::write_memory(uint32_t address, std::span<const std::byte> data) {
-	// Cache is isolated
-	if ((cop0_get_register_data(Cop0_Register::sr) & 0x10000) != 0) {
-		Logger::log(Logger::Level::warning, "[CPU] Cache isolated: Ignoring write");
-		return;
-	}
-	m_bus.write_memory(address, data);
+void Cpu::set_interrupt_line(bool active) {
+	uint32_t cause { cop0_get_register_data(Cop0_Register::cause) };
+	cause = active ? (cause | 0x400) : (cause & ~0x400u);
+	cop0_set_register(Cop0_Register::cause, cause);
 }
 
-uint32_t to_32(std::span<const std::byte> data) {
-	uint32_t word {};
-	std::memcpy(&word, data.data(), sizeof(word));
-	return word;
+// Enters the exception handler in place of the instruction at the pc. The
+// instruction runs again once the handler returns to EPC.
+void Cpu::take_interrupt() {
+	m_current_pc = m_pc;
+	m_is_branch_delay = m_was_branch;
+	m_was_branch = false;
+
+	exception(Exception::interrupt);
+
+	// The load issued before the interrupt still lands
+	m_registers[static_cast<uint32_t>(m_load_delay_slot.reg)] = m_load_delay_slot.data;
+	m_registers[0] = 0;
+	m_load_delay_slot = {};
 }
 
-uint16_t to_16(std::span<const std::byte> data) {
-	uint16_t h_word {};
-	std::memcpy(&h_word, data.data(), sizeof(h_word));
+uint32_t Cpu::cop0_get_register_data(Cop0_Register reg) const {
+	return m_cop0_registers[static_cast<uint32_t>(reg)];
+}
 
-	return h_word;
+template<typename T>
+T Cpu::read_memory(uint32_t address) {
+	T value { m_bus.read<T>(address) };
+	if (m_trace_writer) {
+		trace_memory(Trace_record::memory_read, address, value, sizeof(T));
+	}
+	return value;
 }
 
-uint8_t to_8(std::span<const std::byte> data) {
-	uint8_t byte {};
-	std::memcpy(&byte, data.data(), sizeof(byte));
+template<typename T>
+void Cpu::write_memory(uint32_t address, T value) {
+	// Cache is isolated
+	if ((cop0_get_register_data(Cop0_Register::sr) & 0x10000) != 0) {
+		LOG_WARNING("[CPU] Cache isolated: Ignoring write");
+		return;
+	}
+	m_bus.write<T>(address, value);
+	if (m_trace_writer) {
+		trace_memory(Trace_record::memory_write, address, value, sizeof(T));
+	}
 
-	return byte;
+	uint32_t physical_address { block_address(address) };
+	if (Memory::Map::ram.contains(physical_address)) {
+		invalidate_blocks(physical_address);
+	}
 }
 
 void Cpu::branch(uint32_t offset) {
@@ -318,10 +518,32 @@ void Cpu::branch(uint32_t offset) {
 }
 
 void Cpu::load_delay_data(Register reg, uint32_t data) {
-	m_load_delay_slot = { reg, data };
+	m_next_load_delay_slot = { reg, data };
+
+	if (m_trace_writer) {
+		trace_register(reg, data);
+	}
+}
+
+void Cpu::trace_register(Register reg, uint32_t data) {
+	if (reg == Register::zero) {
+		return;
+	}
+	m_trace_record.destination = static_cast<uint8_t>(reg);
+	m_trace_record.register_value = data;
+	m_trace_record.flags |= Trace_record::register_write;
+}
+
+void Cpu::trace_memory(uint8_t flag, uint32_t address, uint32_t value, uint8_t width) {
+	m_trace_record.memory_address = address;
+	m_trace_record.memory_value = value;
+	m_trace_record.memory_width = width;
+	m_trace_record.flags |= flag;
 }
 
 void Cpu::exception(Exception excode) {
+	m_exception_raised = true;
+
 	uint32_t sr { cop0_get_register_data(Cop0_Register::sr) };
 	// Find exception handler address based on BEV bit
 	uint32_t handler { (sr & (1 << 22)) ? 0xbfc00180 : 0x80000080 };
@@ -331,7 +553,9 @@ void Cpu::exception(Exception excode) {
 	sr |= (mode << 2) & 0x3f;
 	cop0_set_register(Cop0_Register::sr, sr);
 
-	uint32_t cause { static_cast<uint32_t>(excode) << 2 };
+	// The interrupt pending bits stay as they are
+	uint32_t cause { cop0_get_register_data(Cop0_Register::cause) & 0xff00 };
+	cause |= static_cast<uint32_t>(excode) << 2;
 
 	if (m_is_branch_delay) {
 		cause |= 1 << 31;
@@ -350,22 +574,27 @@ void Cpu::exception(Exception excode) {
 
 }
 
+void Cpu::op_unknown(const Instruction& instruction) {
+	LOG_ERROR("[CPU] Unknown instruction: 0x{:x}", instruction.data());
+	std::exit(1);
+}
+
 void Cpu::op_lwr(const Instruction& instruction) {
 	uint32_t address { get_register_data(instruction.base()) + instruction.imm16_se() };
-	
-	uint32_t latest_value { m_temp_registers[static_cast<uint32_t>(instruction.rt())] };
 
-	uint32_t bytes { address & 0x3 };
-	// Get the number of bytes we are out of alignment by and subtract it from size of a word
-	uint32_t word { to_32(read_memory(address, 4 - bytes)) };
+	// Merges with a load still in flight to the same register
+	uint32_t latest_value { m_load_delay_slot.reg == instruction.rt()
+		? m_load_delay_slot.data
+		: get_register_data(instruction.rt()) };
 
-	// Shave off bytes
-	latest_value >>= 32 - 8 * bytes;
-	latest_value <<= 32 - 8 * bytes;
-	latest_value |= word;
-	
-	load_delay_data(instruction.rt(), latest_value);
+	// Load the bytes from the address up to the end of its word into the low
+	// end of the register, keeping the rest of the register as it was.
+	uint32_t word { read_memory<uint32_t>(address & ~0x3u) };
+	uint32_t shift { (address & 0x3) * 8 };
+	uint32_t kept_mask { shift == 0 ? 0 : ~(0xffffffffu >> shift) };
+	latest_value = (latest_value & kept_mask) | (word >> shift);
 
+	load_delay_data(instruction.rt(), latest_value);
 }
 
 void Cpu::op_xor(const Instruction& instruction) {
@@ -413,7 +642,7 @@ void Cpu::op_lh(const Instruction& instruction) {
 		return;
 	}
 
-	load_delay_data(instruction.rt(), static_cast<int16_t>(to_16(read_memory(address, 2))));
+	load_delay_data(instruction.rt(), static_cast<int16_t>(read_memory<uint16_t>(address)));
 }
 
 void Cpu::op_sllv(const Instruction& instruction) {
@@ -430,7 +659,7 @@ void Cpu::op_lhu(const Instruction& instruction) {
 		return;
 	}
 
-	load_delay_data(instruction.rt(), to_16(read_memory(address, 2)));
+	load_delay_data(instruction.rt(), read_memory<uint16_t>(address));
 }
 
 void Cpu::op_rfe(const Instruction& instruction) {
@@ -444,8 +673,9 @@ void Cpu::op_rfe(const Instruction& instruction) {
 	// sr <<= 4;
 	// sr |= status_bits;
 
-	auto mode { sr & 0x3f };
-	sr &= ~0x3f;
+	// Pops the interrupt enable / user mode stack. The old pair is kept.
+	auto mode { sr & 0x3c };
+	sr &= ~0xfu;
 	sr |= mode >> 2;
 
 	cop0_set_register(Cop0_Register::sr, sr);
@@ -560,14 +790,16 @@ void Cpu::op_bltz(const Instruction& instruction) {
 }
 
 void Cpu::op_jalr(const Instruction& instruction) {
+	// Read rs first, rd may be the same register
+	uint32_t address { get_register_data(instruction.rs()) };
 	set_register(instruction.rd(), m_next_pc);
-	m_next_pc = get_register_data(instruction.rs());
+	m_next_pc = address;
 }
 
 void Cpu::op_lbu(const Instruction& instruction) {
 	uint32_t address { get_register_data(instruction.base()) + instruction.imm16_se() };
 
-	load_delay_data(instruction.rt(), to_8(read_memory(address, 1)));
+	load_delay_data(instruction.rt(), read_memory<uint8_t>(address));
 }
 
 void Cpu::op_blez(const Instruction& instruction) {
@@ -627,7 +859,7 @@ void Cpu::op_lb(const Instruction& instruction) {
 	uint32_t address { get_register_data(instruction.base()) + instruction.imm16_se() };
 
 	load_delay_data(instruction.rt(), 
-				 static_cast<uint32_t>(static_cast<int8_t>(to_8(read_memory(address, 1)))));
+				 static_cast<uint32_t>(static_cast<int8_t>(read_memory<uint8_t>(address))));
 }
 
 void Cpu::op_jr(const Instruction& instruction) {
@@ -639,7 +871,7 @@ void Cpu::op_sb(const Instruction& instruction) {
 	uint32_t address { get_register_data(instruction.base()) + instruction.imm16_se() };
 	uint8_t result { static_cast<uint8_t>(get_register_data(instruction.rt())) };
 
-	write_memory(address, std::as_bytes(std::span{ &result, 1 }));
+	write_memory(address, result);
 }
 
 void Cpu::op_andi(const Instruction& instruction) {
@@ -661,7 +893,7 @@ void Cpu::op_sh(const Instruction& instruction) {
 	}
 
 	uint16_t result { static_cast<uint16_t>(rt_data) };
-	write_memory(address, std::as_bytes(std::span(&result, 1)));
+	write_memory(address, result);
 }
 
 void Cpu::op_addu(const Instruction& instruction) {
@@ -684,7 +916,7 @@ void Cpu::op_lw(const Instruction& instruction) {
 	}
 
 
-	load_delay_data(instruction.rt(), to_32(read_memory(address, 4)));
+	load_delay_data(instruction.rt(), read_memory<uint32_t>(address));
 }
 
 void Cpu::op_addi(const Instruction& instruction) {
@@ -711,6 +943,12 @@ void Cpu::op_bne(const Instruction& instruction) {
 
 void Cpu::op_mtc0(const Instruction& instruction) {
 	uint32_t rt_data { get_register_data(instruction.rt()) };
+
+	// Only the two software interrupt bits of CAUSE are writable
+	if (instruction.cop0_rd() == Cop0_Register::cause) {
+		uint32_t cause { cop0_get_register_data(Cop0_Register::cause) };
+		rt_data = (cause & ~0x300u) | (rt_data & 0x300);
+	}
 	cop0_set_register(instruction.cop0_rd(), rt_data);
 }
 
@@ -747,7 +985,7 @@ void Cpu::op_sw(const Instruction& instruction) {
 	}
 	
 	uint32_t result { get_register_data(instruction.rt()) };
-	write_memory(address, std::as_bytes(std::span{ &result, 1 }));
+	write_memory(address, result);
 }
 
 void Cpu::op_ori(const Instruction& instruction) {
@@ -2,19 +2,66 @@
 
 #include "Bus.h"
 #include "Instruction.h"
+#include "Recompiler.h"
+#include "Scheduler.h"
+#include "Trace.h"
 
 #include <array>
 #include <cstdint>
-#include <optional>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Memory.h"
 
 class Cpu {
 public:
-	explicit Cpu(Bus& bus): m_bus { bus }
+	Cpu(Bus& bus, Scheduler& scheduler): m_bus { bus }, m_scheduler { scheduler }
 	{
 	}
 
-	void fetch_decode_execute();
+	// The interpreter is the reference. The recompiler runs what it can as
+	// native code and hands everything else back to the interpreter.
+	enum class Backend {
+		interpreter,
+		recompiler,
+	};
+
+	void set_backend(Backend backend);
+	Backend get_backend() const { return m_backend; }
+
+	// Executes the next instruction, or a native run of at most budget
+	// instructions. Returns the number of instructions executed.
+	uint32_t fetch_decode_execute(uint32_t budget = 1);
+
+	// Executes until the budget is spent, the next scheduled event is due, an
+	// exception is raised or the pc reaches a breakpoint. Breakpoints stop
+	// the recompiler too: runs that hold one are interpreted. Every instruction
+	// moves the scheduler's clock by one cycle as it runs, so an event a
+	// device schedules mid-run still ends the run on time. Due events are left
+	// for the caller to run. Returns the number of instructions executed.
+	uint32_t run(uint32_t budget);
+
+	void add_breakpoint(uint32_t address) { m_breakpoints.insert(address); }
+	void remove_breakpoint(uint32_t address) { m_breakpoints.erase(address); }
+	bool at_breakpoint() const { return m_breakpoints.contains(m_pc); }
+
+	// Appends a Trace_record for every instruction executed from now on.
+	// Compiled runs are not traced, so the interpreter steps through them.
+	// Returns false if the trace file could not be created.
+	bool start_trace(const std::string& path);
+	void stop_trace() { m_trace_writer.reset(); }
+	bool tracing() const { return m_trace_writer != nullptr; }
+
+	// Drops cached code in a range of Ram that was written behind the CPU's
+	// back, by DMA
+	void invalidate_ram(uint32_t physical_address, uint32_t size);
+
+	// Drives CAUSE bit 10, the hardware interrupt from the interrupt controller
+	void set_interrupt_line(bool active);
 
 	uint32_t get_register_data(Register reg) const;
 	uint32_t cop0_get_register_data(Cop0_Register reg) const;
@@ -25,6 +72,7 @@ public:
 	uint32_t get_next_pc() const { return m_next_pc; }
 private:
 	Bus& m_bus;
+	Scheduler& m_scheduler;
 	
 	// Holds the address of the instruction to be executed
 	uint32_t m_pc { 0xbfc00000 };
@@ -36,32 +84,111 @@ private:
 	bool m_was_branch {};
 	bool m_is_branch_delay {};
 
-	std::array<uint32_t, 32> m_registers {};
-	std::array<uint32_t, 32> m_temp_registers {};
+	// Set whenever an exception is raised so run() can hand control back
+	bool m_exception_raised {};
+	// An unmasked interrupt is pending and interrupts are enabled. Only
+	// recomputed when SR or CAUSE change, see cop0_set_register.
+	bool m_interrupt_pending {};
+	std::unordered_set<uint32_t> m_breakpoints {};
 
+	std::array<uint32_t, 32> m_registers {};
 	std::array<uint32_t, 16> m_cop0_registers {};
-	std::array<uint32_t, 16> m_cop0_temp_registers {};
 
 	uint32_t m_hi {};
 	uint32_t m_lo {};
 
 	Instruction m_current_instruction {};
 
-	std::span<const std::byte> read_memory(uint32_t address, uint32_t bytes);
-	void write_memory(uint32_t address, std::span<const std::byte> data);
+	using Handler = void (Cpu::*)(const Instruction&);
+
+	struct Decoded_instruction {
+		Instruction instruction {};
+		Handler handler {};
+		// Native code for the run of instructions starting here, if any
+		Recompiler::Function native {};
+		uint32_t native_length {};
+		// The run ends with a branch and its delay slot
+		bool native_branch {};
+	};
+
+	// A straight-line run of decoded instructions, ending after the delay slot
+	// of the first branch or at the end of a page.
+	struct Block {
+		std::vector<Decoded_instruction> instructions {};
+	};
+
+	static constexpr uint32_t m_block_page_size { 4096 };
+
+	// Blocks keyed by the physical address of their first instruction, with
+	// Ram mirrors folded onto the first copy
+	std::unordered_map<uint32_t, Block> m_block_cache {};
+	// Start addresses of the cached blocks in each page of Ram
+	std::array<std::vector<uint32_t>, Memory::Map::ram.size() / m_block_page_size> m_ram_page_blocks {};
+	// Holds code that runs from outside Ram and Bios, which is never cached
+	Block m_uncached_block {};
+
+	Block* m_current_block {};
+	uint32_t m_block_index {};
+	// Address the next instruction in the current block was decoded from
+	uint32_t m_block_pc {};
+
+	std::unique_ptr<Trace_writer> m_trace_writer {};
+	// Filled in while the current instruction executes
+	Trace_record m_trace_record {};
+
+	void trace_register(Register reg, uint32_t data);
+	void trace_memory(uint8_t flag, uint32_t address, uint32_t value, uint8_t width);
+
+	Backend m_backend { Backend::interpreter };
+	// Native code reaches memory through these, with the Cpu as context.
+	// Only aligned accesses to Ram, Bios and the scratchpad are made there.
+	// Devices are left to the interpreter, so they see accesses when the
+	// scheduler's clock says they happen, and so are address errors and
+	// writes with the cache isolated.
+	static const Recompiler::Memory_functions m_native_memory;
+	template<typename T>
+	static uint64_t native_read(void* context, uint32_t address);
+	template<typename T>
+	static uint32_t native_write(void* context, uint32_t address, uint32_t value);
+	Recompiler m_recompiler { m_native_memory };
+	Recompiler::State m_native_state { .context = this };
+
+	static uint32_t block_address(uint32_t address);
+	const Decoded_instruction& next_decoded_instruction();
+	Block& fetch_block(uint32_t pc);
+	void invalidate_blocks(uint32_t physical_address);
+	void flush_block_cache();
+	void compile_block(Block& block);
+	uint32_t execute_native(const Decoded_instruction& decoded);
+	// Whether a breakpoint sits on an instruction after the first of the
+	// run of length instructions starting at address
+	bool breakpoint_in_run(uint32_t address, uint32_t length) const;
+	// Handlers indexed by opcode
+	static const std::array<Handler, Instruction::opcode_count> m_handlers;
+	static constexpr std::array<Handler, Instruction::opcode_count> build_handler_table();
+	static Handler handler_for(Instruction::Opcode opcode) { return m_handlers[static_cast<size_t>(opcode)]; }
+
+	template<typename T>
+	T read_memory(uint32_t address);
+	template<typename T>
+	void write_memory(uint32_t address, T value);
 
 	
 	void set_register(Register reg, uint32_t data);
 
 	void cop0_set_register(Cop0_Register reg, uint32_t data);
 
-	// Delay moving data from memory into registers by 1 cycle
+	// Delay moving data from memory into registers by 1 cycle.
+	// An empty slot targets r0.
 	struct Load_delay {
-		Register reg {};
+		Register reg { Register::zero };
 		uint32_t data {};
 	};
-	
-	std::optional<Load_delay> m_load_delay_slot {};
+
+	// Load issued by the previous instruction, lands after the current one
+	Load_delay m_load_delay_slot {};
+	// Load issued by the current instruction
+	Load_delay m_next_load_delay_slot {};
 
 	void load_delay_data(Register reg, uint32_t data);
 
@@ -81,6 +208,8 @@ private:
 	};
 
 	void exception(Exception excode);
+	void update_interrupt_pending();
+	void take_interrupt();
 	std::string_view exception_name(Exception exception) const;
 
 	void op_lui(const Instruction& instruction);
@@ -135,4 +264,5 @@ private:
 	void op_multu(const Instruction& instruction);
 	void op_xor(const Instruction& instruction);
 	void op_lwr(const Instruction& instruction);
+	void op_unknown(const Instruction& instruction);
 };
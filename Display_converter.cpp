@@ -0,0 +1,190 @@
+#include "Display_converter.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SOULPSX_DISPLAY_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr uint32_t opaque { 0xff000000 };
+
+    // The three 5 bit channels moved to the bottom of their bytes, then
+    // widened to 8 bits by repeating their top bits underneath
+    constexpr uint32_t widen(uint32_t pixel) {
+        uint32_t channels { (pixel & 0x1f) | ((pixel & 0x3e0) << 3) | ((pixel & 0x7c00) << 6) };
+        return (channels << 3) | ((channels >> 2) & 0x070707) | opaque;
+    }
+
+    bool has_avx2() {
+#ifdef SOULPSX_DISPLAY_AVX2
+        static const bool supported { __builtin_cpu_supports("avx2") != 0 };
+        return supported;
+#else
+        return false;
+#endif
+    }
+}
+
+#ifdef SOULPSX_DISPLAY_AVX2
+
+namespace {
+    __attribute__((target("avx2")))
+    __m256i widen_lanes(__m256i pixels) {
+        __m256i channels { _mm256_or_si256(_mm256_and_si256(pixels, _mm256_set1_epi32(0x1f)),
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x3e0)), 3),
+                _mm256_slli_epi32(_mm256_and_si256(pixels, _mm256_set1_epi32(0x7c00)), 6))) };
+        __m256i low_bits { _mm256_and_si256(_mm256_srli_epi32(channels, 2), _mm256_set1_epi32(0x070707)) };
+        return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(channels, 3), low_bits),
+            _mm256_set1_epi32(static_cast<int>(opaque)));
+    }
+
+    // 16 pixels per step
+    __attribute__((target("avx2")))
+    uint32_t convert_15bit_avx2(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+        uint32_t i { 0 };
+        for (; i + 16 <= count; i += 16) {
+            __m256i words { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i)) };
+            __m256i low { _mm256_cvtepu16_epi32(_mm256_castsi256_si128(words)) };
+            __m256i high { _mm256_cvtepu16_epi32(_mm256_extracti128_si256(words, 1)) };
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), widen_lanes(low));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), widen_lanes(high));
+        }
+        return i;
+    }
+
+    // 8 pixels, 24 bytes, per step. Each half of the register takes 4
+    // pixels from its own 16 byte load, and spreads their bytes out with
+    // room for alpha.
+    __attribute__((target("avx2")))
+    uint32_t convert_24bit_avx2(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+        const auto* bytes { reinterpret_cast<const uint8_t*>(pixels) };
+        const __m256i spread { _mm256_setr_epi8(
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1) };
+        const __m256i alpha { _mm256_set1_epi32(static_cast<int>(opaque)) };
+        uint32_t i { 0 };
+        for (; i + 8 <= count; i += 8) {
+            __m128i low { _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 3)) };
+            __m128i high { _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 3 + 12)) };
+            __m256i both { _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1) };
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_or_si256(_mm256_shuffle_epi8(both, spread), alpha));
+        }
+        return i;
+    }
+}
+
+#endif
+
+#ifdef __SSE2__
+
+namespace {
+    __m128i widen_lanes_sse2(__m128i pixels) {
+        __m128i channels { _mm_or_si128(_mm_and_si128(pixels, _mm_set1_epi32(0x1f)),
+            _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x3e0)), 3),
+                _mm_slli_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0x7c00)), 6))) };
+        __m128i low_bits { _mm_and_si128(_mm_srli_epi32(channels, 2), _mm_set1_epi32(0x070707)) };
+        return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(channels, 3), low_bits),
+            _mm_set1_epi32(static_cast<int>(opaque)));
+    }
+
+    // 8 pixels per step
+    uint32_t convert_15bit_sse2(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+        const __m128i zero { _mm_setzero_si128() };
+        uint32_t i { 0 };
+        for (; i + 8 <= count; i += 8) {
+            __m128i words { _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i)) };
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), widen_lanes_sse2(_mm_unpacklo_epi16(words, zero)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), widen_lanes_sse2(_mm_unpackhi_epi16(words, zero)));
+        }
+        return i;
+    }
+}
+
+#endif
+
+void Display_converter::convert_15bit(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+    uint32_t done { 0 };
+#ifdef SOULPSX_DISPLAY_AVX2
+    if (has_avx2()) {
+        done = convert_15bit_avx2(pixels, out, count);
+    }
+#endif
+#ifdef __SSE2__
+    done += convert_15bit_sse2(pixels + done, out + done, count - done);
+#endif
+    convert_15bit_scalar(pixels + done, out + done, count - done);
+}
+
+void Display_converter::convert_24bit(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+    uint32_t done { 0 };
+#ifdef SOULPSX_DISPLAY_AVX2
+    if (has_avx2()) {
+        done = convert_24bit_avx2(pixels, out, count);
+    }
+#endif
+    // done is a multiple of 8, so it starts on a whole 16 bit pixel
+    convert_24bit_scalar(pixels + done * 3 / 2, out + done, count - done);
+}
+
+void Display_converter::convert_15bit_scalar(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+    for (uint32_t i { 0 }; i < count; i++) {
+        out[i] = widen(pixels[i]);
+    }
+}
+
+void Display_converter::convert_24bit_scalar(const uint16_t* pixels, uint32_t* out, uint32_t count) {
+    const auto* bytes { reinterpret_cast<const uint8_t*>(pixels) };
+    for (uint32_t i { 0 }; i < count; i++) {
+        const uint8_t* pixel { bytes + i * 3 };
+        out[i] = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16) | opaque;
+    }
+}
+
+bool Display_converter::update(const Vram& vram, const Gpu::Display& display,
+    const std::bitset<Vram::height>& written_lines) {
+    bool redo_all { m_stale || display != m_display };
+    if (redo_all) {
+        m_display = display;
+        m_stale = false;
+        m_pixels.assign(size_t { display.width } * display.height, opaque);
+        m_changed_rows.assign(display.height, true);
+        // A disabled display stays black until it is turned on again
+        if (!display.enabled) {
+            return true;
+        }
+    } else if (!display.enabled) {
+        std::fill(m_changed_rows.begin(), m_changed_rows.end(), false);
+        return false;
+    }
+
+    uint32_t row_pixels { display.color_24bit ? (display.width * 3 + 1) / 2 : display.width };
+    bool changed { redo_all };
+    for (uint32_t row { 0 }; row < display.height; row++) {
+        uint32_t line { (display.y + row) & (Vram::height - 1) };
+        if (!redo_all) {
+            m_changed_rows[row] = written_lines[line];
+            if (!written_lines[line]) {
+                continue;
+            }
+            changed = true;
+        }
+
+        const uint16_t* pixels { vram.row(line) + display.x };
+        if (display.x + row_pixels > Vram::width) {
+            m_row.resize(row_pixels + 2);
+            vram.read_run(display.x, line, { m_row.data(), row_pixels });
+            pixels = m_row.data();
+        }
+        uint32_t* out { m_pixels.data() + size_t { row } * display.width };
+        if (display.color_24bit) {
+            convert_24bit(pixels, out, display.width);
+        } else {
+            convert_15bit(pixels, out, display.width);
+        }
+    }
+    return changed;
+}
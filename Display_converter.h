@@ -0,0 +1,44 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Gpu.h"
+#include "Vram.h"
+
+// Turns the displayed part of VRAM into 32 bit RGBA for presenting. Rows
+// are only converted again when the GPU wrote their VRAM line, or when the
+// display moved or changed mode, so a frame that drew nothing costs nothing.
+class Display_converter {
+public:
+    // Returns whether any row changed. written_lines comes from
+    // Gpu::take_written_lines, and has to cover every write since the last
+    // update.
+    bool update(const Vram& vram, const Gpu::Display& display, const std::bitset<Vram::height>& written_lines);
+
+    uint32_t get_width() const { return m_display.width; }
+    uint32_t get_height() const { return m_display.height; }
+    // R, G, B and A bytes in memory order, alpha always 255, row after row
+    std::span<const uint32_t> get_pixels() const { return m_pixels; }
+    // Rows the last update converted, so only those need uploading
+    const std::vector<bool>& get_changed_rows() const { return m_changed_rows; }
+
+    // Kernels for one row, picking the widest vector unit there is. The
+    // 24 bit one reads up to 4 bytes past the end of its input.
+    static void convert_15bit(const uint16_t* pixels, uint32_t* out, uint32_t count);
+    static void convert_24bit(const uint16_t* pixels, uint32_t* out, uint32_t count);
+    // The same without vectors, for checking them
+    static void convert_15bit_scalar(const uint16_t* pixels, uint32_t* out, uint32_t count);
+    static void convert_24bit_scalar(const uint16_t* pixels, uint32_t* out, uint32_t count);
+private:
+    Gpu::Display m_display {};
+    // Nothing has been converted for this display yet
+    bool m_stale { true };
+    std::vector<uint32_t> m_pixels {};
+    std::vector<bool> m_changed_rows {};
+    // Rows that wrap around the right edge of VRAM are copied out first,
+    // with room for the 24 bit kernel to read past the end
+    std::vector<uint16_t> m_row {};
+};
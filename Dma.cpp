@@ -0,0 +1,320 @@
+#include "Dma.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Logger.h"
+#include "Memory.h"
+
+namespace {
+    // Calls f with every run of words that is contiguous in Ram, going forward
+    // from the address and wrapping at the end of Ram
+    template<typename F>
+    void for_each_run(uint32_t address, uint32_t word_count, F f) {
+        while (word_count > 0) {
+            uint32_t run { std::min(word_count, (Ram::ram_size - address) / 4) };
+            f(address, run);
+            address = (address + run * 4) & (Ram::ram_size - 1);
+            word_count -= run;
+        }
+    }
+}
+
+Dma::Dma(Ram& ram, Interrupt_controller& interrupts)
+    : m_ram { ram }, m_interrupts { interrupts } {
+    m_channels[index(Channel::otc)].control = Control::otc_fixed;
+}
+
+uint32_t Dma::read(uint32_t physical_address) const {
+    uint32_t offset { Memory::Map::dma.offset(physical_address) };
+    uint32_t channel { offset >> 4 };
+
+    if (channel < channel_count) {
+        const Channel_state& state { m_channels[channel] };
+        switch (offset & 0xc) {
+            case 0x0: return state.base_address;
+            case 0x4: return state.block_control;
+            case 0x8: return state.control;
+        }
+    } else {
+        switch (offset & 0xc) {
+            case 0x0: return m_dpcr;
+            case 0x4: return (m_dicr & 0x7fffffff) | (irq_master_flag(m_dicr) ? 0x80000000 : 0);
+        }
+    }
+
+    LOG_WARNING("[DMA] Read from unused register 0x{:x}", physical_address);
+    return 0;
+}
+
+void Dma::write(uint32_t physical_address, uint32_t value, uint32_t lanes) {
+    uint32_t offset { Memory::Map::dma.offset(physical_address) };
+    uint32_t channel { offset >> 4 };
+    // The bits a narrow store does not reach keep what the register holds
+    auto merged = [&](uint32_t current) { return (current & ~lanes) | (value & lanes); };
+
+    if (channel < channel_count) {
+        Channel_state& state { m_channels[channel] };
+        switch (offset & 0xc) {
+            case 0x0: {
+                state.base_address = merged(state.base_address) & 0xffffff;
+                return;
+            }
+            case 0x4: {
+                state.block_control = merged(state.block_control);
+                return;
+            }
+            case 0x8: {
+                value = merged(state.control);
+                state.control = channel == index(Channel::otc)
+                    ? (value & Control::otc_writable) | Control::otc_fixed
+                    : value & Control::writable;
+                start_if_ready(channel);
+                return;
+            }
+        }
+    } else {
+        switch (offset & 0xc) {
+            case 0x0: {
+                m_dpcr = merged(m_dpcr);
+                // A channel that was started while disabled goes now
+                for (uint32_t i { 0 }; i < channel_count; i++) {
+                    start_if_ready(i);
+                }
+                return;
+            }
+            case 0x4: {
+                bool was_active { irq_master_flag(m_dicr) };
+                // Flags out of reach are written as 0, which leaves them set
+                value = merged(m_dicr & 0x00ffffff);
+                // Writing 1 to a flag acknowledges it
+                uint32_t flags { (m_dicr & ~value) & 0x7f000000 };
+                m_dicr = (value & 0x00ff803f) | flags;
+                if (!was_active && irq_master_flag(m_dicr)) {
+                    m_interrupts.request(Interrupt_controller::Source::dma);
+                }
+                return;
+            }
+        }
+    }
+
+    LOG_WARNING("[DMA] Write to unused register 0x{:x}", physical_address);
+}
+
+void Dma::ram_written(uint32_t address, uint32_t size) {
+    if (m_ram_write_handler) {
+        m_ram_write_handler(Memory::Map::ram.start() + address, size);
+    }
+}
+
+// Runs the channel's transfer if it has been started, and triggered where
+// the sync mode needs it
+void Dma::start_if_ready(uint32_t channel) {
+    Channel_state& state { m_channels[channel] };
+    if (!(state.control & Control::start) || !channel_enabled(channel)) {
+        return;
+    }
+
+    auto sync_mode { static_cast<Sync_mode>((state.control & Control::sync_mode) >> 9) };
+    switch (sync_mode) {
+        case Sync_mode::manual: {
+            if (!(state.control & Control::trigger)) {
+                return;
+            }
+            uint32_t word_count { state.block_control & 0xffff };
+            if (word_count == 0) {
+                word_count = 0x10000;
+            }
+            if (channel == index(Channel::otc)) {
+                clear_ordering_table(state.base_address & address_mask, word_count);
+            } else {
+                transfer_block(channel, word_count);
+            }
+            break;
+        }
+        case Sync_mode::request: {
+            uint32_t block_size { state.block_control & 0xffff };
+            uint32_t block_count { state.block_control >> 16 };
+            // Like the manual word count, a count of 0 means 0x10000 blocks
+            if (block_count == 0) {
+                block_count = 0x10000;
+            }
+            uint32_t word_count { block_size * block_count };
+            transfer_block(channel, word_count);
+            // The address is left after the last block and the count runs out
+            uint32_t step { (state.control & Control::step_backward) ? -4u : 4u };
+            state.base_address = (state.base_address + word_count * step) & 0xffffff;
+            state.block_control &= 0xffff;
+            break;
+        }
+        case Sync_mode::linked_list: {
+            transfer_linked_list(channel);
+            break;
+        }
+        default: {
+            LOG_WARNING("[DMA] Channel {} started with reserved sync mode 3", channel);
+            break;
+        }
+    }
+    finish(channel);
+}
+
+void Dma::finish(uint32_t channel) {
+    m_channels[channel].control &= ~(Control::start | Control::trigger);
+
+    // Only channels with their interrupt enabled raise a flag
+    if (!(m_dicr & (1u << (channel + 16)))) {
+        return;
+    }
+    bool was_active { irq_master_flag(m_dicr) };
+    m_dicr |= 1u << (channel + 24);
+    if (!was_active && irq_master_flag(m_dicr)) {
+        m_interrupts.request(Interrupt_controller::Source::dma);
+    }
+}
+
+// Moves the words between Ram and the device a run at a time. Only
+// transfers stepping backward through Ram need the words gathered first.
+void Dma::transfer_block(uint32_t channel, uint32_t word_count) {
+    const Channel_state& state { m_channels[channel] };
+    const Port& port { m_ports[channel] };
+    uint32_t address { state.base_address & address_mask };
+    bool backward { (state.control & Control::step_backward) != 0 };
+
+    if (state.control & Control::from_ram) {
+        if (!port.write) {
+            LOG_WARNING("[DMA] Channel {} has no device to write to, dropping {} words", channel, word_count);
+            return;
+        }
+
+        if (!backward) {
+            for_each_run(address, word_count, [&](uint32_t run_address, uint32_t run) {
+                port.write({ ram_words(run_address), run });
+            });
+            return;
+        }
+
+        m_staging.resize(word_count);
+        for (uint32_t i { 0 }; i < word_count; i++) {
+            m_staging[i] = *ram_words(address - i * 4);
+        }
+        port.write(m_staging);
+        return;
+    }
+
+    if (!port.read) {
+        LOG_WARNING("[DMA] Channel {} has no device to read from, filling {} words with 0", channel, word_count);
+    }
+
+    if (!backward) {
+        for_each_run(address, word_count, [&](uint32_t run_address, uint32_t run) {
+            std::span<uint32_t> words { ram_words(run_address), run };
+            if (port.read) {
+                port.read(words);
+            } else {
+                std::fill(words.begin(), words.end(), 0);
+            }
+            ram_written(run_address, run * 4);
+        });
+        return;
+    }
+
+    m_staging.assign(word_count, 0);
+    if (port.read) {
+        port.read(m_staging);
+    }
+    for (uint32_t i { 0 }; i < word_count; i++) {
+        uint32_t word_address { (address - i * 4) & address_mask };
+        *ram_words(word_address) = m_staging[i];
+        ram_written(word_address, 4);
+    }
+}
+
+// Every node is a header word, holding the number of words that follow in
+// the top 8 bits and the address of the next node below them. The packets
+// of the whole list are gathered and handed over as one batch.
+void Dma::transfer_linked_list(uint32_t channel) {
+    Channel_state& state { m_channels[channel] };
+    const Port& port { m_ports[channel] };
+    if (!(state.control & Control::from_ram)) {
+        LOG_WARNING("[DMA] Channel {} linked list transfers only run from Ram", channel);
+        return;
+    }
+
+    m_staging.clear();
+    uint32_t address { state.base_address & address_mask };
+    // A list that loops back on itself would never end. No real list has
+    // more nodes than Ram has words.
+    uint32_t nodes_left { Ram::ram_size / 4 };
+    while (true) {
+        uint32_t header { *ram_words(address) };
+        uint32_t word_count { header >> 24 };
+        for_each_run((address + 4) & address_mask, word_count, [&](uint32_t run_address, uint32_t run) {
+            const uint32_t* words { ram_words(run_address) };
+            m_staging.insert(m_staging.end(), words, words + run);
+        });
+
+        // Only bit 23 is checked for the end marker
+        if (header & 0x800000) {
+            break;
+        }
+        if (--nodes_left == 0) {
+            LOG_WARNING("[DMA] Channel {} linked list does not end, stopping at 0x{:x}", channel, address);
+            break;
+        }
+        address = header & address_mask;
+    }
+    state.base_address = end_of_list;
+
+    if (!port.write) {
+        LOG_WARNING("[DMA] Channel {} has no device to write to, dropping {} words", channel, m_staging.size());
+        return;
+    }
+    if (!m_staging.empty()) {
+        port.write(m_staging);
+    }
+}
+
+// Writes entries from the top of the table down. Each points at the entry
+// below it and the lowest one ends the list. When the table does not wrap
+// around Ram it is a plain ascending sequence and gets filled a vector at a
+// time.
+void Dma::clear_ordering_table(uint32_t address, uint32_t word_count) {
+    uint32_t table_size { (word_count - 1) * 4 };
+    if (address < table_size) {
+        for (uint32_t i { 0 }; i < word_count; i++) {
+            uint32_t entry_address { (address - i * 4) & address_mask };
+            *ram_words(entry_address) = i + 1 == word_count ? end_of_list : (entry_address - 4) & address_mask;
+        }
+        ram_written(0, Ram::ram_size);
+        return;
+    }
+
+    uint32_t lowest { address - table_size };
+    uint32_t* words { ram_words(lowest) };
+    words[0] = end_of_list;
+    uint32_t i { 1 };
+#if defined(__SSE2__)
+    __m128i entries { _mm_setr_epi32(static_cast<int>(lowest), static_cast<int>(lowest + 4),
+        static_cast<int>(lowest + 8), static_cast<int>(lowest + 12)) };
+    const __m128i step { _mm_set1_epi32(16) };
+    for (; i + 4 <= word_count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words + i), entries);
+        entries = _mm_add_epi32(entries, step);
+    }
+#endif
+    for (; i < word_count; i++) {
+        words[i] = lowest + (i - 1) * 4;
+    }
+    ram_written(lowest, word_count * 4);
+}
+
+bool Dma::irq_master_flag(uint32_t dicr) {
+    bool forced { (dicr & (1 << 15)) != 0 };
+    bool enabled { (dicr & (1 << 23)) != 0 };
+    uint32_t raised { (dicr >> 16) & (dicr >> 24) & 0x7f };
+    return forced || (enabled && raised != 0);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "Interrupt_controller.h"
+#include "Ram.h"
+
+// The DMA controller's seven channels. A started transfer runs to the end
+// straight away: block transfers move whole runs of words between Ram and
+// the device at once, and a GPU linked list is walked in one pass and handed
+// over as a single batch of commands.
+class Dma {
+public:
+    enum class Channel : uint32_t {
+        mdec_in,
+        mdec_out,
+        gpu,
+        cdrom,
+        spu,
+        pio,
+        otc,
+        count,
+    };
+
+    // The device end of a channel. Either side may be left empty if the
+    // device never moves data that way.
+    struct Port {
+        // Device to Ram, fills every word of the span
+        std::function<void(std::span<uint32_t> words)> read {};
+        // Ram to device
+        std::function<void(std::span<const uint32_t> words)> write {};
+    };
+
+    // Called with the physical address and size in bytes of every range of
+    // Ram a transfer wrote to, so cached code there can be dropped.
+    using Ram_write_handler = std::function<void(uint32_t physical_address, uint32_t size)>;
+
+    Dma(Ram& ram, Interrupt_controller& interrupts);
+
+    void connect(Channel channel, Port port) { m_ports[index(channel)] = std::move(port); }
+    void set_ram_write_handler(Ram_write_handler handler) { m_ram_write_handler = std::move(handler); }
+
+    // Register accesses from the bus.
+    // 0x1f801080 + 0x10 * n -> MADR, + 4 -> BCR, + 8 -> CHCR
+    // 0x1f8010f0 -> DPCR, 0x1f8010f4 -> DICR
+    // Byte and halfword stores only write the bits set in lanes.
+    uint32_t read(uint32_t physical_address) const;
+    void write(uint32_t physical_address, uint32_t value, uint32_t lanes = 0xffffffff);
+private:
+    static constexpr uint32_t channel_count { static_cast<uint32_t>(Channel::count) };
+
+    struct Control {
+        static constexpr uint32_t from_ram { 1 << 0 };
+        static constexpr uint32_t step_backward { 1 << 1 };
+        static constexpr uint32_t chopping { 1 << 8 };
+        static constexpr uint32_t sync_mode { 3 << 9 };
+        static constexpr uint32_t start { 1 << 24 };
+        static constexpr uint32_t trigger { 1 << 28 };
+        static constexpr uint32_t writable { 0x71770703 };
+        // The OTC channel only lets the start, trigger and unknown bit 30 be
+        // written and always steps backward to Ram
+        static constexpr uint32_t otc_writable { 0x51000000 };
+        static constexpr uint32_t otc_fixed { step_backward };
+    };
+
+    enum class Sync_mode : uint32_t {
+        // All the words at once
+        manual,
+        // Blocks as the device asks for them
+        request,
+        linked_list,
+    };
+
+    struct Channel_state {
+        uint32_t base_address {};
+        uint32_t block_control {};
+        uint32_t control {};
+    };
+
+    // Addresses wrap within Ram and are always word aligned
+    static constexpr uint32_t address_mask { Ram::ram_size - 4 };
+    // Marks the end of a linked list, in the low 24 bits of a header
+    static constexpr uint32_t end_of_list { 0xffffff };
+
+    Ram& m_ram;
+    Interrupt_controller& m_interrupts;
+    std::array<Channel_state, channel_count> m_channels {};
+    std::array<Port, channel_count> m_ports {};
+    Ram_write_handler m_ram_write_handler {};
+
+    // Channel priorities and enables
+    uint32_t m_dpcr { 0x07654321 };
+    // Interrupt enables and flags. Bit 31 is worked out when read.
+    uint32_t m_dicr {};
+
+    // Words gathered for a device when they are not contiguous in Ram
+    std::vector<uint32_t> m_staging {};
+
+    static constexpr uint32_t index(Channel channel) { return static_cast<uint32_t>(channel); }
+
+    uint32_t* ram_words(uint32_t address) {
+        return reinterpret_cast<uint32_t*>(m_ram.mirror(0) + (address & address_mask));
+    }
+    void ram_written(uint32_t address, uint32_t size);
+
+    bool channel_enabled(uint32_t channel) const { return (m_dpcr >> (channel * 4 + 3)) & 1; }
+    void start_if_ready(uint32_t channel);
+    void finish(uint32_t channel);
+
+    void transfer_block(uint32_t channel, uint32_t word_count);
+    void transfer_linked_list(uint32_t channel);
+    // Builds the ordering table the OTC channel clears: a list running from
+    // the last entry down to the first, which marks the end
+    void clear_ordering_table(uint32_t address, uint32_t word_count);
+
+    static bool irq_master_flag(uint32_t dicr);
+};
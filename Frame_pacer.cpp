@@ -0,0 +1,79 @@
+#include "Frame_pacer.h"
+
+#include <format>
+#include <thread>
+
+std::string Frame_pacer::Stats::to_string() const {
+    return std::format("speed={:.1f} mips={:.2f} frame_ms={:.3f} frames={}",
+        speed_percent, guest_mips, host_frame_ms, frames);
+}
+
+void Frame_pacer::set_mode(Mode mode, double multiplier) {
+    m_mode = mode;
+    m_multiplier = multiplier > 0.0 ? multiplier : 1.0;
+    restart(Clock::now());
+}
+
+void Frame_pacer::frame_done(uint64_t cycles, uint64_t instructions) {
+    Clock::time_point now { Clock::now() };
+    m_window_busy += now - m_frame_end;
+    m_window_cycles += cycles;
+    m_window_instructions += instructions;
+    m_window_frames++;
+    m_stats.frames++;
+
+    if (m_mode != Mode::unthrottled) {
+        m_epoch_cycles += cycles;
+        double speed { m_mode == Mode::multiplier ? m_multiplier : 1.0 };
+        std::chrono::duration<double> emulated { m_epoch_cycles / (m_cpu_clock_hz * speed) };
+        Clock::time_point deadline { m_epoch + std::chrono::duration_cast<Clock::duration>(emulated) };
+
+        // Deadlines are absolute, so oversleeping one frame is made up in
+        // the next rather than adding up
+        if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+            now = Clock::now();
+        } else if (now - deadline > max_lag) {
+            restart(now);
+        }
+    }
+
+    m_frame_end = now;
+    if (now - m_window_start >= stats_window) {
+        update_stats(now);
+    }
+}
+
+void Frame_pacer::idle() {
+    std::this_thread::sleep_for(idle_interval);
+    Clock::time_point now { Clock::now() };
+    restart(now);
+    // Time spent paused does not count towards the stats
+    m_window_start = now;
+    m_window_cycles = 0;
+    m_window_instructions = 0;
+    m_window_frames = 0;
+    m_window_busy = {};
+}
+
+void Frame_pacer::restart(Clock::time_point now) {
+    m_epoch = now;
+    m_epoch_cycles = 0;
+    m_frame_end = now;
+}
+
+void Frame_pacer::update_stats(Clock::time_point now) {
+    double host_seconds { std::chrono::duration<double>(now - m_window_start).count() };
+    double emulated_seconds { static_cast<double>(m_window_cycles) / m_cpu_clock_hz };
+
+    m_stats.speed_percent = emulated_seconds / host_seconds * 100.0;
+    m_stats.guest_mips = m_window_instructions / host_seconds / 1e6;
+    m_stats.host_frame_ms = m_window_frames == 0 ? 0.0
+        : std::chrono::duration<double, std::milli>(m_window_busy).count() / m_window_frames;
+
+    m_window_start = now;
+    m_window_cycles = 0;
+    m_window_instructions = 0;
+    m_window_frames = 0;
+    m_window_busy = {};
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Holds the emulator to a target speed by sleeping between frames, and
+// measures how fast it is really going. Pacing follows emulated time rather
+// than counting frames, so full speed means the guest clock runs at the
+// console's rate whatever its refresh rate is.
+class Frame_pacer {
+public:
+    enum class Mode {
+        // Real time, the refresh rate of the video standard
+        throttled,
+        // A fixed multiple of real time
+        multiplier,
+        // As fast as the host allows
+        unthrottled,
+    };
+
+    // Averages over the last stats window
+    struct Stats {
+        // Emulated time over host time, 100 at full speed
+        double speed_percent {};
+        // Guest instructions executed per host second, in millions
+        double guest_mips {};
+        // Host time spent emulating a frame, not counting time asleep
+        double host_frame_ms {};
+        uint64_t frames {};
+
+        // One line of key=value pairs
+        std::string to_string() const;
+    };
+
+    explicit Frame_pacer(uint64_t cpu_clock_hz) : m_cpu_clock_hz { cpu_clock_hz } {}
+
+    // The multiplier only counts in Mode::multiplier
+    void set_mode(Mode mode, double multiplier = 1.0);
+    Mode get_mode() const { return m_mode; }
+    double get_multiplier() const { return m_multiplier; }
+
+    // Called after every emulated frame. Sleeps until the host has caught up
+    // with the emulated time when throttled.
+    void frame_done(uint64_t cycles, uint64_t instructions);
+    // Called instead while the system is paused. Sleeps for a moment rather
+    // than spinning, and starts pacing afresh on resume.
+    void idle();
+
+    const Stats& stats() const { return m_stats; }
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // How often the stats are recomputed
+    static constexpr Clock::duration stats_window { std::chrono::milliseconds { 500 } };
+    // Falling further behind than this gives up on catching up
+    static constexpr Clock::duration max_lag { std::chrono::milliseconds { 100 } };
+    static constexpr Clock::duration idle_interval { std::chrono::milliseconds { 16 } };
+
+    uint64_t m_cpu_clock_hz {};
+    Mode m_mode { Mode::throttled };
+    double m_multiplier { 1.0 };
+
+    // Emulated cycles run since the epoch, which set the pace
+    Clock::time_point m_epoch { Clock::now() };
+    uint64_t m_epoch_cycles {};
+    // When the previous frame finished, after any sleep
+    Clock::time_point m_frame_end { m_epoch };
+
+    Clock::time_point m_window_start { m_epoch };
+    uint64_t m_window_cycles {};
+    uint64_t m_window_instructions {};
+    uint64_t m_window_frames {};
+    Clock::duration m_window_busy {};
+
+    Stats m_stats {};
+
+    void restart(Clock::time_point now);
+    void update_stats(Clock::time_point now);
+};
@@ -0,0 +1,188 @@
+#include "Frame_writer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+
+#include "Logger.h"
+
+Frame_writer::Frame_writer(Format format, std::string path, uint32_t rate_numerator, uint32_t rate_denominator)
+    : m_format { format }, m_path { std::move(path) },
+    m_rate_numerator { rate_numerator }, m_rate_denominator { rate_denominator },
+    m_thread { [this] { run(); } } {
+    if (m_format == Format::ppm) {
+        std::error_code error {};
+        std::filesystem::create_directories(m_path, error);
+    }
+}
+
+Frame_writer::~Frame_writer() {
+    finish();
+}
+
+void Frame_writer::finish() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock { m_mutex };
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+}
+
+void Frame_writer::capture(const Vram& vram, const Gpu::Display& display) {
+    Frame frame { .display = display };
+    frame.row_pixels = display.color_24bit ? (display.width * 3 + 1) / 2 : display.width;
+
+    {
+        std::lock_guard lock { m_mutex };
+        frame.number = m_stats.captured++;
+        if (!m_spare_buffers.empty()) {
+            frame.pixels = std::move(m_spare_buffers.back());
+            m_spare_buffers.pop_back();
+        }
+    }
+
+    frame.pixels.resize(frame.row_pixels * display.height);
+    for (uint32_t row { 0 }; row < display.height; row++) {
+        std::span<uint16_t> pixels { frame.pixels.data() + row * frame.row_pixels, frame.row_pixels };
+        if (display.enabled) {
+            vram.read_run(display.x, display.y + row, pixels);
+        } else {
+            std::fill(pixels.begin(), pixels.end(), 0);
+        }
+    }
+
+    std::unique_lock lock { m_mutex };
+    if (m_queue.size() >= max_queued) {
+        m_stats.stalls++;
+        m_changed.wait(lock, [this] { return m_queue.size() < max_queued; });
+    }
+    m_queue.push_back(std::move(frame));
+    lock.unlock();
+    m_changed.notify_all();
+}
+
+Frame_writer::Stats Frame_writer::get_stats() {
+    std::lock_guard lock { m_mutex };
+    return m_stats;
+}
+
+void Frame_writer::run() {
+    while (true) {
+        Frame frame {};
+        {
+            std::unique_lock lock { m_mutex };
+            m_changed.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+            if (m_queue.empty()) {
+                break;
+            }
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        if (!failed()) {
+            write(frame);
+        }
+
+        {
+            std::lock_guard lock { m_mutex };
+            m_spare_buffers.push_back(std::move(frame.pixels));
+            m_stats.written++;
+        }
+        m_changed.notify_all();
+    }
+
+    // Closing flushes the last of the stream, which can fail too
+    if (m_stream.is_open()) {
+        m_stream.close();
+        if (m_stream.fail() && !failed()) {
+            LOG_ERROR("[FRAME WRITER] Could not write {}", m_path);
+            m_failed.store(true, std::memory_order_release);
+        }
+    }
+}
+
+void Frame_writer::write(const Frame& frame) {
+    to_rgb(frame, m_rgb);
+    if (m_format == Format::ppm) {
+        write_ppm(frame);
+    } else {
+        write_y4m(frame);
+    }
+}
+
+void Frame_writer::write_ppm(const Frame& frame) {
+    std::filesystem::path path { std::filesystem::path { m_path } / std::format("frame_{:06}.ppm", frame.number) };
+    std::ofstream file { path, std::ios::binary };
+    file << std::format("P6\n{} {}\n255\n", frame.display.width, frame.display.height);
+    file.write(reinterpret_cast<const char*>(m_rgb.data()), static_cast<std::streamsize>(m_rgb.size()));
+    if (!file.good()) {
+        LOG_ERROR("[FRAME WRITER] Could not write {}", path.string());
+        m_failed.store(true, std::memory_order_release);
+    }
+}
+
+// BT.601 with studio swing, which is what players assume for Y4M
+void Frame_writer::write_y4m(const Frame& frame) {
+    if (!m_stream.is_open()) {
+        m_stream.open(m_path, std::ios::binary);
+        m_stream_width = std::max(frame.display.width, 1u);
+        m_stream_height = std::max(frame.display.height, 1u);
+        m_stream << std::format("YUV4MPEG2 W{} H{} F{}:{} Ip A1:1 C444\n",
+            m_stream_width, m_stream_height, m_rate_numerator, m_rate_denominator);
+    }
+
+    size_t plane_size { size_t { m_stream_width } * m_stream_height };
+    m_planes.assign(plane_size * 3, 0);
+    std::fill_n(m_planes.begin(), plane_size, 16);
+    std::fill(m_planes.begin() + static_cast<std::ptrdiff_t>(plane_size), m_planes.end(), 128);
+
+    uint32_t width { std::min(frame.display.width, m_stream_width) };
+    uint32_t height { std::min(frame.display.height, m_stream_height) };
+    for (uint32_t y { 0 }; y < height; y++) {
+        const uint8_t* rgb { m_rgb.data() + size_t { y } * frame.display.width * 3 };
+        for (uint32_t x { 0 }; x < width; x++) {
+            int32_t r { rgb[x * 3] };
+            int32_t g { rgb[x * 3 + 1] };
+            int32_t b { rgb[x * 3 + 2] };
+            size_t i { size_t { y } * m_stream_width + x };
+            m_planes[i] = static_cast<uint8_t>(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+            m_planes[plane_size + i] = static_cast<uint8_t>(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+            m_planes[plane_size * 2 + i] = static_cast<uint8_t>(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+        }
+    }
+
+    m_stream << "FRAME\n";
+    m_stream.write(reinterpret_cast<const char*>(m_planes.data()), static_cast<std::streamsize>(m_planes.size()));
+    if (!m_stream.good()) {
+        LOG_ERROR("[FRAME WRITER] Could not write {}", m_path);
+        m_failed.store(true, std::memory_order_release);
+    }
+}
+
+// 15 bit pixels have their 5 bit channels widened to 8 bits. In 24 bit
+// mode the rows are a string of R, G, B bytes, two to a VRAM pixel.
+void Frame_writer::to_rgb(const Frame& frame, std::vector<uint8_t>& rgb) {
+    uint32_t width { frame.display.width };
+    rgb.resize(size_t { width } * frame.display.height * 3);
+    for (uint32_t y { 0 }; y < frame.display.height; y++) {
+        const uint16_t* pixels { frame.pixels.data() + size_t { y } * frame.row_pixels };
+        uint8_t* out { rgb.data() + size_t { y } * width * 3 };
+        if (frame.display.color_24bit) {
+            for (uint32_t i { 0 }; i < width * 3; i++) {
+                out[i] = static_cast<uint8_t>(pixels[i / 2] >> ((i & 1) * 8));
+            }
+            continue;
+        }
+        for (uint32_t x { 0 }; x < width; x++) {
+            uint16_t pixel { pixels[x] };
+            for (uint32_t channel { 0 }; channel < 3; channel++) {
+                uint32_t value { (pixel >> (channel * 5)) & 0x1fu };
+                out[x * 3 + channel] = static_cast<uint8_t>((value << 3) | (value >> 2));
+            }
+        }
+    }
+}
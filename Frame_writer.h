@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Gpu.h"
+#include "Vram.h"
+
+// Writes the displayed frames out as PPM images or a Y4M video. Capturing
+// a frame only copies the displayed rows of VRAM into a spare buffer.
+// Converting to RGB, encoding and writing happen on a background thread,
+// which has at most a few frames queued.
+class Frame_writer {
+public:
+    enum class Format {
+        // An image per frame, frame_000000.ppm onwards, in a directory
+        ppm,
+        // One uncompressed 4:4:4 stream. Frames are cropped or padded to
+        // the size of the first.
+        y4m,
+    };
+
+    struct Stats {
+        uint64_t captured {};
+        uint64_t written {};
+        // Captures that had to wait for the writer to free a buffer
+        uint64_t stalls {};
+    };
+
+    // The frame rate, as a fraction, only goes into Y4M headers
+    Frame_writer(Format format, std::string path, uint32_t rate_numerator, uint32_t rate_denominator);
+    // Writes out the frames still queued, unless finish already did
+    ~Frame_writer();
+
+    // Writes out the frames still queued, closes the output and stops the
+    // writer thread. Nothing may be captured after this. Whether it all
+    // made it out is known from failed() only once this has returned.
+    void finish();
+
+    // Disabled displays are captured as black frames of the same size
+    void capture(const Vram& vram, const Gpu::Display& display);
+    // Set once a file could not be written, nothing more is written then
+    bool failed() const { return m_failed.load(std::memory_order_acquire); }
+    Stats get_stats();
+private:
+    struct Frame {
+        Gpu::Display display {};
+        // The displayed rows, each the VRAM pixels the display's width
+        // takes up at its color depth
+        std::vector<uint16_t> pixels {};
+        uint32_t row_pixels {};
+        uint64_t number {};
+    };
+
+    static constexpr size_t max_queued { 4 };
+
+    Format m_format {};
+    std::string m_path {};
+    uint32_t m_rate_numerator {};
+    uint32_t m_rate_denominator {};
+
+    std::mutex m_mutex {};
+    std::condition_variable m_changed {};
+    std::deque<Frame> m_queue {};
+    // Buffers of written frames, reused for later captures
+    std::vector<std::vector<uint16_t>> m_spare_buffers {};
+    Stats m_stats {};
+    bool m_stopping {};
+    std::atomic<bool> m_failed {};
+
+    // Only used by the writer thread
+    std::ofstream m_stream {};
+    uint32_t m_stream_width {};
+    uint32_t m_stream_height {};
+    std::vector<uint8_t> m_rgb {};
+    std::vector<uint8_t> m_planes {};
+
+    // Declared last so everything above exists before the thread starts
+    std::thread m_thread;
+
+    void run();
+    void write(const Frame& frame);
+    void write_ppm(const Frame& frame);
+    void write_y4m(const Frame& frame);
+    // 3 bytes per pixel, row after row
+    static void to_rgb(const Frame& frame, std::vector<uint8_t>& rgb);
+};
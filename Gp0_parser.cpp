@@ -0,0 +1,42 @@
+#include "Gp0_parser.h"
+
+#include <algorithm>
+
+std::span<const uint32_t> Gp0_parser::next(std::span<const uint32_t>& words) {
+    if (m_in_polyline) {
+        auto terminator { std::find_if(words.begin(), words.end(), is_terminator) };
+        if (terminator != words.end()) {
+            m_in_polyline = false;
+            terminator++;
+        }
+        words = words.subspan(static_cast<size_t>(terminator - words.begin()));
+        return {};
+    }
+
+    if (m_size == 0) {
+        if (words.empty()) {
+            return {};
+        }
+        m_length = Gp0::info(words.front()).length;
+        if (words.size() >= m_length) {
+            std::span<const uint32_t> command { words.first(m_length) };
+            words = words.subspan(m_length);
+            return complete(command);
+        }
+    }
+
+    size_t count { std::min<size_t>(words.size(), m_length - m_size) };
+    std::copy_n(words.begin(), count, m_command.begin() + m_size);
+    m_size += static_cast<uint32_t>(count);
+    words = words.subspan(count);
+    if (m_size < m_length) {
+        return {};
+    }
+    m_size = 0;
+    return complete({ m_command.data(), m_length });
+}
+
+void Gp0_parser::reset() {
+    m_size = 0;
+    m_in_polyline = false;
+}
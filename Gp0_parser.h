@@ -0,0 +1,141 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+// What the first word of a GP0 command says about the whole command, looked
+// up by the opcode in its top byte. Everything is built at compile time.
+namespace Gp0 {
+    enum class Kind : uint8_t {
+        // NOPs, the texture cache flush and the interrupt request
+        other,
+        fill,
+        polygon,
+        line,
+        rectangle,
+        copy,
+        upload,
+        download,
+        // E1 to E6
+        environment,
+    };
+
+    struct Command_info {
+        Kind kind { Kind::other };
+        // Words including the first. Image data after a CPU to VRAM copy is
+        // not part of it, and polylines count their first segment only.
+        uint8_t length { 1 };
+        bool shaded {};
+        bool quad {};
+        bool textured {};
+        // Runs on, a vertex at a time, until a terminator word
+        bool polyline {};
+        // Running it may change GPUSTAT: E1 and E6, textured polygons,
+        // which set the page, and VRAM to CPU copies
+        bool changes_status {};
+    };
+
+    constexpr Command_info describe(uint32_t opcode) {
+        Command_info info {};
+        info.shaded = (opcode & 0x10) != 0;
+        info.textured = (opcode & 0x04) != 0;
+        switch (opcode >> 5) {
+            case 1: {
+                uint32_t vertices { (opcode & 0x08) ? 4u : 3u };
+                info.kind = Kind::polygon;
+                info.quad = vertices == 4;
+                info.length = static_cast<uint8_t>(1 + vertices * (info.textured ? 2 : 1)
+                    + (info.shaded ? vertices - 1 : 0));
+                info.changes_status = info.textured;
+                return info;
+            }
+            case 2: {
+                info.kind = Kind::line;
+                info.textured = false;
+                info.polyline = (opcode & 0x08) != 0;
+                info.length = info.shaded ? 4 : 3;
+                return info;
+            }
+            // Size 0 is given in a word of its own
+            case 3: {
+                bool variable_size { ((opcode >> 3) & 3) == 0 };
+                info.kind = Kind::rectangle;
+                info.shaded = false;
+                info.length = static_cast<uint8_t>(2 + (info.textured ? 1 : 0) + (variable_size ? 1 : 0));
+                return info;
+            }
+            case 4: return { .kind = Kind::copy, .length = 4 };
+            case 5: return { .kind = Kind::upload, .length = 3 };
+            case 6: return { .kind = Kind::download, .length = 3, .changes_status = true };
+        }
+
+        if (opcode == 0x02) {
+            return { .kind = Kind::fill, .length = 3 };
+        }
+        if (opcode >= 0xe1 && opcode <= 0xe6) {
+            return { .kind = Kind::environment, .changes_status = opcode == 0xe1 || opcode == 0xe6 };
+        }
+        return {};
+    }
+
+    constexpr std::array<Command_info, 256> build_command_table() {
+        std::array<Command_info, 256> table {};
+        for (uint32_t opcode { 0 }; opcode < table.size(); opcode++) {
+            table[opcode] = describe(opcode);
+        }
+        return table;
+    }
+
+    inline constexpr std::array<Command_info, 256> command_table { build_command_table() };
+
+    constexpr const Command_info& info(uint32_t command) {
+        return command_table[command >> 24];
+    }
+
+    static_assert(info(0x38000000).length == 8 && info(0x3c000000).length == 12);
+    static_assert(info(0x65000000).length == 4 && info(0x7c000000).length == 3);
+    static_assert(info(0x48000000).polyline && info(0x58000000).length == 4);
+}
+
+// Splits the stream of GP0 words into whole commands. A command that
+// arrives in one span is handed back where it is. One split across writes
+// is gathered first, which only happens for words written one at a time or
+// commands straddling the end of a DMA block.
+class Gp0_parser {
+public:
+    // Takes words off the front, up to the end of the next command, and
+    // returns that command. Returns nothing if the words ran out first, or
+    // if they were the vertices of a polyline, which are skipped up to its
+    // terminator. The command stays valid until the next call.
+    std::span<const uint32_t> next(std::span<const uint32_t>& words);
+    // The same for one word, as written to GP0 by the CPU
+    std::span<const uint32_t> next(uint32_t word) {
+        if (m_in_polyline) {
+            m_in_polyline = !is_terminator(word);
+            return {};
+        }
+        if (m_size == 0) {
+            m_length = Gp0::info(word).length;
+        }
+        m_command[m_size++] = word;
+        if (m_size < m_length) {
+            return {};
+        }
+        m_size = 0;
+        return complete({ m_command.data(), m_length });
+    }
+    // Drops a partly received command
+    void reset();
+private:
+    std::array<uint32_t, 12> m_command {};
+    uint32_t m_size {};
+    uint32_t m_length {};
+    bool m_in_polyline {};
+
+    static bool is_terminator(uint32_t word) { return (word & 0xf000f000) == 0x50005000; }
+    std::span<const uint32_t> complete(std::span<const uint32_t> command) {
+        m_in_polyline = Gp0::info(command.front()).polyline;
+        return command;
+    }
+};
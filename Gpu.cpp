@@ -1,23 +1,655 @@
 #include "Gpu.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "Gp0_parser.h"
 #include "Logger.h"
 
-// Receive a command from the bus.
+namespace {
+    // Vertex coordinates are signed 11 bit values
+    int32_t sign_extend_11(uint32_t value) {
+        return static_cast<int32_t>(value << 21) >> 21;
+    }
+}
+
+Gpu::Gpu() {
+    m_batch.reserve(max_batch);
+    m_texture_cache.set_miss_handler([this] { finish_drawing(); });
+}
+
+Gpu::~Gpu() {
+    set_threaded(false);
+}
+
 void Gpu::receive_command(uint32_t command) {
-    if ((command >> 24) == 0xe1) {
-        Logger::log(Logger::Level::warning, "[GPU] Received Texpage command");
+    if (!m_threaded) {
+        process_command(command);
+        return;
+    }
+
+    Command_fifo::Entry entry { command, Command_fifo::Port::gp0 };
+    enqueue({ &entry, 1 });
+    // Parameters and image data can look like such a command too, which
+    // only costs an unnecessary wait
+    if (Gp0::info(command).changes_status) {
+        m_status_pending = m_fifo.pushed();
+    }
+}
+
+void Gpu::receive_commands(std::span<const uint32_t> commands) {
+    if (!m_threaded) {
+        process_commands(commands);
+        return;
+    }
+
+    std::array<Command_fifo::Entry, 256> entries {};
+    while (!commands.empty()) {
+        size_t count { std::min(commands.size(), entries.size()) };
+        bool changes_status { false };
+        for (size_t i { 0 }; i < count; i++) {
+            entries[i] = { commands[i], Command_fifo::Port::gp0 };
+            changes_status |= Gp0::info(commands[i]).changes_status;
+        }
+        enqueue({ entries.data(), count });
+        if (changes_status) {
+            m_status_pending = m_fifo.pushed();
+        }
+        commands = commands.subspan(count);
+    }
+}
+
+void Gpu::receive_control(uint32_t command) {
+    if (!m_threaded) {
+        process_control(command);
+        return;
+    }
+
+    Command_fifo::Entry entry { command, Command_fifo::Port::gp1 };
+    enqueue({ &entry, 1 });
+    m_status_pending = m_fifo.pushed();
+}
+
+void Gpu::send_data(std::span<uint32_t> words) {
+    sync();
+    size_t available { (m_read_buffer.size() - m_read_position) / 2 };
+    size_t count { std::min(words.size(), available) };
+    if (count > 0) {
+        std::memcpy(words.data(), m_read_buffer.data() + m_read_position, count * sizeof(uint32_t));
+        m_read_position += count * 2;
+        m_gpuread = words[count - 1];
+        if (m_read_position == m_read_buffer.size()) {
+            set_gpustat(m_ready_to_send_bit, 0);
+        }
+    }
+    std::fill(words.begin() + static_cast<std::ptrdiff_t>(count), words.end(), m_gpuread);
+}
+
+void Gpu::set_threaded(bool threaded) {
+    if (threaded == m_threaded) {
+        return;
+    }
+
+    if (threaded) {
+        m_stopping.store(false, std::memory_order_relaxed);
+        m_worker = std::thread { [this] { run_worker(); } };
+    } else {
+        // The worker empties the queue before it stops
+        m_stopping.store(true, std::memory_order_seq_cst);
+        m_wakeups.fetch_add(1, std::memory_order_release);
+        m_wakeups.notify_one();
+        m_worker.join();
+    }
+    m_threaded = threaded;
+}
+
+void Gpu::sync() {
+    if (m_threaded) {
+        wait_until_processed(m_fifo.pushed());
+    } else {
+        finish_drawing();
+    }
+}
+
+void Gpu::set_render_threads(uint32_t thread_count) {
+    sync();
+    if (thread_count > 1) {
+        m_tile_renderer = std::make_unique<Tile_renderer>(m_rasterizer, thread_count);
+    } else {
+        m_tile_renderer.reset();
     }
 }
 
+void Gpu::finish_drawing() {
+    draw_batch();
+    if (m_tile_renderer) {
+        m_tile_renderer->flush();
+    }
+}
+
+void Gpu::enqueue(std::span<const Command_fifo::Entry> entries) {
+    while (true) {
+        entries = entries.subspan(m_fifo.push(entries));
+        wake_worker();
+        if (entries.empty()) {
+            return;
+        }
+        // Full, the worker is busy drawing
+        std::this_thread::yield();
+    }
+}
+
+void Gpu::wait_until_processed(uint64_t position) {
+    while (m_fifo.processed() < position) {
+        std::this_thread::yield();
+    }
+}
+
+void Gpu::wake_worker() {
+    if (m_worker_waiting.load(std::memory_order_seq_cst)) {
+        m_wakeups.fetch_add(1, std::memory_order_release);
+        m_wakeups.notify_one();
+    }
+}
+
+void Gpu::run_worker() {
+    std::array<Command_fifo::Entry, 256> entries {};
+    std::array<uint32_t, 256> commands {};
+    while (true) {
+        uint32_t wakeups { m_wakeups.load(std::memory_order_acquire) };
+
+        size_t count { m_fifo.pop(entries) };
+        if (count > 0) {
+            // Runs of GP0 words go through together, so image data is
+            // copied into VRAM a run at a time
+            size_t command_count { 0 };
+            for (size_t i { 0 }; i < count; i++) {
+                if (entries[i].port == Command_fifo::Port::gp0) {
+                    commands[command_count++] = entries[i].word;
+                    continue;
+                }
+                process_commands({ commands.data(), command_count });
+                command_count = 0;
+                process_control(entries[i].word);
+            }
+            process_commands({ commands.data(), command_count });
+            // Nothing more to bin for now. Drawing has to finish before the
+            // words count as processed, since sync() waits on them.
+            if (m_fifo.empty()) {
+                finish_drawing();
+            }
+            m_fifo.publish_processed();
+            continue;
+        }
+
+        if (m_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        // Pairs with the producer publishing before it checks for a sleeper
+        m_worker_waiting.store(true, std::memory_order_seq_cst);
+        if (m_fifo.empty() && !m_stopping.load(std::memory_order_seq_cst)) {
+            m_wakeups.wait(wakeups, std::memory_order_acquire);
+        }
+        m_worker_waiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+void Gpu::process_command(uint32_t command) {
+    if (m_image_words_left > 0) {
+        receive_image({ &command, 1 });
+        return;
+    }
+    std::span<const uint32_t> packet { m_parser.next(command) };
+    if (!packet.empty()) {
+        execute_command(packet);
+    }
+}
+
+void Gpu::process_commands(std::span<const uint32_t> commands) {
+    while (!commands.empty()) {
+        if (m_image_words_left > 0) {
+            commands = commands.subspan(receive_image(commands));
+            continue;
+        }
+        std::span<const uint32_t> packet { m_parser.next(commands) };
+        if (!packet.empty()) {
+            execute_command(packet);
+        }
+    }
+}
+
+void Gpu::process_control(uint32_t command) {
+    switch (command >> 24) {
+        case 0x00: {
+            reset();
+            break;
+        }
+        case 0x01: {
+            m_parser.reset();
+            m_image_words_left = 0;
+            m_image_pixels_left = 0;
+            break;
+        }
+        // 1 turns the display off
+        case 0x03: {
+            set_gpustat(m_display_disabled_bit, (command & 1) << 23);
+            break;
+        }
+        case 0x04: {
+            set_gpustat(3u << 29, (command & 3) << 29);
+            break;
+        }
+        case 0x05: {
+            m_display_x = command & 0x3fe;
+            m_display_y = (command >> 10) & 0x1ff;
+            break;
+        }
+        // The horizontal range only moves the picture on the screen, the
+        // width comes from the display mode
+        case 0x06: {
+            break;
+        }
+        case 0x07: {
+            m_display_line_start = command & 0x3ff;
+            m_display_line_end = (command >> 10) & 0x3ff;
+            break;
+        }
+        // Resolution, video standard, color depth and interlacing go to
+        // GPUSTAT bits 17-22, the 368 pixel width bit to 16, reverse to 14
+        case 0x08: {
+            uint32_t mode { ((command & 0x3f) << 17) | ((command & 0x40) << 10) | ((command & 0x80) << 7) };
+            set_gpustat(0x7f4000, mode);
+            break;
+        }
+        default: {
+            LOG_DEBUG("[GPU] Ignoring GP1 command 0x{:x}", command);
+            break;
+        }
+    }
+}
+
+Gpu::Display Gpu::get_display() {
+    sync();
+    uint32_t gpustat { m_gpustat.load(std::memory_order_relaxed) };
+    static constexpr std::array<uint32_t, 4> widths { 256, 320, 512, 640 };
+    bool interlaced_480 { (gpustat & (1u << 19)) && (gpustat & (1u << 22)) };
+    uint32_t lines { m_display_line_end > m_display_line_start ? m_display_line_end - m_display_line_start : 0 };
+    return {
+        .x = m_display_x,
+        .y = m_display_y,
+        .width = (gpustat & (1u << 16)) ? 368 : widths[(gpustat >> 17) & 3],
+        .height = std::min(interlaced_480 ? lines * 2 : lines, Vram::height),
+        .color_24bit = (gpustat & (1u << 21)) != 0,
+        .enabled = (gpustat & m_display_disabled_bit) == 0,
+    };
+}
+
+std::bitset<Vram::height> Gpu::take_written_lines() {
+    sync();
+    std::bitset<Vram::height> lines { m_written_lines };
+    m_written_lines.reset();
+    return lines;
+}
+
 // Returns a response based on the given address.
 // 0x1f801814 -> GPUSTAT (GPU status register)
 // 0x1f801810 -> Response to GP0 and GP1 commands.
-std::span<const std::byte> Gpu::get_response(uint32_t physical_address) {
+uint32_t Gpu::read(uint32_t physical_address) {
+    if (physical_address == 0x1f801814) {
+        LOG_DEBUG("[GPU] Sent GPUSTAT.");
+        if (m_threaded) {
+            wait_until_processed(m_status_pending);
+        }
+        return m_gpustat.load(std::memory_order_relaxed);
+    }
+
+    LOG_DEBUG("[GPU] Sent GP1 response.");
+    sync();
+    return read_word();
+}
+
+void Gpu::write(uint32_t physical_address, uint32_t value) {
     if (physical_address == 0x1f801814) {
-        Logger::log(Logger::Level::info, "[GPU] Sent GPUSTAT.");
-        return std::as_bytes(std::span{ &m_gpustat, 1 });
+        receive_control(value);
+    } else {
+        receive_command(value);
+    }
+}
+
+void Gpu::execute_command(std::span<const uint32_t> command) {
+    const Gp0::Command_info& info { Gp0::info(command[0]) };
+    switch (info.kind) {
+        case Gp0::Kind::polygon: {
+            draw_polygon(decode_polygon(command, info));
+            return;
+        }
+        case Gp0::Kind::line: {
+            LOG_DEBUG("[GPU] Lines are not drawn yet");
+            return;
+        }
+        case Gp0::Kind::rectangle: {
+            LOG_DEBUG("[GPU] Rectangles are not drawn yet");
+            return;
+        }
+        case Gp0::Kind::copy: {
+            copy_rectangle(command);
+            return;
+        }
+        case Gp0::Kind::upload: {
+            start_upload(command);
+            return;
+        }
+        case Gp0::Kind::download: {
+            start_download(command);
+            return;
+        }
+        case Gp0::Kind::fill: {
+            fill_rectangle(command);
+            return;
+        }
+        case Gp0::Kind::environment: {
+            set_environment(command[0]);
+            return;
+        }
+        case Gp0::Kind::other: {
+            break;
+        }
+    }
+
+    uint32_t opcode { command[0] >> 24 };
+    if (opcode > 0x01) {
+        LOG_DEBUG("[GPU] Ignoring GP0 command 0x{:x}", command[0]);
     }
+}
+
+// Triangles waiting in the batch were decoded with the settings these
+// replace, so they are drawn first
+void Gpu::set_environment(uint32_t command) {
+    draw_batch();
+    switch (command >> 24) {
+        case 0xe1: {
+            set_texpage(command);
+            m_draw_settings.dither = (command >> 9) & 1;
+            // Dithering and drawing to the display area
+            set_gpustat(0x600, command & 0x600);
+            return;
+        }
+        case 0xe2: {
+            m_draw_settings.window_mask_x = command & 0x1f;
+            m_draw_settings.window_mask_y = (command >> 5) & 0x1f;
+            m_draw_settings.window_offset_x = (command >> 10) & 0x1f;
+            m_draw_settings.window_offset_y = (command >> 15) & 0x1f;
+            return;
+        }
+        case 0xe3: {
+            m_draw_settings.area_left = command & 0x3ff;
+            m_draw_settings.area_top = (command >> 10) & 0x1ff;
+            return;
+        }
+        case 0xe4: {
+            m_draw_settings.area_right = command & 0x3ff;
+            m_draw_settings.area_bottom = (command >> 10) & 0x1ff;
+            return;
+        }
+        case 0xe5: {
+            m_offset_x = sign_extend_11(command);
+            m_offset_y = sign_extend_11(command >> 11);
+            return;
+        }
+        case 0xe6: {
+            m_draw_settings.set_mask = command & 1;
+            m_draw_settings.check_mask = (command >> 1) & 1;
+            set_gpustat(0x1800, (command & 3) << 11);
+            return;
+        }
+    }
+}
+
+void Gpu::set_gpustat(uint32_t mask, uint32_t bits) {
+    uint32_t gpustat { m_gpustat.load(std::memory_order_relaxed) };
+    m_gpustat.store((gpustat & ~mask) | bits, std::memory_order_relaxed);
+}
+
+// Page, blending mode, depth and dither enable live in GPUSTAT's low bits
+void Gpu::set_texpage(uint32_t texpage) {
+    set_gpustat(0x1ff, texpage & 0x1ff);
+}
+
+// Command word and color first, then for each vertex: color if shaded and
+// not the first, position, and texture coordinates if textured. The first
+// vertex's coordinates carry the clut, the second's the texture page.
+Gpu::Polygon Gpu::decode_polygon(std::span<const uint32_t> command, const Gp0::Command_info& info) const {
+    uint32_t opcode { command[0] >> 24 };
+    Polygon polygon {
+        .vertex_count = info.quad ? 4u : 3u,
+        .shaded = info.shaded,
+        .textured = info.textured,
+        .raw_texture = (opcode & 0x01) != 0,
+        .semi_transparent = (opcode & 0x02) != 0,
+        .texpage = static_cast<uint16_t>(m_gpustat.load(std::memory_order_relaxed) & 0x1ff),
+    };
+
+    uint32_t word { 0 };
+    for (uint32_t i { 0 }; i < polygon.vertex_count; i++) {
+        Rasterizer::Vertex& vertex { polygon.vertices[i] };
+        if (i == 0 || info.shaded) {
+            vertex.color = command[word++] & 0xffffff;
+        } else {
+            vertex.color = polygon.vertices[0].color;
+        }
+
+        uint32_t position { command[word++] };
+        vertex.x = sign_extend_11(position) + m_offset_x;
+        vertex.y = sign_extend_11(position >> 16) + m_offset_y;
+
+        if (info.textured) {
+            uint32_t coordinates { command[word++] };
+            vertex.u = coordinates & 0xff;
+            vertex.v = (coordinates >> 8) & 0xff;
+            if (i == 0) {
+                polygon.clut = static_cast<uint16_t>(coordinates >> 16);
+            } else if (i == 1) {
+                polygon.texpage = static_cast<uint16_t>(coordinates >> 16);
+            }
+        }
+    }
+    return polygon;
+}
+
+void Gpu::draw_polygon(const Polygon& polygon) {
+    if (polygon.textured) {
+        set_texpage(polygon.texpage);
+    }
+
+    // What the polygon may draw over, for the texture cache
+    auto vertices_end { polygon.vertices.begin() + polygon.vertex_count };
+    Texture_cache::Rect drawn { m_draw_settings.area_left, m_draw_settings.area_top,
+        m_draw_settings.area_right, m_draw_settings.area_bottom };
+    auto [min_x, max_x] { std::minmax_element(polygon.vertices.begin(), vertices_end,
+        [](const auto& a, const auto& b) { return a.x < b.x; }) };
+    auto [min_y, max_y] { std::minmax_element(polygon.vertices.begin(), vertices_end,
+        [](const auto& a, const auto& b) { return a.y < b.y; }) };
+    drawn.left = std::max(drawn.left, min_x->x);
+    drawn.right = std::min(drawn.right, max_x->x);
+    drawn.top = std::max(drawn.top, min_y->y);
+    drawn.bottom = std::min(drawn.bottom, max_y->y);
+    if (drawn.left > drawn.right || drawn.top > drawn.bottom) {
+        return;
+    }
+
+    Rasterizer::Triangle triangle {};
+    triangle.shaded = polygon.shaded;
+    triangle.textured = polygon.textured;
+    triangle.raw_texture = polygon.raw_texture;
+    triangle.semi_transparent = polygon.semi_transparent;
+    triangle.texpage = polygon.texpage;
+    triangle.clut = polygon.clut;
+    // A miss draws the batch before it decodes over a page the batch uses
+    if (polygon.textured) {
+        triangle.texels = m_texture_cache.lookup(triangle.texpage, triangle.clut, drawn);
+    }
+
+    if (m_batch.size() + 2 > max_batch) {
+        draw_batch();
+    }
+    triangle.vertices = { polygon.vertices[0], polygon.vertices[1], polygon.vertices[2] };
+    m_batch.push_back(triangle);
+    if (polygon.vertex_count == 4) {
+        triangle.vertices = { polygon.vertices[1], polygon.vertices[2], polygon.vertices[3] };
+        m_batch.push_back(triangle);
+    }
+    mark_written(static_cast<uint32_t>(drawn.left), static_cast<uint32_t>(drawn.top),
+        static_cast<uint32_t>(drawn.right - drawn.left + 1), static_cast<uint32_t>(drawn.bottom - drawn.top + 1));
+}
+
+void Gpu::draw_batch() {
+    if (m_batch.empty()) {
+        return;
+    }
+    if (m_tile_renderer) {
+        m_tile_renderer->draw_triangles(m_draw_settings, m_batch);
+    } else {
+        m_rasterizer.draw_triangles(m_draw_settings, m_batch);
+    }
+    m_batch.clear();
+}
+
+namespace {
+    // Copy sizes count from 1, so 0 means the whole of VRAM
+    uint32_t copy_width(uint32_t size) {
+        return ((size & 0xffff) - 1) % Vram::width + 1;
+    }
+
+    uint32_t copy_height(uint32_t size) {
+        return ((size >> 16) - 1) % Vram::height + 1;
+    }
+}
+
+void Gpu::mark_written(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    m_texture_cache.invalidate(x, y, width, height);
+    if (height >= Vram::height) {
+        m_written_lines.set();
+        return;
+    }
+    for (uint32_t i { 0 }; i < height; i++) {
+        m_written_lines.set((y + i) & (Vram::height - 1));
+    }
+}
+
+Vram::Mask Gpu::transfer_mask() const {
+    return { static_cast<uint16_t>(m_draw_settings.set_mask ? 0x8000 : 0), m_draw_settings.check_mask };
+}
+
+// Fills ignore the drawing area and the mask bit, and work in steps of 16
+// pixels horizontally
+void Gpu::fill_rectangle(std::span<const uint32_t> command) {
+    finish_drawing();
+    uint32_t color { command[0] };
+    auto pixel { static_cast<uint16_t>(((color >> 3) & 0x1f) | (((color >> 11) & 0x1f) << 5) | (((color >> 19) & 0x1f) << 10)) };
+    uint32_t x { command[1] & 0x3f0 };
+    uint32_t y { (command[1] >> 16) & 0x1ff };
+    uint32_t width { ((command[2] & 0x3ff) + 0xf) & ~0xfu };
+    uint32_t height { (command[2] >> 16) & 0x1ff };
+    m_vram.fill(x, y, width, height, pixel);
+    mark_written(x, y, width, height);
+}
+
+void Gpu::copy_rectangle(std::span<const uint32_t> command) {
+    finish_drawing();
+    uint32_t source_x { command[1] & 0x3ff };
+    uint32_t source_y { (command[1] >> 16) & 0x1ff };
+    uint32_t x { command[2] & 0x3ff };
+    uint32_t y { (command[2] >> 16) & 0x1ff };
+    uint32_t width { copy_width(command[3]) };
+    uint32_t height { copy_height(command[3]) };
+    m_vram.copy(source_x, source_y, x, y, width, height, transfer_mask());
+    mark_written(x, y, width, height);
+}
+
+void Gpu::start_upload(std::span<const uint32_t> command) {
+    finish_drawing();
+    m_upload = {
+        .x = command[1] & 0x3ff,
+        .y = (command[1] >> 16) & 0x1ff,
+        .width = copy_width(command[2]),
+        .height = copy_height(command[2]),
+    };
+    m_image_pixels_left = m_upload.width * m_upload.height;
+    // Nothing can draw until the image is in, so it counts as written now
+    mark_written(m_upload.x, m_upload.y, m_upload.width, m_upload.height);
+    m_image_words_left = (m_image_pixels_left + 1) / 2;
+}
+
+// Image words hold two pixels each, the last one only the low half if the
+// pixel count is odd
+size_t Gpu::receive_image(std::span<const uint32_t> words) {
+    size_t word_count { std::min<size_t>(words.size(), m_image_words_left) };
+    std::array<uint16_t, Vram::width> pixels {};
+    for (size_t done { 0 }; done < word_count;) {
+        size_t chunk { std::min(word_count - done, pixels.size() / 2) };
+        std::memcpy(pixels.data(), words.data() + done, chunk * sizeof(uint32_t));
+        done += chunk;
+
+        auto pixel_count { static_cast<uint32_t>(std::min<size_t>(chunk * 2, m_image_pixels_left)) };
+        m_image_pixels_left -= pixel_count;
+        std::span<const uint16_t> remaining { pixels.data(), pixel_count };
+        while (!remaining.empty()) {
+            uint32_t run { std::min(m_upload.width - m_upload.column, static_cast<uint32_t>(remaining.size())) };
+            m_vram.write_run(m_upload.x + m_upload.column, m_upload.y + m_upload.row, remaining.first(run), transfer_mask());
+            remaining = remaining.subspan(run);
+            m_upload.column += run;
+            if (m_upload.column == m_upload.width) {
+                m_upload.column = 0;
+                m_upload.row++;
+            }
+        }
+    }
+    m_image_words_left -= static_cast<uint32_t>(word_count);
+    return word_count;
+}
+
+void Gpu::start_download(std::span<const uint32_t> command) {
+    finish_drawing();
+    uint32_t x { command[1] & 0x3ff };
+    uint32_t y { (command[1] >> 16) & 0x1ff };
+    uint32_t width { copy_width(command[2]) };
+    uint32_t height { copy_height(command[2]) };
+
+    uint32_t pixel_count { width * height };
+    m_read_buffer.assign(pixel_count + (pixel_count & 1), 0);
+    for (uint32_t row { 0 }; row < height; row++) {
+        m_vram.read_run(x, y + row, { m_read_buffer.data() + row * width, width });
+    }
+    m_read_position = 0;
+    set_gpustat(m_ready_to_send_bit, m_ready_to_send_bit);
+}
+
+uint32_t Gpu::read_word() {
+    if (m_read_position < m_read_buffer.size()) {
+        m_gpuread = m_read_buffer[m_read_position] | (static_cast<uint32_t>(m_read_buffer[m_read_position + 1]) << 16);
+        m_read_position += 2;
+        if (m_read_position == m_read_buffer.size()) {
+            set_gpustat(m_ready_to_send_bit, 0);
+        }
+    }
+    return m_gpuread;
+}
 
-    Logger::log(Logger::Level::info, "[GPU] Sent GP1 response.");
-    return std::as_bytes(std::span{ &m_dummy_var, 1 });
+void Gpu::reset() {
+    // Triangles received before the reset are drawn with the settings they
+    // came with
+    finish_drawing();
+    m_gpustat.store(m_ready_bits | m_display_disabled_bit, std::memory_order_relaxed);
+    m_display_x = 0;
+    m_display_y = 0;
+    m_display_line_start = 0x10;
+    m_display_line_end = 0x100;
+    m_draw_settings = {};
+    m_offset_x = 0;
+    m_offset_y = 0;
+    m_parser.reset();
+    m_image_words_left = 0;
+    m_image_pixels_left = 0;
+    m_read_buffer.clear();
+    m_read_position = 0;
 }
@@ -1,16 +1,179 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cstdint>
+#include <memory>
 #include <span>
+#include <thread>
+#include <vector>
 
-namespace std {
-    enum class byte : unsigned char;
-}
+#include "Command_fifo.h"
+#include "Gp0_parser.h"
+#include "Rasterizer.h"
+#include "Texture_cache.h"
+#include "Tile_renderer.h"
+#include "Vram.h"
 
 class Gpu {
 public:
+    Gpu();
+    ~Gpu();
+
+    // Register accesses from the bus.
+    // 0x1f801810 -> GP0 / GPUREAD, 0x1f801814 -> GP1 / GPUSTAT
+    uint32_t read(uint32_t physical_address);
+    void write(uint32_t physical_address, uint32_t value);
+
+    // GP0, one word at a time. Commands run once all their words are in.
     void receive_command(uint32_t command);
-    std::span<const std::byte> get_response(uint32_t physical_address);
+    // GP0 words from DMA channel 2, a whole block or linked list at a time
+    void receive_commands(std::span<const uint32_t> commands);
+    // GP1
+    void receive_control(uint32_t command);
+    // GPUREAD words for DMA channel 2
+    void send_data(std::span<uint32_t> words);
+
+    // Runs GP0 and GP1 on a worker thread. Words written by the CPU or DMA
+    // are queued, and the CPU only waits for the GPU when it reads GPUREAD,
+    // VRAM, or a GPUSTAT that queued commands might still change.
+    // Turning it off waits for the queue to empty.
+    void set_threaded(bool threaded);
+    bool threaded() const { return m_threaded; }
+    // Waits until everything queued so far has run and been drawn
+    void sync();
+
+    // More than one thread bins triangles into tiles and draws them on a
+    // Tile_renderer with that many threads. The pixels are the same.
+    void set_render_threads(uint32_t thread_count);
+    uint32_t get_render_threads() const { return m_tile_renderer ? m_tile_renderer->get_thread_count() : 1; }
+
+    // The part of VRAM the video output shows, set by GP1 05 to 08
+    struct Display {
+        uint32_t x {};
+        uint32_t y {};
+        uint32_t width {};
+        uint32_t height {};
+        // Pixels are 3 bytes each, packed across the 16 bit VRAM pixels
+        bool color_24bit {};
+        bool enabled {};
+
+        bool operator==(const Display&) const = default;
+    };
+    // Waits for queued commands
+    Display get_display();
+    // VRAM lines drawn or copied to since the last call, which clears them.
+    // Waits for queued drawing.
+    std::bitset<Vram::height> take_written_lines();
+
+    // Waits for queued drawing. Stays valid until the next GPU write, which
+    // only the caller's thread makes.
+    const Vram& get_vram() { sync(); return m_vram; }
+    void set_rasterizer_backend(Rasterizer::Backend backend) { sync(); m_rasterizer.set_backend(backend); }
+    // Safe to read while the GPU thread runs, though the counts may lag
+    Texture_cache::Stats get_texture_cache_stats() const { return m_texture_cache.get_stats(); }
 private:
-    uint32_t m_gpustat { 0x10000000 }; // Hardcoded response for now
-    uint32_t m_dummy_var {};
+    // Ready to receive commands and to receive DMA blocks
+    static constexpr uint32_t m_ready_bits { 0x14000000 };
+    // A VRAM to CPU copy has words waiting in GPUREAD
+    static constexpr uint32_t m_ready_to_send_bit { 0x08000000 };
+    static constexpr uint32_t m_display_disabled_bit { 0x00800000 };
+    // Written by whichever thread runs the commands, or by the CPU thread
+    // while nothing is queued
+    std::atomic<uint32_t> m_gpustat { m_ready_bits | m_display_disabled_bit };
+    // GPUREAD keeps its last word once a copy has been read
+    uint32_t m_gpuread {};
+
+    Vram m_vram {};
+    Rasterizer m_rasterizer { m_vram };
+    // Only while drawing on several threads
+    std::unique_ptr<Tile_renderer> m_tile_renderer {};
+    Texture_cache m_texture_cache { m_vram };
+    Rasterizer::Draw_settings m_draw_settings {};
+    int32_t m_offset_x {};
+    int32_t m_offset_y {};
+
+    Gp0_parser m_parser {};
+    // A GP0 polygon command, decoded
+    struct Polygon {
+        std::array<Rasterizer::Vertex, 4> vertices {};
+        uint32_t vertex_count {};
+        bool shaded {};
+        bool textured {};
+        bool raw_texture {};
+        bool semi_transparent {};
+        uint16_t texpage {};
+        uint16_t clut {};
+    };
+    // Triangles decoded but not drawn yet, all under m_draw_settings. They
+    // go to the rasterizer together once something needs the pixels, the
+    // settings change, or the batch fills up.
+    static constexpr size_t max_batch { 256 };
+    std::vector<Rasterizer::Triangle> m_batch {};
+    // A CPU to VRAM or VRAM to CPU copy
+    struct Transfer {
+        uint32_t x {};
+        uint32_t y {};
+        uint32_t width {};
+        uint32_t height {};
+        // Where the next pixel goes, relative to (x, y)
+        uint32_t column {};
+        uint32_t row {};
+    };
+    Transfer m_upload {};
+
+    // GP1 05 to 07
+    uint32_t m_display_x {};
+    uint32_t m_display_y {};
+    uint32_t m_display_line_start { 0x10 };
+    uint32_t m_display_line_end { 0x100 };
+    // Lines written since take_written_lines last ran
+    std::bitset<Vram::height> m_written_lines {};
+    // Image data of the CPU to VRAM copy that is still to come
+    uint32_t m_image_words_left {};
+    uint32_t m_image_pixels_left {};
+    // Pixels of the last VRAM to CPU copy, padded to whole words
+    std::vector<uint16_t> m_read_buffer {};
+    size_t m_read_position {};
+
+    bool m_threaded {};
+    Command_fifo m_fifo {};
+    // Position in m_fifo just past the last queued word that might change
+    // GPUSTAT, so reading it has to wait until then
+    uint64_t m_status_pending {};
+    std::atomic<bool> m_stopping {};
+    std::atomic<bool> m_worker_waiting {};
+    std::atomic<uint32_t> m_wakeups {};
+    std::thread m_worker {};
+
+    void process_command(uint32_t command);
+    void process_commands(std::span<const uint32_t> commands);
+    void process_control(uint32_t command);
+    void execute_command(std::span<const uint32_t> command);
+    void set_environment(uint32_t command);
+    void set_gpustat(uint32_t mask, uint32_t bits);
+    void set_texpage(uint32_t texpage);
+    Polygon decode_polygon(std::span<const uint32_t> command, const Gp0::Command_info& info) const;
+    void draw_polygon(const Polygon& polygon);
+    void draw_batch();
+    void fill_rectangle(std::span<const uint32_t> command);
+    void copy_rectangle(std::span<const uint32_t> command);
+    void start_upload(std::span<const uint32_t> command);
+    void start_download(std::span<const uint32_t> command);
+    // Takes up to the rest of the image data, returns how many words it took
+    size_t receive_image(std::span<const uint32_t> words);
+    // Every VRAM write goes through here, to invalidate cached textures and
+    // mark the lines written
+    void mark_written(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    Vram::Mask transfer_mask() const;
+    // The next word of the VRAM to CPU copy, or the last one again
+    uint32_t read_word();
+    // Draws the batch and whatever the tile renderer still has binned
+    void finish_drawing();
+    void reset();
+
+    void enqueue(std::span<const Command_fifo::Entry> entries);
+    void wait_until_processed(uint64_t position);
+    void wake_worker();
+    void run_worker();
 };
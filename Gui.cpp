@@ -64,6 +64,9 @@ Gui::Gui(std::shared_ptr<System> system, int width, int height)
 }
 
 Gui::~Gui() {
+    if (m_display_texture) {
+        glDeleteTextures(1, &m_display_texture);
+    }
     ImGui_ImplOpenGL3_Shutdown();
     SDL_GL_DestroyContext(m_gl_context);
 
@@ -84,6 +87,8 @@ void Gui::render() {
     if (m_system) {
         render_cpu_registers();
         render_executed_instructions();
+        render_performance_overlay();
+        render_display();
     }
 
     ImGui::Render();
@@ -172,3 +177,89 @@ void Gui::render_cpu_registers() const {
     ImGui::EndTabBar();
     ImGui::End();
 }
+
+void Gui::render_performance_overlay() {
+    const ImGuiViewport* viewport { ImGui::GetMainViewport() };
+    ImVec2 corner { viewport->WorkPos.x + viewport->WorkSize.x - 10.0f, viewport->WorkPos.y + 10.0f };
+    ImGui::SetNextWindowPos(corner, ImGuiCond_Always, ImVec2 { 1.0f, 0.0f });
+    ImGui::SetNextWindowBgAlpha(0.35f);
+    ImGuiWindowFlags flags { ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize
+        | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav };
+    ImGui::Begin("Performance", nullptr, flags);
+
+    const Frame_pacer::Stats& stats { m_system->get_stats() };
+    ImGui::Text("Speed: %.1f%%", stats.speed_percent);
+    ImGui::Text("Guest: %.2f MIPS", stats.guest_mips);
+    ImGui::Text("Frame: %.2f ms", stats.host_frame_ms);
+    Texture_cache::Stats textures { m_system->get_texture_cache_stats() };
+    ImGui::Text("Textures: %llu hits, %llu misses, %llu invalidated", static_cast<unsigned long long>(textures.hits),
+        static_cast<unsigned long long>(textures.misses), static_cast<unsigned long long>(textures.invalidations));
+    ImGui::Separator();
+
+    Frame_pacer::Mode mode { m_system->get_speed_mode() };
+    double multiplier { m_system->get_speed_multiplier() };
+    if (ImGui::RadioButton("100%", mode == Frame_pacer::Mode::throttled)) {
+        m_system->set_speed_mode(Frame_pacer::Mode::throttled);
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("2x", mode == Frame_pacer::Mode::multiplier && multiplier == 2.0)) {
+        m_system->set_speed_mode(Frame_pacer::Mode::multiplier, 2.0);
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("4x", mode == Frame_pacer::Mode::multiplier && multiplier == 4.0)) {
+        m_system->set_speed_mode(Frame_pacer::Mode::multiplier, 4.0);
+    }
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Unthrottled", mode == Frame_pacer::Mode::unthrottled)) {
+        m_system->set_speed_mode(Frame_pacer::Mode::unthrottled);
+    }
+    ImGui::End();
+}
+
+void Gui::render_display() {
+    const Vram& vram { m_system->get_vram() };
+    Gpu::Display display { m_system->get_display() };
+    bool changed { m_display_converter.update(vram, display, m_system->take_written_lines()) };
+
+    uint32_t width { m_display_converter.get_width() };
+    uint32_t height { m_display_converter.get_height() };
+    if (!m_display_texture) {
+        glGenTextures(1, &m_display_texture);
+        glBindTexture(GL_TEXTURE_2D, m_display_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, m_display_texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    const uint32_t* pixels { m_display_converter.get_pixels().data() };
+    if (width != m_texture_width || height != m_texture_height) {
+        m_texture_width = width;
+        m_texture_height = height;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(width), static_cast<GLsizei>(height), 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    } else if (changed) {
+        // One upload per run of changed rows
+        const std::vector<bool>& rows { m_display_converter.get_changed_rows() };
+        for (uint32_t row { 0 }; row < height;) {
+            if (!rows[row]) {
+                row++;
+                continue;
+            }
+            uint32_t end { row };
+            while (end < height && rows[end]) {
+                end++;
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, static_cast<GLint>(row), static_cast<GLsizei>(width),
+                static_cast<GLsizei>(end - row), GL_RGBA, GL_UNSIGNED_BYTE, pixels + size_t { row } * width);
+            row = end;
+        }
+    }
+
+    ImGui::Begin("Display", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse);
+    if (width && height) {
+        ImGui::Image(static_cast<ImTextureID>(m_display_texture), ImVec2 { static_cast<float>(width), static_cast<float>(height) });
+    } else {
+        ImGui::TextUnformatted("No display");
+    }
+    ImGui::End();
+}
@@ -5,6 +5,7 @@
 #include <string_view>
 
 #include "Bus.h"
+#include "Display_converter.h"
 #include "../../../../Library/Frameworks/SDL3.xcframework/macos-arm64_x86_64/SDL3.framework/Versions/A/Headers/SDL_video.h"
 #include "Dependencies/imgui/imgui.h"
 
@@ -42,7 +43,18 @@ private:
    uint32_t last_pc {};
    ImVec4 addr_colour = ImVec4{0, 80, 200, 1};
 
+   Display_converter m_display_converter {};
+   // GL texture the display is uploaded to, and the size it was made with
+   unsigned int m_display_texture {};
+   uint32_t m_texture_width {};
+   uint32_t m_texture_height {};
+
    void disassemble_memory(std::span<const std::byte> memory);
    void render_executed_instructions();
    void render_cpu_registers() const;
+   // Speed, guest MIPS and frame time in a corner, with the speed mode
+   void render_performance_overlay();
+   // What the video output shows. Uploads only the rows written since the
+   // last frame, and nothing when no row was.
+   void render_display();
 };
@@ -5,14 +5,6 @@
 #include <sstream>
 #include <unistd.h>
 
-#include "Bus.h"
-
-Instruction::Instruction(std::span<const std::byte> data, uint32_t pc) {
-	memcpy(&m_data, data.data(), sizeof(int));
-	m_opcode = determine_opcode(m_data);
-	m_pc = pc;
-	//to_string(pc);
-}
 
 Instruction::Instruction() {
 	m_opcode = Opcode::unknown;
@@ -77,94 +69,140 @@ std::string_view Instruction::opcode_as_string() const {
 	}
 }
 
-Instruction::Opcode Instruction::determine_opcode(uint32_t data) {
-	uint8_t primary_opcode { static_cast<uint8_t>(data >> 26) };
-
+bool Instruction::is_branch() const {
 	using enum Opcode;
-	switch (primary_opcode) {
-		case 0b001100: return andi;
-		case 0b001101: return ori;
-		case 0b001001: return addiu;
-		case 0b001000: return addi;
-		case 0b001111: return lui;
-		case 0b001010: return slti;
-		case 0b001011: return sltiu;
-		case 0b100011: return lw;
-		case 0b100000: return lb;
-		case 0b100100: return lbu;
-		case 0b100101: return lhu;
-		case 0b100001: return lh;
-		case 0b100110: return lwr;
-		case 0b101011: return sw;
-		case 0b101001: return sh;
-		case 0b101000: return sb;
-		case 0b000010: return jump;
-		case 0b000011: return jal;
-		case 0b000101: return bne;
-		case 0b000100: return beq;
-		case 0b000111: return bgtz;
-		case 0b000110: return blez;
-		// Certain branch instructions. Need to check bits 16 to 20
-		case 0b000001: {
-			uint8_t branch_opcode { static_cast<uint8_t>(data >> 16 & 0b11111) };
-			switch (branch_opcode) {
-				case 0b00000: return bltz;
-				case 0b00001: return bgez;
-				default: ;
+	switch (m_opcode) {
+		case jump:
+		case jal:
+		case jr:
+		case jalr:
+		case bne:
+		case beq:
+		case bgtz:
+		case bgez:
+		case blez:
+		case bltz:
+			return true;
+		default:
+			return false;
+	}
+}
+
+namespace {
+	// The nested switch the tables replaced. It is only kept to check the tables
+	// against at compile time.
+	constexpr Instruction::Opcode reference_decode(uint32_t data) {
+		uint8_t primary_opcode { static_cast<uint8_t>(data >> 26) };
+
+		using enum Instruction::Opcode;
+		switch (primary_opcode) {
+			case 0b001100: return andi;
+			case 0b001101: return ori;
+			case 0b001001: return addiu;
+			case 0b001000: return addi;
+			case 0b001111: return lui;
+			case 0b001010: return slti;
+			case 0b001011: return sltiu;
+			case 0b100011: return lw;
+			case 0b100000: return lb;
+			case 0b100100: return lbu;
+			case 0b100101: return lhu;
+			case 0b100001: return lh;
+			case 0b100110: return lwr;
+			case 0b101011: return sw;
+			case 0b101001: return sh;
+			case 0b101000: return sb;
+			case 0b000010: return jump;
+			case 0b000011: return jal;
+			case 0b000101: return bne;
+			case 0b000100: return beq;
+			case 0b000111: return bgtz;
+			case 0b000110: return blez;
+			// Certain branch instructions. Need to check bits 16 to 20
+			case 0b000001: {
+				uint8_t branch_opcode { static_cast<uint8_t>(data >> 16 & 0b11111) };
+				switch (branch_opcode) {
+					case 0b00000: return bltz;
+					case 0b00001: return bgez;
+					default: return unknown;
+				}
 			}
-		}
-		// Special instruction. So we check secondary opcode
-		case 0b000000: {
-			uint8_t secondary_opcode { static_cast<uint8_t>(data & 0b111111) };
-			switch (secondary_opcode) {
-				case 0b000000: return sll;
-				case 0b000010: return srl;
-				case 0b000100: return sllv;
-				case 0b000111: return srav;
-				case 0b000110: return srlv;
-				case 0b000011: return sra;
-				case 0b100100: return and_b;
-				case 0b100101: return or_b;
-				case 0b100111: return nor;
-				case 0b100110: return Xor;
-				case 0b101010: return slt;
-				case 0b101011: return sltu;
-				case 0b100001: return addu;
-				case 0b100000: return add;
-				case 0b100011: return subu;
-				case 0b011010: return div;
-				case 0b011011: return divu;
-				case 0b011001: return multu;
-				case 0b001000: return jr;
-				case 0b001001: return jalr;
-				case 0b010010: return mflo;
-				case 0b010000: return mfhi;
-				case 0b010011: return mtlo;
-				case 0b010001: return mthi;
-				case 0b001100: return syscall;
-				default:
-					return unknown;
+			// Special instruction. So we check secondary opcode
+			case 0b000000: {
+				uint8_t secondary_opcode { static_cast<uint8_t>(data & 0b111111) };
+				switch (secondary_opcode) {
+					case 0b000000: return sll;
+					case 0b000010: return srl;
+					case 0b000100: return sllv;
+					case 0b000111: return srav;
+					case 0b000110: return srlv;
+					case 0b000011: return sra;
+					case 0b100100: return and_b;
+					case 0b100101: return or_b;
+					case 0b100111: return nor;
+					case 0b100110: return Xor;
+					case 0b101010: return slt;
+					case 0b101011: return sltu;
+					case 0b100001: return addu;
+					case 0b100000: return add;
+					case 0b100011: return subu;
+					case 0b011010: return div;
+					case 0b011011: return divu;
+					case 0b011001: return multu;
+					case 0b001000: return jr;
+					case 0b001001: return jalr;
+					case 0b010010: return mflo;
+					case 0b010000: return mfhi;
+					case 0b010011: return mtlo;
+					case 0b010001: return mthi;
+					case 0b001100: return syscall;
+					default:
+						return unknown;
+				}
 			}
-		}
-		// Cop0 instruction. Check next 5 bits
-		case 0b010000: {
-			uint8_t cop0_opcode { static_cast<uint8_t>((data >> 21) & 0b111111) };
-			switch (cop0_opcode) {
-				case 0b00100: return mtc0;
-				case 0b00000: return mfc0;
+			// Cop0 instruction. Check next 5 bits
+			case 0b010000: {
+				uint8_t cop0_opcode { static_cast<uint8_t>((data >> 21) & 0b111111) };
+				switch (cop0_opcode) {
+					case 0b00100: return mtc0;
+					case 0b00000: return mfc0;
+				}
+
+				switch (data & 0b111111) {
+					case 0b010000: return rfe;
+				}
+
+				return unknown;
 			}
+			default: 
+				return unknown;
+		}
+	}
 
-			switch (data & 0b111111) {
-				case 0b010000: return rfe;
+	// Decoding only depends on the primary opcode, rs (COP0), rt (REGIMM) and the
+	// function field (SPECIAL, COP0), so every combination of those is covered.
+	constexpr bool tables_match_reference() {
+		auto matches = [](uint32_t data) { return Instruction::decode(data) == reference_decode(data); };
+		for (uint32_t primary { 0 }; primary < 64; primary++) {
+			for (uint32_t rs { 0 }; rs < 32; rs++) {
+				for (uint32_t function { 0 }; function < 64; function++) {
+					if (!matches(primary << 26 | rs << 21 | function)) {
+						return false;
+					}
+				}
 			}
 
-			return unknown;
+			for (uint32_t rt { 0 }; rt < 32; rt++) {
+				if (!matches(primary << 26 | rt << 16)) {
+					return false;
+				}
+			}
 		}
-		default: 
-			return unknown;
+		return true;
 	}
-}
 
+	static_assert(tables_match_reference(), "Decode tables disagree with the reference decoder");
+}
 
 std::string Instruction::as_hex() const {
 	std::stringstream ss;
@@ -279,7 +317,6 @@ std::string Instruction::to_string() {
         case Instruction::Opcode::jal: {
             std::stringstream value_as_hex;
         	uint32_t addr { (m_pc & 0xf0000000) | jump_addr() << 2 };
-        	Bus::to_physical_address(addr);
         	value_as_hex << "0x" << std::hex << addr;
             return instruction_to_string( {
                 value_as_hex.str()
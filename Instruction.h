@@ -1,9 +1,13 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <span>
+#include <string>
+#include <string_view>
+#include <vector>
 
 // Register names are from 
 // https://psx-spx.consoledev.net/cpuspecifications/
@@ -142,10 +146,15 @@ public:
 		unknown,
 	};
 
-	explicit Instruction(std::span<const std::byte> data, uint32_t pc);
+	static constexpr size_t opcode_count { static_cast<size_t>(Opcode::unknown) + 1 };
+
+	explicit Instruction(uint32_t data, uint32_t pc) : m_data { data }, m_opcode { decode(data) }, m_pc { pc } {}
 	explicit Instruction();
 
-	explicit Instruction(uint32_t data) : m_data { data }, m_opcode { determine_opcode(data) } {}
+	explicit Instruction(uint32_t data) : m_data { data }, m_opcode { decode(data) } {}
+
+	// Maps an instruction word to its opcode using the tables in Instruction_decoder
+	static constexpr Opcode decode(uint32_t data);
 	
 	Register rs() const { return static_cast<Register>((m_data >> 21) & 0b11111); }
 	Register base() const { return static_cast<Register>((m_data >> 21) & 0b11111); }
@@ -168,6 +177,8 @@ public:
 
 	// Returns a type based on the 5 bit identifier
 	Opcode opcode() const { return m_opcode; }
+	// True for jumps and branches, which are followed by a delay slot
+	bool is_branch() const;
 	std::string_view opcode_as_string() const;
 
 	uint32_t data() const { return m_data; }
@@ -243,6 +254,113 @@ private:
 	uint32_t m_data {};
 	Opcode m_opcode {};
 	uint32_t m_pc {};
-
-	Instruction::Opcode determine_opcode(uint32_t data);
 };
+
+// Decoding is a walk down a small tree of lookup tables. The primary opcode
+// (bits 26-31) indexes the first table. SPECIAL, REGIMM and COP0 entries point
+// at a second table indexed by another field of the word, and COP0 has a third
+// level for the function field. Everything is built at compile time.
+namespace Instruction_decoder {
+	struct Node {
+		Instruction::Opcode opcode { Instruction::Opcode::unknown };
+		// When mask is non zero the node is not a leaf and the walk continues at
+		// table[next + ((data >> shift) & mask)]
+		uint16_t next {};
+		uint8_t shift {};
+		uint8_t mask {};
+	};
+
+	inline constexpr uint16_t primary_table { 0 };
+	inline constexpr uint16_t special_table { 64 };
+	inline constexpr uint16_t regimm_table { special_table + 64 };
+	inline constexpr uint16_t cop0_table { regimm_table + 32 };
+	inline constexpr uint16_t cop0_function_table { cop0_table + 32 };
+	inline constexpr uint16_t table_size { cop0_function_table + 64 };
+
+	constexpr std::array<Node, table_size> build_table() {
+		using enum Instruction::Opcode;
+		std::array<Node, table_size> table {};
+
+		auto primary = [&](uint32_t opcode, Instruction::Opcode op) { table[primary_table + opcode].opcode = op; };
+		auto special = [&](uint32_t function, Instruction::Opcode op) { table[special_table + function].opcode = op; };
+		auto regimm = [&](uint32_t rt, Instruction::Opcode op) { table[regimm_table + rt].opcode = op; };
+
+		// Primary opcodes that select a secondary table
+		table[primary_table + 0b000000] = { unknown, special_table, 0, 0b111111 };
+		table[primary_table + 0b000001] = { unknown, regimm_table, 16, 0b11111 };
+		table[primary_table + 0b010000] = { unknown, cop0_table, 21, 0b11111 };
+
+		primary(0b001100, andi);
+		primary(0b001101, ori);
+		primary(0b001001, addiu);
+		primary(0b001000, addi);
+		primary(0b001111, lui);
+		primary(0b001010, slti);
+		primary(0b001011, sltiu);
+		primary(0b100011, lw);
+		primary(0b100000, lb);
+		primary(0b100100, lbu);
+		primary(0b100101, lhu);
+		primary(0b100001, lh);
+		primary(0b100110, lwr);
+		primary(0b101011, sw);
+		primary(0b101001, sh);
+		primary(0b101000, sb);
+		primary(0b000010, jump);
+		primary(0b000011, jal);
+		primary(0b000101, bne);
+		primary(0b000100, beq);
+		primary(0b000111, bgtz);
+		primary(0b000110, blez);
+
+		regimm(0b00000, bltz);
+		regimm(0b00001, bgez);
+
+		special(0b000000, sll);
+		special(0b000010, srl);
+		special(0b000100, sllv);
+		special(0b000111, srav);
+		special(0b000110, srlv);
+		special(0b000011, sra);
+		special(0b100100, and_b);
+		special(0b100101, or_b);
+		special(0b100111, nor);
+		special(0b100110, Xor);
+		special(0b101010, slt);
+		special(0b101011, sltu);
+		special(0b100001, addu);
+		special(0b100000, add);
+		special(0b100011, subu);
+		special(0b011010, div);
+		special(0b011011, divu);
+		special(0b011001, multu);
+		special(0b001000, jr);
+		special(0b001001, jalr);
+		special(0b010010, mflo);
+		special(0b010000, mfhi);
+		special(0b010011, mtlo);
+		special(0b010001, mthi);
+		special(0b001100, syscall);
+
+		// COP0 is keyed on the rs field. Anything that isn't a move is a
+		// coprocessor operation selected by the function field.
+		for (uint16_t rs { 0 }; rs < 32; rs++) {
+			table[cop0_table + rs] = { unknown, cop0_function_table, 0, 0b111111 };
+		}
+		table[cop0_table + 0b00000] = { mfc0 };
+		table[cop0_table + 0b00100] = { mtc0 };
+		table[cop0_function_table + 0b010000].opcode = rfe;
+
+		return table;
+	}
+
+	inline constexpr std::array<Node, table_size> table { build_table() };
+}
+
+constexpr Instruction::Opcode Instruction::decode(uint32_t data) {
+	Instruction_decoder::Node node { Instruction_decoder::table[data >> 26] };
+	while (node.mask != 0) {
+		node = Instruction_decoder::table[node.next + ((data >> node.shift) & node.mask)];
+	}
+	return node.opcode;
+}
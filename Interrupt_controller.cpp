@@ -0,0 +1,54 @@
+#include "Interrupt_controller.h"
+
+#include <utility>
+
+#include "Logger.h"
+
+void Interrupt_controller::set_line_handler(Line_handler handler) {
+    m_line_handler = std::move(handler);
+    if (m_line_handler) {
+        m_line_handler(m_line_active);
+    }
+}
+
+void Interrupt_controller::request(Source source) {
+    m_status |= 1u << static_cast<uint32_t>(source);
+    update_line();
+}
+
+uint32_t Interrupt_controller::read(uint32_t physical_address) const {
+    if (physical_address == 0x1f801070) {
+        return m_status;
+    }
+    if (physical_address == 0x1f801074) {
+        return m_mask;
+    }
+
+    LOG_WARNING("[IRQ] Read from unused register 0x{:x}", physical_address);
+    return 0;
+}
+
+void Interrupt_controller::write(uint32_t physical_address, uint32_t value, uint32_t lanes) {
+    if (physical_address == 0x1f801070) {
+        // Writing 0 to a bit acknowledges it, writing 1 leaves it alone
+        m_status &= value | ~lanes;
+    } else if (physical_address == 0x1f801074) {
+        m_mask = ((m_mask & ~lanes) | (value & lanes)) & m_source_mask;
+    } else {
+        LOG_WARNING("[IRQ] Write to unused register 0x{:x}", physical_address);
+        return;
+    }
+    update_line();
+}
+
+void Interrupt_controller::update_line() {
+    bool active { (m_status & m_mask) != 0 };
+    if (active == m_line_active) {
+        return;
+    }
+
+    m_line_active = active;
+    if (m_line_handler) {
+        m_line_handler(active);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// I_STAT and I_MASK. Devices request interrupts here and the controller
+// drives the CPU's hardware interrupt line (CAUSE bit 10) whenever a
+// requested interrupt is also unmasked. The line handler only runs when
+// the line actually changes.
+class Interrupt_controller {
+public:
+    enum class Source : uint32_t {
+        vblank,
+        gpu,
+        cdrom,
+        dma,
+        timer_0,
+        timer_1,
+        timer_2,
+        controller,
+        sio,
+        spu,
+        lightpen,
+    };
+
+    using Line_handler = std::function<void(bool active)>;
+    void set_line_handler(Line_handler handler);
+
+    void request(Source source);
+    bool line_active() const { return m_line_active; }
+
+    // Register accesses from the bus.
+    // 0x1f801070 -> I_STAT, 0x1f801074 -> I_MASK
+    // Byte and halfword stores only write the bits set in lanes.
+    uint32_t read(uint32_t physical_address) const;
+    void write(uint32_t physical_address, uint32_t value, uint32_t lanes = 0xffffffff);
+private:
+    static constexpr uint32_t m_source_mask { 0x7ff };
+
+    uint32_t m_status {};
+    uint32_t m_mask {};
+    bool m_line_active {};
+    Line_handler m_line_handler {};
+
+    void update_line();
+};
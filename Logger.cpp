@@ -0,0 +1,225 @@
+#include "Logger.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+    // Bounded multi producer, single consumer queue. Each slot carries a
+    // sequence number that tells producers and the consumer whose turn it is,
+    // so neither side takes a lock.
+    class Log_queue {
+    public:
+        Log_queue() : m_slots { std::make_unique<Slot[]>(m_capacity) } {
+            for (uint64_t i { 0 }; i < m_capacity; i++) {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool try_push(Logger::Level level, std::string_view message) {
+            uint64_t position { m_enqueue_position.load(std::memory_order_relaxed) };
+            Slot* slot {};
+            while (true) {
+                slot = &m_slots[position & (m_capacity - 1)];
+                uint64_t sequence { slot->sequence.load(std::memory_order_acquire) };
+                auto difference { static_cast<int64_t>(sequence - position) };
+                if (difference == 0) {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    // Full. The consumer has not freed this slot yet
+                    return false;
+                } else {
+                    position = m_enqueue_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->level = level;
+            slot->timestamp = std::chrono::system_clock::now();
+            slot->length = std::min(message.size(), Logger::max_message_length);
+            message.copy(slot->message.data(), slot->length);
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Only ever called from the writer thread
+        bool try_pop(Logger::Entry& entry) {
+            Slot& slot { m_slots[m_dequeue_position & (m_capacity - 1)] };
+            if (slot.sequence.load(std::memory_order_acquire) != m_dequeue_position + 1) {
+                return false;
+            }
+
+            entry.level = slot.level;
+            entry.timestamp = slot.timestamp;
+            entry.message.assign(slot.message.data(), slot.length);
+            slot.sequence.store(m_dequeue_position + m_capacity, std::memory_order_release);
+            m_dequeue_position++;
+            return true;
+        }
+
+        uint64_t enqueued() const { return m_enqueue_position.load(std::memory_order_acquire); }
+    private:
+        struct Slot {
+            std::atomic<uint64_t> sequence {};
+            Logger::Level level {};
+            std::chrono::time_point<std::chrono::system_clock> timestamp {};
+            size_t length {};
+            std::array<char, Logger::max_message_length> message {};
+        };
+
+        static constexpr uint64_t m_capacity { 4096 };
+        std::unique_ptr<Slot[]> m_slots {};
+
+        alignas(64) std::atomic<uint64_t> m_enqueue_position {};
+        alignas(64) uint64_t m_dequeue_position {};
+    };
+
+    class Log_writer {
+    public:
+        Log_writer() : m_history(m_max_entries), m_thread { [this] { run(); } } {
+        }
+
+        ~Log_writer() {
+            m_stopping.store(true, std::memory_order_release);
+            wake();
+            m_thread.join();
+        }
+
+        void push(Logger::Level level, std::string_view message) {
+            while (!m_queue.try_push(level, message)) {
+                // Errors usually come right before an exit, so they wait for room
+                if (level != Logger::Level::error) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                wake();
+                std::this_thread::yield();
+            }
+            wake();
+        }
+
+        void flush() {
+            uint64_t target { m_queue.enqueued() };
+            wake();
+            while (m_written.load(std::memory_order_acquire) < target) {
+                std::this_thread::yield();
+            }
+        }
+
+        void clear() {
+            std::lock_guard lock { m_history_mutex };
+            m_history_start = 0;
+            m_history_size = 0;
+        }
+
+        std::vector<Logger::Entry> entries() {
+            std::lock_guard lock { m_history_mutex };
+            std::vector<Logger::Entry> entries {};
+            entries.reserve(m_history_size);
+            for (size_t i { 0 }; i < m_history_size; i++) {
+                entries.push_back(m_history[(m_history_start + i) % m_max_entries]);
+            }
+            return entries;
+        }
+    private:
+        Log_queue m_queue {};
+        std::atomic<uint32_t> m_wakeups {};
+        std::atomic<bool> m_stopping {};
+        std::atomic<uint64_t> m_written {};
+        std::atomic<uint64_t> m_dropped {};
+
+        // Ring of the most recent entries
+        static constexpr size_t m_max_entries { 1000 };
+        std::mutex m_history_mutex {};
+        std::vector<Logger::Entry> m_history {};
+        size_t m_history_start {};
+        size_t m_history_size {};
+
+        // Declared last so everything above exists before the thread starts
+        std::thread m_thread;
+
+        void wake() {
+            m_wakeups.fetch_add(1, std::memory_order_release);
+            m_wakeups.notify_one();
+        }
+
+        void run() {
+            Logger::Entry entry {};
+            while (true) {
+                uint32_t wakeups { m_wakeups.load(std::memory_order_acquire) };
+
+                uint64_t written {};
+                while (m_queue.try_pop(entry)) {
+                    std::cout << entry;
+                    remember(entry);
+                    written++;
+                }
+                report_dropped();
+                if (written > 0) {
+                    std::cout.flush();
+                    m_written.fetch_add(written, std::memory_order_release);
+                }
+
+                if (m_stopping.load(std::memory_order_acquire)) {
+                    // Producers may still have slipped something in before we stopped
+                    if (m_queue.enqueued() == m_written.load(std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+                m_wakeups.wait(wakeups, std::memory_order_acquire);
+            }
+        }
+
+        void remember(const Logger::Entry& entry) {
+            std::lock_guard lock { m_history_mutex };
+            if (m_history_size < m_max_entries) {
+                m_history[(m_history_start + m_history_size++) % m_max_entries] = entry;
+            } else {
+                m_history[m_history_start] = entry;
+                m_history_start = (m_history_start + 1) % m_max_entries;
+            }
+        }
+
+        void report_dropped() {
+            uint64_t dropped { m_dropped.exchange(0, std::memory_order_relaxed) };
+            if (dropped == 0) {
+                return;
+            }
+
+            Logger::Entry entry {
+                Logger::Level::warning,
+                std::format("[LOGGER] Dropped {} messages, the queue was full", dropped),
+                std::chrono::system_clock::now()
+            };
+            std::cout << entry;
+            remember(entry);
+        }
+    };
+
+    Log_writer& writer() {
+        static Log_writer writer {};
+        return writer;
+    }
+}
+
+void Logger::push(Level level, std::string_view message) {
+    writer().push(level, message);
+}
+
+void Logger::flush() {
+    writer().flush();
+}
+
+void Logger::clear() {
+    writer().clear();
+}
+
+std::vector<Logger::Entry> Logger::entries() {
+    return writer().entries();
+}
@@ -4,11 +4,41 @@
 #include <windows.h>
 #endif
 
+#include <algorithm>
+#include <array>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <chrono>
+#include <format>
 #include <iostream>
 
+// Log calls below this level are compiled out of the LOG_ macros entirely.
+// 0 is debug, 1 info, 2 warning and 3 error.
+#ifndef SOULPSX_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define SOULPSX_LOG_MIN_LEVEL 2
+#else
+#define SOULPSX_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// Checks the level before the arguments are evaluated, so a filtered call
+// costs one comparison. Takes a std::format string and its arguments.
+#define LOG_AT(level, ...) \
+    do { \
+        if constexpr (level >= Logger::compile_time_min_level) { \
+            if (Logger::enabled(level)) { \
+                Logger::log(level, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(Logger::Level::debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(Logger::Level::info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(Logger::Level::warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(Logger::Level::error, __VA_ARGS__)
+
 namespace ANSI_Colours {
     static std::string reset { "\033[0m" };
     static std::string grey { "\033[90m" };
@@ -18,6 +48,9 @@ namespace ANSI_Colours {
 
 }
 
+// Messages are queued on a fixed size lock free ring and written to the
+// console by a background thread, so logging never waits on stdout. If the
+// ring fills up, messages are dropped and the writer reports how many.
 class Logger {
 public:
     enum class Level {
@@ -33,21 +66,36 @@ public:
         std::chrono::time_point<std::chrono::system_clock> timestamp {};
     };
 
-    static void log(Level level, std::string message) {
-        if (level < m_min_level) return;
+    static constexpr Level compile_time_min_level { static_cast<Level>(SOULPSX_LOG_MIN_LEVEL) };
+
+    static bool enabled(Level level) {
+        return level >= compile_time_min_level && level >= m_min_level;
+    }
+    static void set_min_level(Level level) { m_min_level = level; }
 
-        const auto timestamp = std::chrono::system_clock::now();
-        Entry entry { level, std::move(message), timestamp };
-        m_entries.emplace_back(entry);
-        std::cout << entry;
+    static void log(Level level, std::string_view message) {
+        if (!enabled(level)) return;
+        push(level, message);
+    }
 
-        if (m_entries.size() > m_max_entries) {
-            m_entries.erase(m_entries.begin(), m_entries.begin() + 100);
-        }
+    // Formats straight into a stack buffer, only once the level has passed
+    template<typename... Args>
+    static void log(Level level, std::format_string<Args...> format, Args&&... args) {
+        if (!enabled(level)) return;
+        std::array<char, max_message_length> buffer;
+        auto result { std::format_to_n(buffer.data(), buffer.size(), format, std::forward<Args>(args)...) };
+        push(level, { buffer.data(), std::min<size_t>(result.size, buffer.size()) });
     }
 
-    static void clear() { m_entries.clear(); }
-    static const std::vector<Entry>& entries() { return m_entries; }
+    // Blocks until everything logged so far has been written out
+    static void flush();
+
+    // The most recent entries written out, oldest first
+    static void clear();
+    static std::vector<Entry> entries();
+
+    // Messages longer than this are truncated
+    static constexpr size_t max_message_length { 240 };
 
     friend std::ostream& operator<<(std::ostream& out, const Entry& entry) {
 #ifdef _WIN32
@@ -82,7 +130,7 @@ public:
         return ANSI_Colours::reset;
     }
 private:
-    inline static std::vector<Entry> m_entries {};
-    inline static uint32_t m_max_entries { 1000 };
+    static void push(Level level, std::string_view message);
+
     inline static Level m_min_level { Level::debug };
 };
@@ -30,6 +30,9 @@ namespace Memory {
 namespace Memory::Map {
     static constexpr Range bios { 0x1fc00000, 512 * 1024 };
     static constexpr Range ram { 0x0, 2048 * 1024 };
+    // Ram repeats every 2MB up to here
+    static constexpr Range ram_mirrors { 0x0, 8 * 1024 * 1024 };
+    static constexpr Range scratchpad { 0x1f800000, 1024 };
     static constexpr Range gpu { 0x1f801810, 8 };
     static constexpr Range irq_control { 0x1f801070, 8 };
     static constexpr Range timers { 0x1f801100, 0x2c };
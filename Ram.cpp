@@ -1,14 +1,66 @@
 #include "Ram.h"
-#include <algorithm>
-#include <cstddef>
-#include <cstdint>
-#include <span>
 
-std::span<const std::byte> Ram::read(uint32_t address, uint32_t bytes = 0) {
-	return std::span{ m_ram }.subspan(address, bytes);
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+Ram::Ram() {
+	if (map_mirrors()) {
+		m_mirrored = true;
+		m_offset_mask = window_size - 1;
+		return;
+	}
+
+	LOG_WARNING("[RAM] Could not map the ram mirrors, falling back to masked access");
+	m_fallback = std::make_unique<std::byte[]>(ram_size);
+	m_window = m_fallback.get();
 }
 
-void Ram::write(uint32_t address, std::span<const std::byte> data) {
-	std::copy(data.begin(), data.end(), m_ram.begin() + address);
+Ram::~Ram() {
+#if defined(__linux__)
+	if (m_mirrored) {
+		munmap(m_window, window_size);
+	}
+#endif
 }
 
+// Reserves the whole window, then maps one memfd over each mirror so they all
+// share the same physical pages.
+bool Ram::map_mirrors() {
+#if defined(__linux__)
+	int fd { memfd_create("soulpsx-ram", MFD_CLOEXEC) };
+	if (fd < 0) {
+		return false;
+	}
+	if (ftruncate(fd, ram_size) != 0) {
+		close(fd);
+		return false;
+	}
+
+	void* window { mmap(nullptr, window_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) };
+	if (window == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	auto* base { static_cast<std::byte*>(window) };
+	for (uint32_t mirror { 0 }; mirror < mirror_count; mirror++) {
+		void* view { mmap(base + mirror * ram_size, ram_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) };
+		if (view == MAP_FAILED) {
+			munmap(window, window_size);
+			close(fd);
+			return false;
+		}
+	}
+
+	// The mappings keep the memory alive
+	close(fd);
+	m_window = base;
+	return true;
+#else
+	return false;
+#endif
+}
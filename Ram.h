@@ -1,16 +1,57 @@
 #pragma once
 
-#include <array>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <span>
 
+#include "Memory.h"
+
+// Main ram is 2MB and shows up four times across the first 8MB of the
+// physical address space. Where the host allows it the same memory is mapped
+// at every mirror, so any address in the window can be used as is. Otherwise
+// there is a single copy and offsets get masked down to it.
 class Ram {
 public:
+	Ram();
+	~Ram();
+
+	Ram(const Ram&) = delete;
+	Ram& operator=(const Ram&) = delete;
+
+	// Offsets may be anywhere within the mirrored window
+	template<typename T>
+	T read(uint32_t offset) const {
+		T value {};
+		std::memcpy(&value, m_window + (offset & m_offset_mask), sizeof(T));
+		return value;
+	}
+
+	template<typename T>
+	void write(uint32_t offset, T value) {
+		std::memcpy(m_window + (offset & m_offset_mask), &value, sizeof(T));
+	}
 
-	std::span<const std::byte> read(uint32_t address, uint32_t bytes);
-	void write(uint32_t address, std::span<const std::byte> data);
-	std::span<const std::byte> get_memory() const { return { m_ram.data(), m_ram_size }; }
+	std::span<const std::byte> get_memory() const { return { m_window, ram_size }; }
+
+	// Host memory backing the given mirror, for the bus page table
+	std::byte* mirror(uint32_t index) { return m_window + ((index * ram_size) & m_offset_mask); }
+	// Whether every mirror has its own host addresses
+	bool mirrored() const { return m_mirrored; }
+	// The whole mirrored window for base plus offset addressing, or nullptr
+	// when only masked access is available
+	std::byte* host_window() { return m_mirrored ? m_window : nullptr; }
+
+	static constexpr uint32_t ram_size { Memory::Map::ram.size() };
+	static constexpr uint32_t window_size { Memory::Map::ram_mirrors.size() };
+	static constexpr uint32_t mirror_count { window_size / ram_size };
 private:
-	static constexpr int m_ram_size { 2048 * 1024 };
-	std::array<std::byte, m_ram_size> m_ram {};
+	std::byte* m_window {};
+	uint32_t m_offset_mask { ram_size - 1 };
+	bool m_mirrored {};
+
+	// Backing store when the mirrors could not be mapped
+	std::unique_ptr<std::byte[]> m_fallback {};
+
+	bool map_mirrors();
 };
@@ -0,0 +1,611 @@
+#include "Rasterizer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SOULPSX_RASTERIZER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    // Added to 8 bit colors before they are cut down to 5 bits
+    constexpr std::array<std::array<int32_t, 4>, 4> dither_table {{
+        { -4, 0, -3, 1 },
+        { 2, -2, 3, -1 },
+        { -3, 1, -4, 0 },
+        { 3, -1, 2, -2 },
+    }};
+
+    constexpr int32_t max_width { 1023 };
+    constexpr int32_t max_height { 511 };
+
+    int64_t floor_divide(int64_t numerator, int64_t denominator) {
+        int64_t quotient { numerator / denominator };
+        if ((numerator % denominator != 0) && ((numerator < 0) != (denominator < 0))) {
+            quotient--;
+        }
+        return quotient;
+    }
+
+    int32_t edge_function(const Rasterizer::Vertex& a, const Rasterizer::Vertex& b, int32_t x, int32_t y) {
+        return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+    }
+
+    // With the vertices wound so the area is positive, top and left edges
+    // own the pixels that lie exactly on them
+    bool is_top_left(const Rasterizer::Vertex& a, const Rasterizer::Vertex& b) {
+        int32_t dx { b.x - a.x };
+        int32_t dy { b.y - a.y };
+        return dy < 0 || (dy == 0 && dx > 0);
+    }
+
+    uint32_t blend(uint32_t back, uint32_t front, uint32_t mode) {
+        switch (mode) {
+            case 0: return (back + front) >> 1;
+            case 1: return std::min(back + front, 31u);
+            case 2: return back > front ? back - front : 0;
+            default: return std::min(back + (front >> 2), 31u);
+        }
+    }
+
+    // A variant's flags, unpacked for if constexpr
+    struct Variant_flags {
+        bool raw_texture {};
+        bool semi_transparent {};
+        bool textured {};
+        bool shaded {};
+        uint32_t blend_mode {};
+        bool dither {};
+        bool check_mask {};
+        bool cached_texels {};
+
+        constexpr explicit Variant_flags(uint32_t variant)
+            : raw_texture { (variant & Rasterizer::variant_raw_texture) != 0 },
+            semi_transparent { (variant & Rasterizer::variant_semi_transparent) != 0 },
+            textured { (variant & Rasterizer::variant_textured) != 0 },
+            shaded { (variant & Rasterizer::variant_shaded) != 0 },
+            blend_mode { (variant >> Rasterizer::variant_blend_shift) & 3 },
+            dither { (variant & Rasterizer::variant_dither) != 0 },
+            check_mask { (variant & Rasterizer::variant_check_mask) != 0 },
+            cached_texels { (variant & Rasterizer::variant_cached_texels) != 0 } {
+        }
+    };
+
+    // Clears flags that make no difference to the pixels, so the kernel
+    // tables only instantiate kernels that differ: about 130 of the 512
+    constexpr uint32_t canonical_variant(uint32_t variant) {
+        if (!(variant & Rasterizer::variant_textured)) {
+            variant &= ~(Rasterizer::variant_raw_texture | Rasterizer::variant_cached_texels);
+        }
+        // Raw texels ignore the color, and flat colors are not dithered
+        if (variant & Rasterizer::variant_raw_texture) {
+            variant &= ~(Rasterizer::variant_shaded | Rasterizer::variant_dither);
+        }
+        if (!(variant & (Rasterizer::variant_shaded | Rasterizer::variant_textured))) {
+            variant &= ~Rasterizer::variant_dither;
+        }
+        if (!(variant & Rasterizer::variant_semi_transparent)) {
+            variant &= ~(3u << Rasterizer::variant_blend_shift);
+        }
+        return variant;
+    }
+}
+
+Rasterizer::Rasterizer(Vram& vram) : m_vram { vram } {
+    set_backend(Backend::avx2);
+}
+
+Rasterizer::Backend Rasterizer::best_backend() {
+#ifdef SOULPSX_RASTERIZER_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return Backend::avx2;
+    }
+#endif
+    return Backend::scalar;
+}
+
+void Rasterizer::set_backend(Backend backend) {
+    m_backend = backend == Backend::avx2 ? best_backend() : Backend::scalar;
+    m_kernels = m_backend == Backend::avx2 ? &avx2_kernels : &scalar_kernels;
+}
+
+void Rasterizer::draw_triangle(const Draw_settings& settings, const Triangle& triangle) {
+    Setup setup {};
+    if (setup_triangle(settings, triangle, setup)) {
+        draw(setup);
+    }
+}
+
+void Rasterizer::draw_triangles(const Draw_settings& settings, std::span<const Triangle> triangles) {
+    for (const Triangle& triangle : triangles) {
+        Setup setup {};
+        if (setup_triangle(settings, triangle, setup)) {
+            draw(setup);
+        }
+    }
+}
+
+void Rasterizer::draw(const Setup& setup) {
+    const std::array<Kernel, variant_count>& kernels { setup.samples_own_pixels ? scalar_kernels : *m_kernels };
+    (this->*kernels[setup.variant])(setup);
+}
+
+bool Rasterizer::setup_triangle(const Draw_settings& settings, const Triangle& triangle, Setup& setup) {
+    std::array<Vertex, 3> v { triangle.vertices };
+    int32_t area { edge_function(v[0], v[1], v[2].x, v[2].y) };
+    if (area == 0) {
+        return false;
+    }
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        area = -area;
+    }
+
+    auto [min_x, max_x] { std::minmax({ v[0].x, v[1].x, v[2].x }) };
+    auto [min_y, max_y] { std::minmax({ v[0].y, v[1].y, v[2].y }) };
+    // The GPU drops polygons this large outright
+    if (max_x - min_x > max_width || max_y - min_y > max_height) {
+        return false;
+    }
+
+    setup.min_x = std::max(min_x, settings.area_left);
+    setup.max_x = std::min(max_x, settings.area_right);
+    setup.min_y = std::max(min_y, settings.area_top);
+    setup.max_y = std::min(max_y, settings.area_bottom);
+    if (setup.min_x > setup.max_x || setup.min_y > setup.max_y) {
+        return false;
+    }
+
+    // Edge i is the one opposite vertex i
+    for (uint32_t i { 0 }; i < 3; i++) {
+        const Vertex& a { v[(i + 1) % 3] };
+        const Vertex& b { v[(i + 2) % 3] };
+        setup.edge[i] = edge_function(a, b, setup.min_x, setup.min_y);
+        setup.edge_dx[i] = a.y - b.y;
+        setup.edge_dy[i] = b.x - a.x;
+        setup.edge_bias[i] = is_top_left(a, b) ? 0 : 1;
+    }
+
+    // Flat triangles use the first vertex's color everywhere
+    uint32_t flat_color { triangle.vertices[0].color };
+    auto attribute_of = [&](const Vertex& vertex, uint32_t attribute) -> int64_t {
+        uint32_t color { triangle.shaded ? vertex.color : flat_color };
+        switch (attribute) {
+            case red: return color & 0xff;
+            case green: return (color >> 8) & 0xff;
+            case blue: return (color >> 16) & 0xff;
+            case tex_u: return vertex.u;
+            default: return vertex.v;
+        }
+    };
+
+    for (uint32_t i { 0 }; i < attribute_count; i++) {
+        int64_t a0 { attribute_of(v[0], i) };
+        int64_t a1 { attribute_of(v[1], i) - a0 };
+        int64_t a2 { attribute_of(v[2], i) - a0 };
+        int64_t numerator_x { a1 * (v[2].y - v[0].y) - a2 * (v[1].y - v[0].y) };
+        int64_t numerator_y { a2 * (v[1].x - v[0].x) - a1 * (v[2].x - v[0].x) };
+        int64_t dx { floor_divide(numerator_x << fraction_bits, area) };
+        int64_t dy { floor_divide(numerator_y << fraction_bits, area) };
+
+        // Half a step up so truncating the fixed point rounds to nearest
+        int64_t start { (a0 << fraction_bits) + (1 << (fraction_bits - 1))
+            + dx * (setup.min_x - v[0].x) + dy * (setup.min_y - v[0].y) };
+        setup.attribute[i] = static_cast<uint32_t>(start);
+        setup.attribute_dx[i] = static_cast<uint32_t>(dx);
+        setup.attribute_dy[i] = static_cast<uint32_t>(dy);
+    }
+
+    setup.textured = triangle.textured;
+    setup.mask_bit = settings.set_mask ? 0x8000 : 0;
+    setup.texture_depth = std::min((triangle.texpage >> 7) & 3, 2);
+    setup.page_x = (triangle.texpage & 0xf) * 64;
+    setup.page_y = ((triangle.texpage >> 4) & 1) * 256;
+    setup.clut_x = (triangle.clut & 0x3f) * 16;
+    setup.clut_y = (triangle.clut >> 6) & 0x1ff;
+    setup.texels = setup.texture_depth < 2 ? triangle.texels : nullptr;
+    setup.window_and_u = ~(settings.window_mask_x * 8u) & 0xff;
+    setup.window_or_u = (settings.window_offset_x & settings.window_mask_x) * 8u;
+    setup.window_and_v = ~(settings.window_mask_y * 8u) & 0xff;
+    setup.window_or_v = (settings.window_offset_y & settings.window_mask_y) * 8u;
+
+    uint32_t variant { ((triangle.texpage >> 5) & 3u) << variant_blend_shift };
+    variant |= triangle.textured ? variant_textured : 0;
+    variant |= triangle.textured && triangle.raw_texture ? variant_raw_texture : 0;
+    variant |= triangle.semi_transparent ? variant_semi_transparent : 0;
+    variant |= triangle.shaded ? variant_shaded : 0;
+    variant |= settings.dither ? variant_dither : 0;
+    variant |= settings.check_mask ? variant_check_mask : 0;
+    variant |= setup.texels ? variant_cached_texels : 0;
+    setup.variant = canonical_variant(variant);
+    setup.samples_own_pixels = samples_own_pixels(setup);
+    return true;
+}
+
+// Texture pages and CLUTs may run past the edges of VRAM and wrap, the
+// bounds never do
+bool Rasterizer::samples_own_pixels(const Setup& setup) {
+    // Decoded pages are copies, drawing cannot change them
+    if (!setup.textured || setup.texels) {
+        return false;
+    }
+
+    auto overlaps = [](uint32_t start, uint32_t length, int32_t min, int32_t max, uint32_t size) {
+        uint32_t end { start + length - 1 };
+        auto low { static_cast<uint32_t>(min) };
+        auto high { static_cast<uint32_t>(max) };
+        return (start <= high && end >= low) || (start <= high + size && end >= low + size);
+    };
+    auto overlaps_bounds = [&](uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        return overlaps(x, width, setup.min_x, setup.max_x, Vram::width)
+            && overlaps(y, height, setup.min_y, setup.max_y, Vram::height);
+    };
+
+    // Width in VRAM pixels of a page of 4, 8 and 15 bit texels
+    static constexpr std::array<uint32_t, 3> page_widths { 64, 128, 256 };
+    if (overlaps_bounds(setup.page_x, setup.page_y, page_widths[setup.texture_depth], 256)) {
+        return true;
+    }
+    return setup.texture_depth != 2
+        && overlaps_bounds(setup.clut_x, setup.clut_y, setup.texture_depth == 0 ? 16 : 256, 1);
+}
+
+// Edge functions and attributes are linear, and the attributes wrap the
+// same way wherever they start, so moving the origin changes no pixel
+bool Rasterizer::clip(Setup& setup, int32_t left, int32_t top, int32_t right, int32_t bottom) {
+    int32_t min_x { std::max(setup.min_x, left) };
+    int32_t min_y { std::max(setup.min_y, top) };
+    int32_t max_x { std::min(setup.max_x, right) };
+    int32_t max_y { std::min(setup.max_y, bottom) };
+    if (min_x > max_x || min_y > max_y) {
+        return false;
+    }
+
+    int32_t offset_x { min_x - setup.min_x };
+    int32_t offset_y { min_y - setup.min_y };
+    for (uint32_t i { 0 }; i < 3; i++) {
+        setup.edge[i] += setup.edge_dx[i] * offset_x + setup.edge_dy[i] * offset_y;
+    }
+    for (uint32_t i { 0 }; i < attribute_count; i++) {
+        setup.attribute[i] += setup.attribute_dx[i] * static_cast<uint32_t>(offset_x)
+            + setup.attribute_dy[i] * static_cast<uint32_t>(offset_y);
+    }
+    setup.min_x = min_x;
+    setup.min_y = min_y;
+    setup.max_x = max_x;
+    setup.max_y = max_y;
+    return true;
+}
+
+template <uint32_t variant>
+void Rasterizer::draw_scalar(const Setup& setup) {
+    for (int32_t y { setup.min_y }; y <= setup.max_y; y++) {
+        int32_t row { y - setup.min_y };
+        std::array<int32_t, 3> edge {};
+        for (uint32_t i { 0 }; i < 3; i++) {
+            edge[i] = setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i];
+        }
+        std::array<uint32_t, attribute_count> attributes {};
+        for (uint32_t i { 0 }; i < attribute_count; i++) {
+            attributes[i] = setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row);
+        }
+
+        for (int32_t x { setup.min_x }; x <= setup.max_x; x++) {
+            if ((edge[0] | edge[1] | edge[2]) >= 0) {
+                shade_pixel<variant>(setup, x, y, attributes);
+            }
+            for (uint32_t i { 0 }; i < 3; i++) {
+                edge[i] += setup.edge_dx[i];
+            }
+            for (uint32_t i { 0 }; i < attribute_count; i++) {
+                attributes[i] += setup.attribute_dx[i];
+            }
+        }
+    }
+}
+
+template <uint32_t variant>
+void Rasterizer::shade_pixel(const Setup& setup, int32_t x, int32_t y, const std::array<uint32_t, attribute_count>& attributes) {
+    static constexpr Variant_flags flags { variant };
+    uint16_t& pixel { m_vram.row(y)[x] };
+    if (flags.check_mask && (pixel & 0x8000)) {
+        return;
+    }
+
+    std::array<uint32_t, 3> color {};
+    for (uint32_t i { 0 }; i < 3; i++) {
+        color[i] = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[i]) >> fraction_bits, 0, 255));
+    }
+
+    uint16_t texel {};
+    if constexpr (flags.textured) {
+        uint32_t u { static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[tex_u]) >> fraction_bits, 0, 255)) };
+        uint32_t v { static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[tex_v]) >> fraction_bits, 0, 255)) };
+        texel = fetch_texel<variant>(setup, u, v);
+        // Fully transparent
+        if (texel == 0) {
+            return;
+        }
+    }
+
+    std::array<uint32_t, 3> result {};
+    for (uint32_t i { 0 }; i < 3; i++) {
+        if constexpr (flags.raw_texture) {
+            result[i] = (texel >> (i * 5)) & 0x1f;
+            continue;
+        }
+
+        // Modulating by 0x80 leaves the texel as it is
+        int32_t value { static_cast<int32_t>(flags.textured ? (((texel >> (i * 5)) & 0x1f) * color[i]) >> 4 : color[i]) };
+        if constexpr (flags.dither) {
+            value += dither_table[y & 3][x & 3];
+        }
+        result[i] = static_cast<uint32_t>(std::clamp(value, 0, 255)) >> 3;
+    }
+
+    if (flags.semi_transparent && (!flags.textured || (texel & 0x8000))) {
+        for (uint32_t i { 0 }; i < 3; i++) {
+            result[i] = blend((pixel >> (i * 5)) & 0x1f, result[i], flags.blend_mode);
+        }
+    }
+
+    pixel = static_cast<uint16_t>(result[0] | (result[1] << 5) | (result[2] << 10) | (texel & 0x8000) | setup.mask_bit);
+}
+
+template <uint32_t variant>
+uint16_t Rasterizer::fetch_texel(const Setup& setup, uint32_t u, uint32_t v) const {
+    u = (u & setup.window_and_u) | setup.window_or_u;
+    v = (v & setup.window_and_v) | setup.window_or_v;
+    if constexpr (Variant_flags { variant }.cached_texels) {
+        return setup.texels[v * 256 + u];
+    }
+    uint32_t y { setup.page_y + v };
+
+    switch (setup.texture_depth) {
+        case 0: {
+            uint16_t indices { m_vram.get(setup.page_x + (u >> 2), y) };
+            uint32_t index { (indices >> ((u & 3) * 4)) & 0xfu };
+            return m_vram.get(setup.clut_x + index, setup.clut_y);
+        }
+        case 1: {
+            uint16_t indices { m_vram.get(setup.page_x + (u >> 1), y) };
+            uint32_t index { (indices >> ((u & 1) * 8)) & 0xffu };
+            return m_vram.get(setup.clut_x + index, setup.clut_y);
+        }
+        default: {
+            return m_vram.get(setup.page_x + u, y);
+        }
+    }
+}
+
+#ifdef SOULPSX_RASTERIZER_AVX2
+
+namespace {
+    // 32 bit gather of 16 bit pixels, the top half of each lane is junk
+    __attribute__((target("avx2")))
+    __m256i gather_pixels(const uint16_t* base, __m256i indices) {
+        return _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), indices, 2),
+            _mm256_set1_epi32(0xffff));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i shift_right(__m256i value, uint32_t count) {
+        return _mm256_srl_epi32(value, _mm_cvtsi32_si128(static_cast<int>(count)));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i to_byte_range(__m256i fixed_point, uint32_t fraction_bits) {
+        __m256i value { _mm256_sra_epi32(fixed_point, _mm_cvtsi32_si128(static_cast<int>(fraction_bits))) };
+        return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i blend_lanes(__m256i back, __m256i front, uint32_t mode) {
+        __m256i max_channel { _mm256_set1_epi32(31) };
+        switch (mode) {
+            case 0: return _mm256_srli_epi32(_mm256_add_epi32(back, front), 1);
+            case 1: return _mm256_min_epi32(_mm256_add_epi32(back, front), max_channel);
+            case 2: return _mm256_max_epi32(_mm256_sub_epi32(back, front), _mm256_setzero_si256());
+            default: return _mm256_min_epi32(_mm256_add_epi32(back, _mm256_srli_epi32(front, 2)), max_channel);
+        }
+    }
+}
+
+// Shades 8 pixels of a row per step. Runs shorter than 8 at the end of a
+// row are finished by the scalar reference.
+template <uint32_t variant>
+__attribute__((target("avx2")))
+void Rasterizer::draw_avx2(const Setup& setup) {
+    static constexpr Variant_flags flags { variant };
+    // Flat colors and texture coordinates of untextured triangles do not
+    // change along a row
+    static constexpr uint32_t first_stepped { flags.shaded ? 0u : static_cast<uint32_t>(tex_u) };
+    static constexpr uint32_t end_stepped { flags.textured ? static_cast<uint32_t>(attribute_count) : static_cast<uint32_t>(tex_u) };
+    const __m256i lane { _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7) };
+    const __m256i zero { _mm256_setzero_si256() };
+    const __m256i channel_mask { _mm256_set1_epi32(0x1f) };
+    const __m256i pixel_mask { _mm256_set1_epi32(0x8000) };
+    const uint16_t* vram { m_vram.data() };
+
+    __m256i edge_step[3] {};
+    for (uint32_t i { 0 }; i < 3; i++) {
+        edge_step[i] = _mm256_set1_epi32(setup.edge_dx[i] * 8);
+    }
+    __m256i attribute_step[attribute_count] {};
+    for (uint32_t i { 0 }; i < attribute_count; i++) {
+        attribute_step[i] = _mm256_set1_epi32(static_cast<int>(setup.attribute_dx[i] * 8));
+    }
+
+    for (int32_t y { setup.min_y }; y <= setup.max_y; y++) {
+        int32_t row { y - setup.min_y };
+        uint16_t* pixels { m_vram.row(y) };
+
+        __m256i edge[3] {};
+        for (uint32_t i { 0 }; i < 3; i++) {
+            int32_t start { setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i] };
+            edge[i] = _mm256_add_epi32(_mm256_set1_epi32(start), _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup.edge_dx[i])));
+        }
+        __m256i attributes[attribute_count] {};
+        for (uint32_t i { 0 }; i < attribute_count; i++) {
+            uint32_t start { setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row) };
+            attributes[i] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(start)),
+                _mm256_mullo_epi32(lane, _mm256_set1_epi32(static_cast<int>(setup.attribute_dx[i]))));
+        }
+
+        // The dither pattern for x & 3 == 0, 1, 2 and 3 repeats every 4
+        // pixels, so a window into three copies covers any start
+        std::array<int32_t, 12> dither_row {};
+        if constexpr (flags.dither) {
+            for (uint32_t i { 0 }; i < dither_row.size(); i++) {
+                dither_row[i] = dither_table[y & 3][i & 3];
+            }
+        }
+
+        int32_t x { setup.min_x };
+        for (; x + 7 <= setup.max_x; x += 8) {
+            __m256i outside { _mm256_or_si256(_mm256_or_si256(edge[0], edge[1]), edge[2]) };
+            __m256i covered { _mm256_cmpgt_epi32(zero, outside) };
+            covered = _mm256_xor_si256(covered, _mm256_set1_epi32(-1));
+
+            if (!_mm256_testz_si256(covered, covered)) {
+                __m128i packed_destination { _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x)) };
+                __m256i destination { _mm256_cvtepu16_epi32(packed_destination) };
+                __m256i write { covered };
+                if constexpr (flags.check_mask) {
+                    write = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(destination, pixel_mask), pixel_mask), write);
+                }
+
+                __m256i texel { zero };
+                if constexpr (flags.textured) {
+                    __m256i u { to_byte_range(attributes[tex_u], fraction_bits) };
+                    __m256i v { to_byte_range(attributes[tex_v], fraction_bits) };
+                    u = _mm256_or_si256(_mm256_and_si256(u, _mm256_set1_epi32(static_cast<int>(setup.window_and_u))),
+                        _mm256_set1_epi32(static_cast<int>(setup.window_or_u)));
+                    v = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi32(static_cast<int>(setup.window_and_v))),
+                        _mm256_set1_epi32(static_cast<int>(setup.window_or_v)));
+
+                    __m256i texel_y { _mm256_and_si256(_mm256_add_epi32(v, _mm256_set1_epi32(static_cast<int>(setup.page_y))),
+                        _mm256_set1_epi32(Vram::height - 1)) };
+                    __m256i row_start { _mm256_slli_epi32(texel_y, 10) };
+                    __m256i page_x { _mm256_set1_epi32(static_cast<int>(setup.page_x)) };
+                    __m256i column_mask { _mm256_set1_epi32(Vram::width - 1) };
+
+                    if constexpr (flags.cached_texels) {
+                        texel = gather_pixels(setup.texels, _mm256_add_epi32(_mm256_slli_epi32(v, 8), u));
+                    } else if (setup.texture_depth == 2) {
+                        __m256i column { _mm256_and_si256(_mm256_add_epi32(page_x, u), column_mask) };
+                        texel = gather_pixels(vram, _mm256_add_epi32(row_start, column));
+                    } else {
+                        // 4 or 2 indices per pixel, looked up in the clut
+                        bool four_bit { setup.texture_depth == 0 };
+                        __m256i column { _mm256_and_si256(_mm256_add_epi32(page_x,
+                            four_bit ? _mm256_srli_epi32(u, 2) : _mm256_srli_epi32(u, 1)), column_mask) };
+                        __m256i indices { gather_pixels(vram, _mm256_add_epi32(row_start, column)) };
+                        __m256i shift { four_bit
+                            ? _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(3)), 2)
+                            : _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(1)), 3) };
+                        __m256i index { _mm256_and_si256(_mm256_srlv_epi32(indices, shift), _mm256_set1_epi32(four_bit ? 0xf : 0xff)) };
+                        __m256i clut_column { _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(setup.clut_x)), index), column_mask) };
+                        __m256i clut_row { _mm256_set1_epi32(static_cast<int>(setup.clut_y << 10)) };
+                        texel = gather_pixels(vram, _mm256_add_epi32(clut_row, clut_column));
+                    }
+                    write = _mm256_andnot_si256(_mm256_cmpeq_epi32(texel, zero), write);
+                }
+
+                if (!_mm256_testz_si256(write, write)) {
+                    __m256i result[3] {};
+                    for (uint32_t i { 0 }; i < 3; i++) {
+                        if constexpr (flags.raw_texture) {
+                            result[i] = _mm256_and_si256(shift_right(texel, i * 5), channel_mask);
+                            continue;
+                        }
+                        __m256i value { to_byte_range(attributes[i], fraction_bits) };
+                        if constexpr (flags.textured) {
+                            __m256i texel_channel { _mm256_and_si256(shift_right(texel, i * 5), channel_mask) };
+                            value = _mm256_srli_epi32(_mm256_mullo_epi32(texel_channel, value), 4);
+                        }
+                        if constexpr (flags.dither) {
+                            value = _mm256_add_epi32(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither_row.data() + (x & 3))));
+                        }
+                        // Untextured values without dither are in range already
+                        if constexpr (flags.dither || flags.textured) {
+                            value = _mm256_min_epi32(_mm256_max_epi32(value, zero), _mm256_set1_epi32(255));
+                        }
+                        result[i] = _mm256_srli_epi32(value, 3);
+                    }
+
+                    if constexpr (flags.semi_transparent) {
+                        __m256i blended_lanes { flags.textured
+                            ? _mm256_cmpeq_epi32(_mm256_and_si256(texel, pixel_mask), pixel_mask)
+                            : _mm256_set1_epi32(-1) };
+                        for (uint32_t i { 0 }; i < 3; i++) {
+                            __m256i back { _mm256_and_si256(shift_right(destination, i * 5), channel_mask) };
+                            result[i] = _mm256_blendv_epi8(result[i], blend_lanes(back, result[i], flags.blend_mode), blended_lanes);
+                        }
+                    }
+
+                    __m256i color { _mm256_or_si256(result[0], _mm256_or_si256(_mm256_slli_epi32(result[1], 5), _mm256_slli_epi32(result[2], 10))) };
+                    color = _mm256_or_si256(color, _mm256_and_si256(texel, pixel_mask));
+                    color = _mm256_or_si256(color, _mm256_set1_epi32(setup.mask_bit));
+
+                    __m256i merged { _mm256_blendv_epi8(destination, color, write) };
+                    __m128i packed { _mm_packus_epi32(_mm256_castsi256_si128(merged), _mm256_extracti128_si256(merged, 1)) };
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x), packed);
+                }
+            }
+
+            for (uint32_t i { 0 }; i < 3; i++) {
+                edge[i] = _mm256_add_epi32(edge[i], edge_step[i]);
+            }
+            for (uint32_t i { first_stepped }; i < end_stepped; i++) {
+                attributes[i] = _mm256_add_epi32(attributes[i], attribute_step[i]);
+            }
+        }
+
+        // The last few pixels of the row
+        int32_t offset { x - setup.min_x };
+        std::array<int32_t, 3> tail_edge {};
+        for (uint32_t i { 0 }; i < 3; i++) {
+            tail_edge[i] = setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i] + setup.edge_dx[i] * offset;
+        }
+        std::array<uint32_t, attribute_count> tail_attributes {};
+        for (uint32_t i { 0 }; i < attribute_count; i++) {
+            tail_attributes[i] = setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row)
+                + setup.attribute_dx[i] * static_cast<uint32_t>(offset);
+        }
+        for (; x <= setup.max_x; x++) {
+            if ((tail_edge[0] | tail_edge[1] | tail_edge[2]) >= 0) {
+                shade_pixel<variant>(setup, x, y, tail_attributes);
+            }
+            for (uint32_t i { 0 }; i < 3; i++) {
+                tail_edge[i] += setup.edge_dx[i];
+            }
+            for (uint32_t i { 0 }; i < attribute_count; i++) {
+                tail_attributes[i] += setup.attribute_dx[i];
+            }
+        }
+    }
+}
+
+#else
+
+template <uint32_t variant>
+void Rasterizer::draw_avx2(const Setup& setup) {
+    draw_scalar<variant>(setup);
+}
+
+#endif
+
+const std::array<Rasterizer::Kernel, Rasterizer::variant_count> Rasterizer::scalar_kernels {
+    []<size_t... variants>(std::index_sequence<variants...>) {
+        return std::array<Kernel, variant_count> { &Rasterizer::draw_scalar<canonical_variant(variants)>... };
+    }(std::make_index_sequence<variant_count> {})
+};
+
+const std::array<Rasterizer::Kernel, Rasterizer::variant_count> Rasterizer::avx2_kernels {
+    []<size_t... variants>(std::index_sequence<variants...>) {
+        return std::array<Kernel, variant_count> { &Rasterizer::draw_avx2<canonical_variant(variants)>... };
+    }(std::make_index_sequence<variant_count> {})
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "Vram.h"
+
+// Draws the GPU's triangles into Vram with edge functions. Every attribute
+// is stepped in 20.12 fixed point from the same setup, so the AVX2 kernel,
+// which shades 8 pixels per step, and the scalar reference produce exactly
+// the same pixels. The AVX2 kernel fetches all 8 texels before writing any
+// of them, so triangles that may sample texels or CLUT entries inside their
+// own bounds are drawn by the scalar kernel instead. Both kernels are
+// compiled once per combination of the flags that would otherwise be tested
+// per pixel, and a table picks one per triangle.
+class Rasterizer {
+public:
+    enum class Backend {
+        scalar,
+        avx2,
+    };
+
+    // State set by the GP0 E1-E6 commands that affects drawing
+    struct Draw_settings {
+        // Drawing area, inclusive on all sides
+        int32_t area_left {};
+        int32_t area_top {};
+        int32_t area_right {};
+        int32_t area_bottom {};
+        bool dither {};
+        // Drawn pixels get bit 15 set
+        bool set_mask {};
+        // Pixels with bit 15 set are left alone
+        bool check_mask {};
+        // Texture window, in 8 pixel steps
+        uint8_t window_mask_x {};
+        uint8_t window_mask_y {};
+        uint8_t window_offset_x {};
+        uint8_t window_offset_y {};
+    };
+
+    struct Vertex {
+        // Drawing offset already applied
+        int32_t x {};
+        int32_t y {};
+        // 24 bit BGR
+        uint32_t color {};
+        uint8_t u {};
+        uint8_t v {};
+    };
+
+    struct Triangle {
+        std::array<Vertex, 3> vertices {};
+        // Gouraud shaded, otherwise every vertex has the first vertex's color
+        bool shaded {};
+        bool textured {};
+        // Textured without modulating by the color
+        bool raw_texture {};
+        bool semi_transparent {};
+        // In the layout of GP0 E1: page, blending mode and color depth
+        uint16_t texpage {};
+        uint16_t clut {};
+        // The 4 or 8 bit page already looked up through the CLUT, see
+        // Texture_cache. Null to read the page and CLUT from VRAM.
+        const uint16_t* texels {};
+    };
+
+    explicit Rasterizer(Vram& vram);
+
+    // The fastest backend this host supports
+    static Backend best_backend();
+    // Falls back to scalar if the host lacks the instructions
+    void set_backend(Backend backend);
+    Backend get_backend() const { return m_backend; }
+
+    void draw_triangle(const Draw_settings& settings, const Triangle& triangle);
+    // In order, as if drawn one at a time
+    void draw_triangles(const Draw_settings& settings, std::span<const Triangle> triangles);
+
+    static constexpr uint32_t fraction_bits { 12 };
+
+    // Flags picking a kernel. The low ones are bits 0, 1, 2 and 4 of a GP0
+    // polygon opcode, the rest come from E1, E6 and the texture cache.
+    static constexpr uint32_t variant_raw_texture { 1 << 0 };
+    static constexpr uint32_t variant_semi_transparent { 1 << 1 };
+    static constexpr uint32_t variant_textured { 1 << 2 };
+    static constexpr uint32_t variant_shaded { 1 << 3 };
+    // 2 bits of blending mode
+    static constexpr uint32_t variant_blend_shift { 4 };
+    static constexpr uint32_t variant_dither { 1 << 6 };
+    static constexpr uint32_t variant_check_mask { 1 << 7 };
+    // Texels come decoded from Texture_cache
+    static constexpr uint32_t variant_cached_texels { 1 << 8 };
+    static constexpr uint32_t variant_count { 1 << 9 };
+
+    enum Attribute {
+        red,
+        green,
+        blue,
+        tex_u,
+        tex_v,
+        attribute_count,
+    };
+
+    // Everything the kernels need, worked out once per triangle. Edge
+    // functions and attributes are given at (min_x, min_y).
+    struct Setup {
+        int32_t min_x {};
+        int32_t min_y {};
+        int32_t max_x {};
+        int32_t max_y {};
+
+        std::array<int32_t, 3> edge {};
+        std::array<int32_t, 3> edge_dx {};
+        std::array<int32_t, 3> edge_dy {};
+        // 1 for edges that do not own the pixels lying exactly on them
+        std::array<int32_t, 3> edge_bias {};
+
+        // Fixed point, wrapping like the vector lanes do
+        std::array<uint32_t, attribute_count> attribute {};
+        std::array<uint32_t, attribute_count> attribute_dx {};
+        std::array<uint32_t, attribute_count> attribute_dy {};
+
+        // Variant flags, which the kernels read instead of per pixel
+        uint32_t variant {};
+        bool textured {};
+        uint16_t mask_bit {};
+        uint32_t texture_depth {};
+        uint32_t page_x {};
+        uint32_t page_y {};
+        uint32_t clut_x {};
+        uint32_t clut_y {};
+        // 256x256 decoded texels, or null
+        const uint16_t* texels {};
+        // The texture window as masks applied to u and v
+        uint32_t window_and_u {};
+        uint32_t window_or_u {};
+        uint32_t window_and_v {};
+        uint32_t window_or_v {};
+        // The page or CLUT read from VRAM overlaps the bounds, so pixels
+        // have to be drawn one at a time
+        bool samples_own_pixels {};
+    };
+
+    // Returns false if nothing would be drawn
+    static bool setup_triangle(const Draw_settings& settings, const Triangle& triangle, Setup& setup);
+    // Narrows a setup to an inclusive rectangle. Pixels inside it come out
+    // exactly as they would from the whole setup. Returns false if none are
+    // left.
+    static bool clip(Setup& setup, int32_t left, int32_t top, int32_t right, int32_t bottom);
+    // Safe to call from several threads at once for setups that do not
+    // overlap and do not sample each other's pixels
+    void draw(const Setup& setup);
+private:
+    using Kernel = void (Rasterizer::*)(const Setup& setup);
+
+    Vram& m_vram;
+    Backend m_backend { Backend::scalar };
+    // The kernels for the backend, indexed by variant
+    const std::array<Kernel, variant_count>* m_kernels {};
+
+    static const std::array<Kernel, variant_count> scalar_kernels;
+    static const std::array<Kernel, variant_count> avx2_kernels;
+
+    static bool samples_own_pixels(const Setup& setup);
+
+    template <uint32_t variant>
+    void draw_scalar(const Setup& setup);
+    template <uint32_t variant>
+    void draw_avx2(const Setup& setup);
+    // The reference for a single pixel, given its attributes
+    template <uint32_t variant>
+    void shade_pixel(const Setup& setup, int32_t x, int32_t y, const std::array<uint32_t, attribute_count>& attributes);
+    template <uint32_t variant>
+    uint16_t fetch_texel(const Setup& setup, uint32_t u, uint32_t v) const;
+};
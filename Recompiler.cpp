@@ -0,0 +1,643 @@
+#include "Recompiler.h"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#include "Logger.h"
+
+// Native functions keep the guest registers in rbx and the State in rbp, both
+// preserved across the calls into the memory functions. Registers and State
+// fields are addressed with 8 bit displacements from those.
+namespace {
+	constexpr uint8_t modrm_rbx_disp8 { 0x43 };
+	constexpr uint8_t modrm_rbp_disp8 { 0x45 };
+
+	uint8_t register_offset(Register reg) {
+		return static_cast<uint8_t>(static_cast<uint32_t>(reg) * sizeof(uint32_t));
+	}
+
+	// Puts an x86 register into the reg field of a ModRM byte
+	uint8_t with_register(uint8_t modrm, uint8_t host) {
+		return static_cast<uint8_t>(modrm | (host << 3));
+	}
+
+	// Condition codes for jcc
+	constexpr uint8_t condition_below { 0x2 };
+	constexpr uint8_t condition_equal { 0x4 };
+	constexpr uint8_t condition_not_equal { 0x5 };
+}
+
+Recompiler::~Recompiler() {
+#if defined(__x86_64__) && !defined(_WIN32)
+	if (m_code) {
+		munmap(m_code, m_code_size);
+	}
+#endif
+}
+
+bool Recompiler::is_supported(const Instruction& instruction) {
+	using enum Instruction::Opcode;
+	switch (instruction.opcode()) {
+		case addiu:
+		case addu:
+		case subu:
+		case and_b:
+		case or_b:
+		case Xor:
+		case andi:
+		case ori:
+		case lui:
+		case sll:
+		case srl:
+		case sra:
+		case sllv:
+		case srlv:
+		case srav:
+		case slt:
+		case sltu:
+		case slti:
+		case sltiu:
+		case lw:
+		case lh:
+		case lhu:
+		case lb:
+		case lbu:
+		case sw:
+		case sh:
+		case sb:
+		case jump:
+		case jal:
+		case jr:
+		case jalr:
+		case beq:
+		case bne:
+		case bgtz:
+		case blez:
+		case bltz:
+		case bgez:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Instructions run in order. Load delay slots are resolved while compiling:
+// the value of a load is kept in the State and lands after the next
+// instruction, unless that one writes the register itself. Only the load in
+// flight when the run is entered is not known until then.
+Recompiler::Function Recompiler::compile(std::span<const Instruction> instructions) {
+#if defined(__x86_64__) && !defined(_WIN32)
+	if (!m_code) {
+		void* code { mmap(nullptr, m_code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) };
+		if (code == MAP_FAILED) {
+			LOG_ERROR("[JIT] Failed to allocate the code buffer");
+			return nullptr;
+		}
+		m_code = static_cast<std::byte*>(code);
+	}
+
+	m_emit_buffer.clear();
+	m_exits.clear();
+
+	// push rbx, push rbp, sub rsp, 8 to keep calls 16 byte aligned
+	emit({ 0x53, 0x55, 0x48, 0x83, 0xec, 0x08 });
+	// mov rbx, rdi; mov rbp, rsi
+	emit({ 0x48, 0x89, 0xfb, 0x48, 0x89, 0xf5 });
+
+	Pending_load pending { .kind = Pending_load::Kind::unknown };
+	for (uint32_t index { 0 }; index < instructions.size(); index++) {
+		const Instruction& instruction { instructions[index] };
+		if (is_store(instruction)) {
+			emit_store(instruction, index, pending);
+			pending = {};
+			continue;
+		}
+
+		if (is_load(instruction)) {
+			emit_load(instruction, index);
+		} else if (instruction.is_branch()) {
+			emit_branch(instruction, index);
+		} else {
+			emit_alu(instruction);
+		}
+		emit_land(pending, written_register(instruction));
+
+		// A load leaves its value in eax
+		Register loaded { is_load(instruction) ? instruction.rt() : Register::zero };
+		if (loaded != Register::zero) {
+			store_state(Host::eax, offsetof(State, load_value));
+			store_state(offsetof(State, load_register), static_cast<uint32_t>(loaded));
+			pending = { .kind = Pending_load::Kind::known, .reg = loaded };
+		} else {
+			if (pending.kind != Pending_load::Kind::none) {
+				store_state(offsetof(State, load_register), 0);
+			}
+			pending = {};
+		}
+	}
+
+	// mov eax, count
+	emit({ 0xb8 });
+	emit_32(static_cast<uint32_t>(instructions.size()));
+	size_t epilogue { m_emit_buffer.size() };
+	// add rsp, 8; pop rbp; pop rbx; ret
+	emit({ 0x48, 0x83, 0xc4, 0x08, 0x5d, 0x5b, 0xc3 });
+
+	// Early exits load their count and join the epilogue
+	for (const Exit& exit : m_exits) {
+		uint32_t target { static_cast<uint32_t>(m_emit_buffer.size() - (exit.position + 4)) };
+		std::memcpy(m_emit_buffer.data() + exit.position, &target, sizeof(target));
+		// mov eax, count; jmp epilogue
+		emit({ 0xb8 });
+		emit_32(exit.count);
+		emit({ 0xe9 });
+		emit_32(static_cast<uint32_t>(epilogue - (m_emit_buffer.size() + 4)));
+	}
+
+	if (m_emit_buffer.size() > free_space()) {
+		return nullptr;
+	}
+
+	// Keep the buffer W^X: writable only while we copy the new code in
+	mprotect(m_code, m_code_size, PROT_READ | PROT_WRITE);
+	std::byte* function { m_code + m_code_used };
+	std::memcpy(function, m_emit_buffer.data(), m_emit_buffer.size());
+	m_code_used += m_emit_buffer.size();
+	mprotect(m_code, m_code_size, PROT_READ | PROT_EXEC);
+
+	return reinterpret_cast<Function>(function);
+#else
+	return nullptr;
+#endif
+}
+
+void Recompiler::emit(std::initializer_list<uint8_t> bytes) {
+	m_emit_buffer.insert(m_emit_buffer.end(), bytes);
+}
+
+void Recompiler::emit_32(uint32_t value) {
+	emit({
+		static_cast<uint8_t>(value),
+		static_cast<uint8_t>(value >> 8),
+		static_cast<uint8_t>(value >> 16),
+		static_cast<uint8_t>(value >> 24)
+	});
+}
+
+// jcc rel32 to an exit stub, filled in once the body is done
+void Recompiler::emit_exit_jump(uint8_t condition, uint32_t count) {
+	emit({ 0x0f, static_cast<uint8_t>(0x80 | condition) });
+	m_exits.push_back({ m_emit_buffer.size(), count });
+	emit_32(0);
+}
+
+void Recompiler::load(Host host, Register reg) {
+	if (reg == Register::zero) {
+		// xor host, host
+		emit({ 0x31, with_register(static_cast<uint8_t>(0xc0 | static_cast<uint8_t>(host)), static_cast<uint8_t>(host)) });
+		return;
+	}
+	// mov host, [rbx + offset]
+	emit({ 0x8b, with_register(modrm_rbx_disp8, static_cast<uint8_t>(host)), register_offset(reg) });
+}
+
+void Recompiler::store(Host host, Register reg) {
+	// Writes to r0 are discarded
+	if (reg == Register::zero) {
+		return;
+	}
+	// mov [rbx + offset], host
+	emit({ 0x89, with_register(modrm_rbx_disp8, static_cast<uint8_t>(host)), register_offset(reg) });
+}
+
+void Recompiler::load_state(Host host, std::size_t offset) {
+	// mov host, [rbp + offset]
+	emit({ 0x8b, with_register(modrm_rbp_disp8, static_cast<uint8_t>(host)), static_cast<uint8_t>(offset) });
+}
+
+void Recompiler::store_state(Host host, std::size_t offset) {
+	// mov [rbp + offset], host
+	emit({ 0x89, with_register(modrm_rbp_disp8, static_cast<uint8_t>(host)), static_cast<uint8_t>(offset) });
+}
+
+void Recompiler::store_state(std::size_t offset, uint32_t value) {
+	// mov dword [rbp + offset], imm32
+	emit({ 0xc7, modrm_rbp_disp8, static_cast<uint8_t>(offset) });
+	emit_32(value);
+}
+
+// Calls a memory function with the context as its first argument. The
+// address and value must already be in esi and edx.
+void Recompiler::call(const void* function) {
+	// mov rdi, [rbp + context]
+	emit({ 0x48, 0x8b, 0x7d, static_cast<uint8_t>(offsetof(State, context)) });
+	// mov rax, imm64; call rax
+	emit({ 0x48, 0xb8 });
+	uint64_t address { reinterpret_cast<uint64_t>(function) };
+	emit_32(static_cast<uint32_t>(address));
+	emit_32(static_cast<uint32_t>(address >> 32));
+	emit({ 0xff, 0xd0 });
+}
+
+// Lands the load in flight unless the instruction just compiled wrote the
+// register itself, which cancels it
+void Recompiler::emit_land(const Pending_load& pending, Register written) {
+	switch (pending.kind) {
+		case Pending_load::Kind::none:
+			return;
+		case Pending_load::Kind::known: {
+			if (pending.reg == written) {
+				return;
+			}
+			load_state(Host::ecx, offsetof(State, load_value));
+			store(Host::ecx, pending.reg);
+			return;
+		}
+		case Pending_load::Kind::unknown: {
+			load_state(Host::edx, offsetof(State, load_register));
+			size_t skip {};
+			if (written != Register::zero) {
+				// cmp edx, written; je skip
+				emit({ 0x83, 0xfa, static_cast<uint8_t>(written), 0x74, 0x00 });
+				skip = m_emit_buffer.size();
+			}
+			load_state(Host::ecx, offsetof(State, load_value));
+			// mov [rbx + rdx * 4], ecx; mov dword [rbx], 0
+			emit({ 0x89, 0x0c, 0x93, 0xc7, 0x03 });
+			emit_32(0);
+			if (skip) {
+				m_emit_buffer[skip - 1] = static_cast<uint8_t>(m_emit_buffer.size() - skip);
+			}
+			return;
+		}
+	}
+}
+
+// Leaves the zero or sign extended value in eax
+void Recompiler::emit_load(const Instruction& instruction, uint32_t index) {
+	using enum Instruction::Opcode;
+	load(Host::esi, instruction.base());
+	// add esi, imm32
+	emit({ 0x81, 0xc6 });
+	emit_32(instruction.imm16_se());
+
+	switch (instruction.opcode()) {
+		case lb:
+		case lbu: call(reinterpret_cast<const void*>(m_memory.read_8)); break;
+		case lh:
+		case lhu: call(reinterpret_cast<const void*>(m_memory.read_16)); break;
+		default: call(reinterpret_cast<const void*>(m_memory.read_32)); break;
+	}
+
+	// bt rax, 32; jc to the interpreter
+	emit({ 0x48, 0x0f, 0xba, 0xe0, 0x20 });
+	emit_exit_jump(condition_below, index);
+
+	if (instruction.opcode() == lb) {
+		// movsx eax, al
+		emit({ 0x0f, 0xbe, 0xc0 });
+	} else if (instruction.opcode() == lh) {
+		// movsx eax, ax
+		emit({ 0x0f, 0xbf, 0xc0 });
+	}
+}
+
+// Stores land the load in flight themselves, since a store that has to
+// stop the run still counts as run
+void Recompiler::emit_store(const Instruction& instruction, uint32_t index, const Pending_load& pending) {
+	using enum Instruction::Opcode;
+	load(Host::esi, instruction.base());
+	// add esi, imm32
+	emit({ 0x81, 0xc6 });
+	emit_32(instruction.imm16_se());
+	load(Host::edx, instruction.rt());
+
+	switch (instruction.opcode()) {
+		case sb: call(reinterpret_cast<const void*>(m_memory.write_8)); break;
+		case sh: call(reinterpret_cast<const void*>(m_memory.write_16)); break;
+		default: call(reinterpret_cast<const void*>(m_memory.write_32)); break;
+	}
+
+	// cmp eax, write_refused; je to the interpreter
+	emit({ 0x83, 0xf8, static_cast<uint8_t>(write_refused) });
+	emit_exit_jump(condition_equal, index);
+
+	// Only touches ecx and edx, so eax still holds the result
+	emit_land(pending, Register::zero);
+	if (pending.kind != Pending_load::Kind::none) {
+		store_state(offsetof(State, load_register), 0);
+	}
+
+	// test eax, eax; jnz out, with the store counted
+	emit({ 0x85, 0xc0 });
+	emit_exit_jump(condition_not_equal, index + 1);
+}
+
+// Works out where the branch goes from the pc of the run, since the same
+// code runs from every mirror of Ram
+void Recompiler::emit_branch(const Instruction& instruction, uint32_t index) {
+	using enum Instruction::Opcode;
+	uint32_t branch_offset { index * Instruction::instruction_length };
+	uint32_t delay_slot_end { branch_offset + 2 * Instruction::instruction_length };
+
+	auto write_return_address = [&](Register reg) {
+		load_state(Host::eax, offsetof(State, pc));
+		// add eax, imm32
+		emit({ 0x05 });
+		emit_32(delay_slot_end);
+		store(Host::eax, reg);
+	};
+
+	switch (instruction.opcode()) {
+		case jump:
+		case jal: {
+			load_state(Host::edx, offsetof(State, pc));
+			// add edx, imm32; and edx, 0xf0000000; or edx, imm32
+			emit({ 0x81, 0xc2 });
+			emit_32(branch_offset + Instruction::instruction_length);
+			emit({ 0x81, 0xe2 });
+			emit_32(0xf0000000);
+			emit({ 0x81, 0xca });
+			emit_32(instruction.jump_addr() << 2);
+			store_state(Host::edx, offsetof(State, next_pc));
+			store_state(offsetof(State, was_branch), 0);
+			if (instruction.opcode() == jal) {
+				write_return_address(Register::ra);
+			}
+			return;
+		}
+		case jr:
+		case jalr: {
+			// Read rs first, rd may be the same register
+			load(Host::edx, instruction.rs());
+			store_state(Host::edx, offsetof(State, next_pc));
+			store_state(offsetof(State, was_branch), 0);
+			if (instruction.opcode() == jalr) {
+				write_return_address(instruction.rd());
+			}
+			return;
+		}
+		default:
+			break;
+	}
+
+	// Not taken until the condition says otherwise
+	load_state(Host::edx, offsetof(State, pc));
+	// add edx, imm32
+	emit({ 0x81, 0xc2 });
+	emit_32(delay_slot_end);
+	store_state(Host::edx, offsetof(State, next_pc));
+	store_state(offsetof(State, was_branch), 0);
+
+	// Compare, then skip the taken path on the opposite condition
+	uint8_t skip_opcode {};
+	switch (instruction.opcode()) {
+		case beq:
+		case bne: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// cmp eax, ecx
+			emit({ 0x39, 0xc8 });
+			// jne / je
+			skip_opcode = instruction.opcode() == beq ? 0x75 : 0x74;
+			break;
+		}
+		default: {
+			// cmp dword [rbx + offset], 0
+			emit({ 0x83, 0x7b, register_offset(instruction.rs()), 0x00 });
+			switch (instruction.opcode()) {
+				// jle / jg / jge / jl
+				case bgtz: skip_opcode = 0x7e; break;
+				case blez: skip_opcode = 0x7f; break;
+				case bltz: skip_opcode = 0x7d; break;
+				default: skip_opcode = 0x7c; break;
+			}
+			break;
+		}
+	}
+	emit({ skip_opcode, 0x00 });
+	size_t skip { m_emit_buffer.size() };
+
+	// The target is relative to the delay slot
+	uint32_t target_offset { (instruction.imm16_se() << 2) - Instruction::instruction_length };
+	emit({ 0x81, 0xc2 });
+	emit_32(target_offset);
+	store_state(Host::edx, offsetof(State, next_pc));
+	store_state(offsetof(State, was_branch), 1);
+	m_emit_buffer[skip - 1] = static_cast<uint8_t>(m_emit_buffer.size() - skip);
+}
+
+Register Recompiler::written_register(const Instruction& instruction) {
+	using enum Instruction::Opcode;
+	switch (instruction.opcode()) {
+		case addiu:
+		case andi:
+		case ori:
+		case lui:
+		case slti:
+		case sltiu:
+			return instruction.rt();
+		case addu:
+		case subu:
+		case and_b:
+		case or_b:
+		case Xor:
+		case sll:
+		case srl:
+		case sra:
+		case sllv:
+		case srlv:
+		case srav:
+		case slt:
+		case sltu:
+		case jalr:
+			return instruction.rd();
+		case jal:
+			return Register::ra;
+		default:
+			return Register::zero;
+	}
+}
+
+bool Recompiler::is_load(const Instruction& instruction) {
+	using enum Instruction::Opcode;
+	switch (instruction.opcode()) {
+		case lw:
+		case lh:
+		case lhu:
+		case lb:
+		case lbu:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Recompiler::is_store(const Instruction& instruction) {
+	using enum Instruction::Opcode;
+	switch (instruction.opcode()) {
+		case sw:
+		case sh:
+		case sb:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void Recompiler::emit_alu(const Instruction& instruction) {
+	using enum Instruction::Opcode;
+	switch (instruction.opcode()) {
+		case addu: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// add eax, ecx
+			emit({ 0x01, 0xc8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case subu: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// sub eax, ecx
+			emit({ 0x29, 0xc8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case and_b: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// and eax, ecx
+			emit({ 0x21, 0xc8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case or_b: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// or eax, ecx
+			emit({ 0x09, 0xc8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case Xor: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// xor eax, ecx
+			emit({ 0x31, 0xc8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case addiu: {
+			load(Host::eax, instruction.rs());
+			// add eax, imm32
+			emit({ 0x05 });
+			emit_32(instruction.imm16_se());
+			store(Host::eax, instruction.rt());
+			break;
+		}
+		case andi: {
+			load(Host::eax, instruction.rs());
+			// and eax, imm32
+			emit({ 0x25 });
+			emit_32(instruction.imm16());
+			store(Host::eax, instruction.rt());
+			break;
+		}
+		case ori: {
+			load(Host::eax, instruction.rs());
+			// or eax, imm32
+			emit({ 0x0d });
+			emit_32(instruction.imm16());
+			store(Host::eax, instruction.rt());
+			break;
+		}
+		case lui: {
+			// mov eax, imm32
+			emit({ 0xb8 });
+			emit_32(instruction.imm16() << 16);
+			store(Host::eax, instruction.rt());
+			break;
+		}
+		case sll: {
+			load(Host::eax, instruction.rt());
+			// shl eax, imm8
+			emit({ 0xc1, 0xe0, static_cast<uint8_t>(instruction.sa()) });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case srl: {
+			load(Host::eax, instruction.rt());
+			// shr eax, imm8
+			emit({ 0xc1, 0xe8, static_cast<uint8_t>(instruction.sa()) });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case sra: {
+			load(Host::eax, instruction.rt());
+			// sar eax, imm8
+			emit({ 0xc1, 0xf8, static_cast<uint8_t>(instruction.sa()) });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		// x86 masks variable shift amounts to 5 bits, same as the R3000
+		case sllv: {
+			load(Host::eax, instruction.rt());
+			load(Host::ecx, instruction.rs());
+			// shl eax, cl
+			emit({ 0xd3, 0xe0 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case srlv: {
+			load(Host::eax, instruction.rt());
+			load(Host::ecx, instruction.rs());
+			// shr eax, cl
+			emit({ 0xd3, 0xe8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case srav: {
+			load(Host::eax, instruction.rt());
+			load(Host::ecx, instruction.rs());
+			// sar eax, cl
+			emit({ 0xd3, 0xf8 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case slt:
+		case sltu: {
+			load(Host::eax, instruction.rs());
+			load(Host::ecx, instruction.rt());
+			// cmp eax, ecx
+			emit({ 0x39, 0xc8 });
+			// setl al / setb al
+			emit({ 0x0f, static_cast<uint8_t>(instruction.opcode() == slt ? 0x9c : 0x92), 0xc0 });
+			// movzx eax, al
+			emit({ 0x0f, 0xb6, 0xc0 });
+			store(Host::eax, instruction.rd());
+			break;
+		}
+		case slti:
+		case sltiu: {
+			load(Host::eax, instruction.rs());
+			// cmp eax, imm32
+			emit({ 0x3d });
+			emit_32(instruction.imm16_se());
+			// setl al / setb al
+			emit({ 0x0f, static_cast<uint8_t>(instruction.opcode() == slti ? 0x9c : 0x92), 0xc0 });
+			// movzx eax, al
+			emit({ 0x0f, 0xb6, 0xc0 });
+			store(Host::eax, instruction.rt());
+			break;
+		}
+		default: {
+			LOG_ERROR("[JIT] Unsupported instruction: {}", instruction.opcode_as_string());
+			std::exit(1);
+		}
+	}
+}
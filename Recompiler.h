@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Instruction.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Translates runs of instructions into native x86-64 code. ALU instructions,
+// loads, stores and a branch with its delay slot at the end of the run are
+// supported. Memory accesses call back into the Cpu, which may refuse them
+// and leave the instruction to the interpreter. Anything else that can raise
+// an exception is left to the interpreter too.
+class Recompiler {
+public:
+	// What native code and the Cpu hand each other besides the registers
+	struct State {
+		// Address of the first instruction of the run
+		uint32_t pc {};
+		// The load that lands after the next instruction. An empty slot names
+		// r0. Kept up to date whenever native code can return.
+		uint32_t load_register {};
+		uint32_t load_value {};
+		// Written by the branch at the end of a run: where it goes, and
+		// whether it was a taken conditional branch
+		uint32_t next_pc {};
+		uint32_t was_branch {};
+		// Passed to the memory functions
+		void* context {};
+	};
+
+	// Native code for a run of instructions. Takes the guest register file and
+	// returns how many instructions ran, which is fewer than the run when a
+	// memory access was refused or asked to stop.
+	using Function = uint32_t (*)(uint32_t* registers, State* state);
+
+	// A read returns the zero extended value, or refused_read if the
+	// interpreter has to run the instruction.
+	using Read_function = uint64_t (*)(void* context, uint32_t address);
+	// A write returns one of the Write_result values
+	using Write_function = uint32_t (*)(void* context, uint32_t address, uint32_t value);
+
+	static constexpr uint64_t refused_read { uint64_t { 1 } << 32 };
+	enum Write_result : uint32_t {
+		write_done,
+		// Nothing was written, the interpreter runs the store
+		write_refused,
+		// Written, but the run has to stop after the store
+		write_stop,
+	};
+
+	struct Memory_functions {
+		Read_function read_8 {};
+		Read_function read_16 {};
+		Read_function read_32 {};
+		Write_function write_8 {};
+		Write_function write_16 {};
+		Write_function write_32 {};
+	};
+
+	explicit Recompiler(const Memory_functions& memory): m_memory { memory } {}
+	~Recompiler();
+
+	Recompiler(const Recompiler&) = delete;
+	Recompiler& operator=(const Recompiler&) = delete;
+
+	// Whether native code can run on this host at all
+	static constexpr bool available() {
+#if defined(__x86_64__) && !defined(_WIN32)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Branches are only supported second to last in a run, followed by their
+	// delay slot, which must not be a branch itself
+	static bool is_supported(const Instruction& instruction);
+
+	// Compiles the instructions into a single native function.
+	// Returns nullptr if the host is unsupported or the code buffer is full.
+	Function compile(std::span<const Instruction> instructions);
+
+	// Frees all compiled code. Any Function handed out before is invalid.
+	void reset() { m_code_used = 0; }
+	std::size_t free_space() const { return m_code_size - m_code_used; }
+
+	// Upper bound on the code emitted for one instruction
+	static constexpr std::size_t max_instruction_size { 128 };
+private:
+	// x86 registers by their encoding
+	enum class Host : uint8_t {
+		eax = 0,
+		ecx = 1,
+		edx = 2,
+		esi = 6,
+	};
+
+	// What is known at translation time about the load landing after the
+	// instruction being compiled
+	struct Pending_load {
+		enum class Kind {
+			none,
+			// Loaded by the previous instruction in the run
+			known,
+			// Whatever was in flight when the run was entered
+			unknown,
+		};
+		Kind kind { Kind::none };
+		Register reg { Register::zero };
+	};
+
+	// A jump to the exit that reports count instructions as run
+	struct Exit {
+		std::size_t position {};
+		uint32_t count {};
+	};
+
+	static constexpr std::size_t m_code_size { 16 * 1024 * 1024 };
+	std::byte* m_code {};
+	std::size_t m_code_used {};
+
+	Memory_functions m_memory {};
+
+	std::vector<uint8_t> m_emit_buffer {};
+	std::vector<Exit> m_exits {};
+
+	void emit(std::initializer_list<uint8_t> bytes);
+	void emit_32(uint32_t value);
+	void emit_exit_jump(uint8_t condition, uint32_t count);
+
+	void load(Host host, Register reg);
+	void store(Host host, Register reg);
+	void load_state(Host host, std::size_t offset);
+	void store_state(Host host, std::size_t offset);
+	void store_state(std::size_t offset, uint32_t value);
+	void call(const void* function);
+
+	void emit_alu(const Instruction& instruction);
+	void emit_load(const Instruction& instruction, uint32_t index);
+	void emit_store(const Instruction& instruction, uint32_t index, const Pending_load& pending);
+	void emit_branch(const Instruction& instruction, uint32_t index);
+	void emit_land(const Pending_load& pending, Register written);
+	static Register written_register(const Instruction& instruction);
+	static bool is_load(const Instruction& instruction);
+	static bool is_store(const Instruction& instruction);
+};
@@ -0,0 +1,90 @@
+#include "Scheduler.h"
+
+void Scheduler::schedule_at(Event event, uint64_t timestamp) {
+    size_t position { m_positions[index(event)] };
+    if (position == not_scheduled) {
+        position = m_size++;
+        place(position, { timestamp, event });
+        sift_up(position);
+        return;
+    }
+
+    uint64_t old_deadline { m_heap[position].deadline };
+    m_heap[position].deadline = timestamp;
+    if (timestamp < old_deadline) {
+        sift_up(position);
+    } else {
+        sift_down(position);
+    }
+}
+
+void Scheduler::cancel(Event event) {
+    size_t position { m_positions[index(event)] };
+    if (position != not_scheduled) {
+        remove_at(position);
+    }
+}
+
+void Scheduler::run_due_events() {
+    while (m_size != 0 && m_heap[0].deadline <= m_now) {
+        Entry due { m_heap[0] };
+        remove_at(0);
+        // The handler is free to schedule this or any other event again
+        if (const Handler& handler { m_handlers[index(due.event)] }) {
+            handler(m_now - due.deadline);
+        }
+    }
+}
+
+void Scheduler::place(size_t position, const Entry& entry) {
+    m_heap[position] = entry;
+    m_positions[index(entry.event)] = position;
+}
+
+void Scheduler::sift_up(size_t position) {
+    Entry entry { m_heap[position] };
+    while (position > 0) {
+        size_t parent { (position - 1) / 2 };
+        if (!earlier(entry, m_heap[parent])) {
+            break;
+        }
+        place(position, m_heap[parent]);
+        position = parent;
+    }
+    place(position, entry);
+}
+
+void Scheduler::sift_down(size_t position) {
+    Entry entry { m_heap[position] };
+    while (true) {
+        size_t child { position * 2 + 1 };
+        if (child >= m_size) {
+            break;
+        }
+        if (child + 1 < m_size && earlier(m_heap[child + 1], m_heap[child])) {
+            child++;
+        }
+        if (!earlier(m_heap[child], entry)) {
+            break;
+        }
+        place(position, m_heap[child]);
+        position = child;
+    }
+    place(position, entry);
+}
+
+void Scheduler::remove_at(size_t position) {
+    m_positions[index(m_heap[position].event)] = not_scheduled;
+    m_size--;
+    if (position == m_size) {
+        return;
+    }
+
+    // Fill the hole with the last entry and let it find its place
+    place(position, m_heap[m_size]);
+    if (position > 0 && earlier(m_heap[position], m_heap[(position - 1) / 2])) {
+        sift_up(position);
+    } else {
+        sift_down(position);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+
+// Keeps time for the whole system in CPU cycles. Devices register a handler
+// per event and schedule it some number of cycles ahead. The CPU runs until
+// the earliest deadline, so no device needs polling per instruction.
+//
+// Every event type is pending at most once. The pending events are kept in
+// a min-heap indexed by event type, so scheduling, rescheduling and
+// cancelling are all O(log n).
+class Scheduler {
+public:
+    enum class Event : uint8_t {
+        vblank,
+        hblank,
+        timer_0,
+        timer_1,
+        timer_2,
+        dma,
+        cdrom_sector,
+        count,
+    };
+
+    // Called with how many cycles after its deadline the event was handled,
+    // so periodic events can reschedule without drifting.
+    using Handler = std::function<void(uint64_t cycles_late)>;
+
+    void set_handler(Event event, Handler handler) { m_handlers[index(event)] = std::move(handler); }
+
+    uint64_t now() const { return m_now; }
+
+    // Schedules the event the given number of cycles from now, replacing any
+    // deadline it already had.
+    void schedule(Event event, uint64_t cycles) { schedule_at(event, m_now + cycles); }
+    void schedule_at(Event event, uint64_t timestamp);
+    void cancel(Event event);
+
+    bool is_scheduled(Event event) const { return m_positions[index(event)] != not_scheduled; }
+    // Timestamp of the earliest pending event, or the end of time
+    uint64_t next_deadline() const {
+        return m_size == 0 ? std::numeric_limits<uint64_t>::max() : m_heap[0].deadline;
+    }
+
+    // Moves time forward without running anything. The CPU calls this as it
+    // goes so devices always see the current cycle.
+    void add_cycles(uint64_t cycles) { m_now += cycles; }
+    // Runs the handlers of every event now due, in deadline order
+    void run_due_events();
+    void advance(uint64_t cycles) {
+        add_cycles(cycles);
+        run_due_events();
+    }
+private:
+    static constexpr size_t event_count { static_cast<size_t>(Event::count) };
+    static constexpr size_t not_scheduled { event_count };
+
+    struct Entry {
+        uint64_t deadline {};
+        Event event {};
+    };
+
+    uint64_t m_now {};
+
+    std::array<Entry, event_count> m_heap {};
+    size_t m_size {};
+    // Where each event sits in the heap, or not_scheduled
+    std::array<size_t, event_count> m_positions { make_positions() };
+    std::array<Handler, event_count> m_handlers {};
+
+    static constexpr size_t index(Event event) { return static_cast<size_t>(event); }
+    static constexpr std::array<size_t, event_count> make_positions() {
+        std::array<size_t, event_count> positions {};
+        positions.fill(not_scheduled);
+        return positions;
+    }
+
+    // Ties go to the lower event type so the order is always the same
+    static bool earlier(const Entry& a, const Entry& b) {
+        return a.deadline < b.deadline || (a.deadline == b.deadline && a.event < b.event);
+    }
+
+    void place(size_t position, const Entry& entry);
+    void sift_up(size_t position);
+    void sift_down(size_t position);
+    void remove_at(size_t position);
+};
@@ -1,13 +1,59 @@
 #include "System.h"
 
-void System::run() {
+#include <algorithm>
+#include <limits>
+
+System::System() {
+    m_interrupts.set_line_handler([this](bool active) { m_cpu.set_interrupt_line(active); });
+
+    m_dma.set_ram_write_handler([this](uint32_t physical_address, uint32_t size) {
+        m_cpu.invalidate_ram(physical_address, size);
+    });
+    m_dma.connect(Dma::Channel::gpu, {
+        .read = [this](std::span<uint32_t> words) { m_gpu.send_data(words); },
+        .write = [this](std::span<const uint32_t> words) { m_gpu.receive_commands(words); },
+    });
+
+    // Stands in for the GPU's vblank until the GPU keeps video timing itself
+    m_scheduler.set_handler(Scheduler::Event::vblank, [this](uint64_t cycles_late) {
+        m_frame_done = true;
+        m_interrupts.request(Interrupt_controller::Source::vblank);
+        m_scheduler.schedule(Scheduler::Event::vblank, cycles_per_frame(m_video_standard) - cycles_late);
+    });
+    m_scheduler.schedule(Scheduler::Event::vblank, cycles_per_frame(m_video_standard));
+}
+
+uint64_t System::run_for(uint64_t cycles) {
+    uint64_t start { m_scheduler.now() };
+    uint64_t end { start + cycles };
+    while (m_scheduler.now() < end) {
+        uint64_t budget { std::min<uint64_t>(end - m_scheduler.now(), std::numeric_limits<uint32_t>::max()) };
+        m_instructions_executed += m_cpu.run(static_cast<uint32_t>(budget));
+        m_scheduler.run_due_events();
+
+        if (m_cpu.at_breakpoint()) {
+            m_pause_system = true;
+            break;
+        }
+    }
+    return m_scheduler.now() - start;
+}
+
+void System::run_frame() {
     if (m_pause_system) {
+        m_pacer.idle();
         return;
     }
-    m_cpu.fetch_decode_execute();
+
+    uint64_t start_cycle { m_scheduler.now() };
+    uint64_t start_instructions { m_instructions_executed };
+    m_frame_done = false;
+    while (!m_frame_done && !m_pause_system) {
+        run_for(m_scheduler.next_deadline() - m_scheduler.now());
+    }
+    m_pacer.frame_done(m_scheduler.now() - start_cycle, m_instructions_executed - start_instructions);
 }
 
 void System::pause(bool pause_state) {
     m_pause_system = pause_state;
 }
-
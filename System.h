@@ -4,25 +4,91 @@
 
 #include "Bus.h"
 #include "Cpu.h"
+#include "Dma.h"
+#include "Frame_pacer.h"
 #include "Gpu.h"
+#include "Interrupt_controller.h"
 #include "Ram.h"
+#include "Scheduler.h"
+#include "Timers.h"
 
 class System {
 public:
+	System();
+
 	const Cpu& get_cpu() const { return m_cpu; }
 	const Bios& get_bios() const { return m_bios; }
 	const Bus& get_bus() const { return m_bus; }
 	const Ram& get_ram() const { return m_memory; }
+	const Scheduler& get_scheduler() const { return m_scheduler; }
+
+	void set_cpu_backend(Cpu::Backend backend) { m_cpu.set_backend(backend); }
+	// Draws on a thread of its own, see Gpu::set_threaded
+	void set_gpu_threaded(bool threaded) { m_gpu.set_threaded(threaded); }
+	// Rasterizes on this many threads, see Gpu::set_render_threads
+	void set_gpu_render_threads(uint32_t thread_count) { m_gpu.set_render_threads(thread_count); }
+	// Writes a binary trace of every executed instruction, see soulpsx-trace
+	bool start_trace(const std::string& path) { return m_cpu.start_trace(path); }
+	void stop_trace() { m_cpu.stop_trace(); }
+
+	// Runs the system for the given number of cycles, or until the CPU hits a
+	// breakpoint, which pauses the system. The CPU runs in batches up to the
+	// next scheduled event. Every instruction counts as one cycle for now.
+	// Returns the number of cycles run.
+	uint64_t run_for(uint64_t cycles);
+	// Runs until the next vblank, unless paused, then waits as long as the
+	// speed mode asks. While paused it sleeps for a moment instead.
+	void run_frame();
+
+	// Throttled runs at the refresh rate of the video standard
+	void set_speed_mode(Frame_pacer::Mode mode, double multiplier = 1.0) { m_pacer.set_mode(mode, multiplier); }
+	Frame_pacer::Mode get_speed_mode() const { return m_pacer.get_mode(); }
+	double get_speed_multiplier() const { return m_pacer.get_multiplier(); }
+	// Emulated speed, guest MIPS and host frame time, updated twice a second
+	const Frame_pacer::Stats& get_stats() const { return m_pacer.stats(); }
+	uint64_t get_instructions_executed() const { return m_instructions_executed; }
+	Texture_cache::Stats get_texture_cache_stats() const { return m_gpu.get_texture_cache_stats(); }
+	// All three wait for the GPU to catch up
+	const Vram& get_vram() { return m_gpu.get_vram(); }
+	Gpu::Display get_display() { return m_gpu.get_display(); }
+	std::bitset<Vram::height> take_written_lines() { return m_gpu.take_written_lines(); }
 
-	void run();
+	enum class Video_standard {
+		// 59.94Hz
+		ntsc,
+		// 50Hz
+		pal,
+	};
+	// Takes effect from the next vblank
+	void set_video_standard(Video_standard standard) { m_video_standard = standard; }
+	Video_standard get_video_standard() const { return m_video_standard; }
+
+	bool paused() const { return m_pause_system; }
 	void pause(bool pause_state);
 	void quit(bool quit_state);
+
+	void add_breakpoint(uint32_t address) { m_cpu.add_breakpoint(address); }
+	void remove_breakpoint(uint32_t address) { m_cpu.remove_breakpoint(address); }
+
+	static constexpr uint64_t cpu_clock_hz { 33'868'800 };
+	static constexpr uint64_t cycles_per_frame(Video_standard standard) {
+		return standard == Video_standard::ntsc ? cpu_clock_hz * 1001 / 60'000 : cpu_clock_hz / 50;
+	}
 private:
+    Scheduler m_scheduler {};
+    bool m_frame_done {};
+    Video_standard m_video_standard { Video_standard::ntsc };
+    uint64_t m_instructions_executed {};
+    Frame_pacer m_pacer { cpu_clock_hz };
+
     static constexpr std::string bios_file_path { "../scph1001.bin" };
     Bios m_bios { bios_file_path };
     Ram m_memory {};
 	Gpu m_gpu {};
-    Bus m_bus { m_bios, m_memory, m_gpu };
-	Cpu m_cpu { m_bus };
+    Interrupt_controller m_interrupts {};
+    Timers m_timers { m_scheduler, m_interrupts };
+    Dma m_dma { m_memory, m_interrupts };
+    Bus m_bus { m_bios, m_memory, m_gpu, m_timers, m_interrupts, m_dma };
+	Cpu m_cpu { m_bus, m_scheduler };
 	bool m_pause_system { false };
 };
@@ -0,0 +1,150 @@
+#include "Texture_cache.h"
+
+#include <algorithm>
+
+const uint16_t* Texture_cache::lookup(uint16_t texpage, uint16_t clut, const Rect& drawn) {
+    uint32_t depth { (texpage >> 7) & 3u };
+    if (depth >= 2) {
+        return nullptr;
+    }
+
+    Key key {
+        .page_x = (texpage & 0xfu) * 64,
+        .page_y = ((texpage >> 4) & 1u) * 256,
+        .depth = depth,
+        .clut_x = (clut & 0x3fu) * 16,
+        .clut_y = (clut >> 6) & 0x1ffu,
+    };
+    m_lookups++;
+
+    auto drawn_over = [&](const std::vector<uint32_t>& tiles) {
+        return std::any_of(tiles.begin(), tiles.end(), [&](uint32_t tile) {
+            auto column { static_cast<int32_t>(tile % tiles_x) };
+            auto row { static_cast<int32_t>(tile / tiles_x) };
+            return column >= drawn.left / static_cast<int32_t>(tile_size) && column <= drawn.right / static_cast<int32_t>(tile_size)
+                && row >= drawn.top / static_cast<int32_t>(tile_size) && row <= drawn.bottom / static_cast<int32_t>(tile_size);
+        });
+    };
+
+    auto found { std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+        return entry.valid && entry.key == key;
+    }) };
+    if (found != m_entries.end()) {
+        if (drawn_over(found->tiles)) {
+            return nullptr;
+        }
+        found->last_used = m_lookups;
+        if (written_since_decode(*found)) {
+            count(m_invalidations);
+            count(m_misses);
+            decode(*found);
+        } else {
+            count(m_hits);
+        }
+        return found->texels.data();
+    }
+
+    std::vector<uint32_t> tiles { source_tiles(key) };
+    if (drawn_over(tiles)) {
+        return nullptr;
+    }
+
+    // Unused entries have never been used, so they go first
+    Entry& entry { *std::min_element(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+        return a.last_used < b.last_used;
+    }) };
+    count(m_misses);
+    entry.key = key;
+    entry.tiles = std::move(tiles);
+    entry.last_used = m_lookups;
+    decode(entry);
+    return entry.texels.data();
+}
+
+void Texture_cache::invalidate(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    m_write_sequence++;
+    x &= Vram::width - 1;
+    y &= Vram::height - 1;
+    for (uint32_t row { y / tile_size }; row <= (y + height - 1) / tile_size; row++) {
+        for (uint32_t column { x / tile_size }; column <= (x + width - 1) / tile_size; column++) {
+            m_tile_written[(row % tiles_y) * tiles_x + column % tiles_x] = m_write_sequence;
+        }
+    }
+}
+
+Texture_cache::Stats Texture_cache::get_stats() const {
+    return {
+        .hits = m_hits.load(std::memory_order_relaxed),
+        .misses = m_misses.load(std::memory_order_relaxed),
+        .invalidations = m_invalidations.load(std::memory_order_relaxed),
+    };
+}
+
+// The page is 64 or 128 VRAM pixels wide and the CLUT 16 or 256, both
+// wrapping at the right edge
+std::vector<uint32_t> Texture_cache::source_tiles(const Key& key) {
+    std::vector<uint32_t> tiles {};
+    auto add = [&](uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        for (uint32_t row { y / tile_size }; row <= (y + height - 1) / tile_size; row++) {
+            for (uint32_t column { x / tile_size }; column <= (x + width - 1) / tile_size; column++) {
+                tiles.push_back((row % tiles_y) * tiles_x + column % tiles_x);
+            }
+        }
+    };
+    add(key.page_x, key.page_y, key.depth == 0 ? 64 : 128, page_size);
+    add(key.clut_x, key.clut_y, key.depth == 0 ? 16 : 256, 1);
+
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+    return tiles;
+}
+
+bool Texture_cache::written_since_decode(const Entry& entry) const {
+    return std::any_of(entry.tiles.begin(), entry.tiles.end(), [&](uint32_t tile) {
+        return m_tile_written[tile] > entry.decoded_at;
+    });
+}
+
+void Texture_cache::decode(Entry& entry) {
+    if (m_miss_handler) {
+        m_miss_handler();
+    }
+
+    const Key& key { entry.key };
+    bool four_bit { key.depth == 0 };
+    std::array<uint16_t, 256> clut {};
+    m_vram.read_run(key.clut_x, key.clut_y, { clut.data(), four_bit ? 16u : 256u });
+
+    entry.texels.resize(page_size * page_size + 1);
+    std::array<uint16_t, 128> indices {};
+    for (uint32_t v { 0 }; v < page_size; v++) {
+        uint16_t* texels { entry.texels.data() + v * page_size };
+        if (four_bit) {
+            m_vram.read_run(key.page_x, key.page_y + v, { indices.data(), 64 });
+            for (uint32_t i { 0 }; i < 64; i++) {
+                uint16_t packed { indices[i] };
+                texels[i * 4] = clut[packed & 0xf];
+                texels[i * 4 + 1] = clut[(packed >> 4) & 0xf];
+                texels[i * 4 + 2] = clut[(packed >> 8) & 0xf];
+                texels[i * 4 + 3] = clut[packed >> 12];
+            }
+        } else {
+            m_vram.read_run(key.page_x, key.page_y + v, { indices.data(), 128 });
+            for (uint32_t i { 0 }; i < 128; i++) {
+                texels[i * 2] = clut[indices[i] & 0xff];
+                texels[i * 2 + 1] = clut[indices[i] >> 8];
+            }
+        }
+    }
+    entry.decoded_at = m_write_sequence;
+    entry.valid = true;
+}
+
+// Only the drawing thread counts, other threads only read
+void Texture_cache::count(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
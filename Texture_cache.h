@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Vram.h"
+
+// 4 and 8 bit texture pages looked up through their CLUT ahead of time,
+// so drawing fetches one 16 bit texel instead of an index and a CLUT
+// entry. Pages are keyed by the page, depth and CLUT they were decoded
+// with. VRAM writes mark 32x32 pixel tiles as written, and a page is decoded
+// again once any tile it was read from has been written since.
+class Texture_cache {
+public:
+    // Decoded pages are 256x256 texels, indexed by v * 256 + u
+    static constexpr uint32_t page_size { 256 };
+
+    struct Stats {
+        uint64_t hits {};
+        uint64_t misses {};
+        // Misses because the page or its CLUT were written since decoding
+        uint64_t invalidations {};
+    };
+
+    // Inclusive, in VRAM pixels
+    struct Rect {
+        int32_t left {};
+        int32_t top {};
+        int32_t right {};
+        int32_t bottom {};
+    };
+
+    explicit Texture_cache(const Vram& vram) : m_vram { vram } {}
+
+    // Runs before a page is decoded, so drawing still pending elsewhere can
+    // reach VRAM first. Pages handed out before may be decoded over after.
+    void set_miss_handler(std::function<void()> handler) { m_miss_handler = std::move(handler); }
+
+    // Texels for the texpage (in the layout of GP0 E1) and CLUT. Null for
+    // 15 bit textures, and for textures under the area being drawn, which
+    // have to be read as they are drawn over.
+    const uint16_t* lookup(uint16_t texpage, uint16_t clut, const Rect& drawn);
+    // Called for every VRAM write. Wraps at the edges.
+    void invalidate(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    Stats get_stats() const;
+private:
+    static constexpr uint32_t tile_size { 32 };
+    static constexpr uint32_t tiles_x { Vram::width / tile_size };
+    static constexpr uint32_t tiles_y { Vram::height / tile_size };
+    static constexpr size_t max_entries { 32 };
+
+    struct Key {
+        uint32_t page_x {};
+        uint32_t page_y {};
+        // 0 for 4 bit and 1 for 8 bit
+        uint32_t depth {};
+        uint32_t clut_x {};
+        uint32_t clut_y {};
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct Entry {
+        Key key {};
+        bool valid {};
+        // m_write_sequence when decoded
+        uint64_t decoded_at {};
+        uint64_t last_used {};
+        // Tiles the page and its CLUT were read from
+        std::vector<uint32_t> tiles {};
+        // page_size squared, plus a pixel for 32 bit gathers of the last
+        std::vector<uint16_t> texels {};
+    };
+
+    const Vram& m_vram;
+    std::function<void()> m_miss_handler {};
+    std::array<Entry, max_entries> m_entries {};
+    uint64_t m_lookups {};
+
+    // Sequence number of the last write to each tile
+    std::array<uint64_t, tiles_x * tiles_y> m_tile_written {};
+    uint64_t m_write_sequence {};
+
+    // Read from other threads
+    std::atomic<uint64_t> m_hits {};
+    std::atomic<uint64_t> m_misses {};
+    std::atomic<uint64_t> m_invalidations {};
+
+    static std::vector<uint32_t> source_tiles(const Key& key);
+    bool written_since_decode(const Entry& entry) const;
+    void decode(Entry& entry);
+    static void count(std::atomic<uint64_t>& counter);
+};
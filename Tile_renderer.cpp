@@ -0,0 +1,225 @@
+#include "Tile_renderer.h"
+
+#include <algorithm>
+
+Tile_renderer::Tile_renderer(Rasterizer& rasterizer, uint32_t thread_count)
+    : m_rasterizer { rasterizer }, m_thread_count { std::max(thread_count, 1u) } {
+    for (uint32_t i { 0 }; i < m_thread_count; i++) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (uint32_t i { 1 }; i < m_thread_count; i++) {
+        m_workers.emplace_back([this, i] { run_worker(i); });
+    }
+}
+
+Tile_renderer::~Tile_renderer() {
+    m_stopping.store(true, std::memory_order_release);
+    m_generation.fetch_add(1, std::memory_order_release);
+    m_generation.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void Tile_renderer::draw_triangles(const Rasterizer::Draw_settings& settings,
+    std::span<const Rasterizer::Triangle> triangles) {
+    for (const Rasterizer::Triangle& triangle : triangles) {
+        draw_triangle(settings, triangle);
+    }
+}
+
+void Tile_renderer::draw_triangle(const Rasterizer::Draw_settings& settings, const Rasterizer::Triangle& triangle) {
+    Rasterizer::Setup setup {};
+    if (!Rasterizer::setup_triangle(settings, triangle, setup)) {
+        return;
+    }
+
+    // What a triangle samples from pixels drawn before it, or by itself,
+    // depends on the order they are drawn in, so it is drawn in one go
+    std::bitset<tile_count> sampled { sampled_tiles(setup) };
+    std::bitset<tile_count> bounds { bounding_tiles(setup) };
+    if ((sampled & (m_drawn_tiles | bounds)).any()) {
+        flush();
+        m_rasterizer.draw(setup);
+        return;
+    }
+    // Nor may it draw over texels a binned triangle is still to read
+    if ((bounds & m_sampled_tiles).any()) {
+        flush();
+    }
+
+    auto index { static_cast<uint32_t>(m_setups.size()) };
+    bool binned { false };
+    for (int32_t row { setup.min_y / tile_size }; row <= setup.max_y / tile_size; row++) {
+        for (int32_t column { setup.min_x / tile_size }; column <= setup.max_x / tile_size; column++) {
+            uint32_t tile { static_cast<uint32_t>(row) * tiles_x + static_cast<uint32_t>(column) };
+            if (!covers_tile(setup, tile)) {
+                continue;
+            }
+            if (m_bins[tile].empty()) {
+                m_binned_tiles.push_back(tile);
+            }
+            m_bins[tile].push_back(index);
+            m_drawn_tiles.set(tile);
+            binned = true;
+        }
+    }
+
+    if (binned) {
+        m_setups.push_back(setup);
+        m_sampled_tiles |= sampled;
+        if (m_setups.size() >= max_batch) {
+            flush();
+        }
+    }
+}
+
+void Tile_renderer::flush() {
+    if (m_binned_tiles.empty()) {
+        return;
+    }
+
+    if (m_workers.empty() || m_binned_tiles.size() <= min_pool_tiles) {
+        for (uint32_t tile : m_binned_tiles) {
+            draw_tile(tile);
+        }
+    } else {
+        // Set before any tile is queued, a worker still busy with the last
+        // flush may pick one up straight away
+        m_tiles_left.store(static_cast<uint32_t>(m_binned_tiles.size()), std::memory_order_relaxed);
+        // Neighbouring tiles go to different threads, which spreads out
+        // areas of heavy overdraw
+        for (size_t i { 0 }; i < m_binned_tiles.size(); i++) {
+            Queue& queue { *m_queues[i % m_thread_count] };
+            std::lock_guard lock { queue.mutex };
+            queue.tiles.push_back(m_binned_tiles[i]);
+        }
+        m_generation.fetch_add(1, std::memory_order_release);
+        m_generation.notify_all();
+
+        work(0);
+        while (m_tiles_left.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (uint32_t tile : m_binned_tiles) {
+        m_bins[tile].clear();
+    }
+    m_binned_tiles.clear();
+    m_drawn_tiles.reset();
+    m_sampled_tiles.reset();
+    m_setups.clear();
+}
+
+// Texture pages and CLUTs may run past the right edge of VRAM and wrap
+std::bitset<Tile_renderer::tile_count> Tile_renderer::sampled_tiles(const Rasterizer::Setup& setup) {
+    std::bitset<tile_count> tiles {};
+    // Decoded pages are copies, drawing cannot change them
+    if (!setup.textured || setup.texels) {
+        return tiles;
+    }
+
+    auto add = [&](uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        for (uint32_t row { y / tile_size }; row <= (y + height - 1) / tile_size; row++) {
+            for (uint32_t column { x / tile_size }; column <= (x + width - 1) / tile_size; column++) {
+                tiles.set((row % tiles_y) * tiles_x + column % tiles_x);
+            }
+        }
+    };
+
+    // Width in VRAM pixels of a page of 4, 8 and 15 bit texels
+    static constexpr std::array<uint32_t, 3> page_widths { 64, 128, 256 };
+    add(setup.page_x, setup.page_y, page_widths[setup.texture_depth], 256);
+    if (setup.texture_depth != 2) {
+        add(setup.clut_x, setup.clut_y, setup.texture_depth == 0 ? 16 : 256, 1);
+    }
+    return tiles;
+}
+
+std::bitset<Tile_renderer::tile_count> Tile_renderer::bounding_tiles(const Rasterizer::Setup& setup) {
+    std::bitset<tile_count> tiles {};
+    for (int32_t row { setup.min_y / tile_size }; row <= setup.max_y / tile_size; row++) {
+        for (int32_t column { setup.min_x / tile_size }; column <= setup.max_x / tile_size; column++) {
+            tiles.set(static_cast<uint32_t>(row) * tiles_x + static_cast<uint32_t>(column));
+        }
+    }
+    return tiles;
+}
+
+// Whether any pixel of the tile might be inside all three edges, checked at
+// the corner of the tile furthest inside each edge
+bool Tile_renderer::covers_tile(const Rasterizer::Setup& setup, uint32_t tile) {
+    auto left { static_cast<int32_t>(tile % tiles_x) * tile_size };
+    auto top { static_cast<int32_t>(tile / tiles_x) * tile_size };
+    int32_t min_x { std::max(setup.min_x, left) };
+    int32_t min_y { std::max(setup.min_y, top) };
+    int32_t max_x { std::min(setup.max_x, left + tile_size - 1) };
+    int32_t max_y { std::min(setup.max_y, top + tile_size - 1) };
+
+    for (uint32_t i { 0 }; i < 3; i++) {
+        int32_t edge { setup.edge[i] - setup.edge_bias[i]
+            + setup.edge_dx[i] * (min_x - setup.min_x) + setup.edge_dy[i] * (min_y - setup.min_y) };
+        edge += std::max(setup.edge_dx[i] * (max_x - min_x), 0);
+        edge += std::max(setup.edge_dy[i] * (max_y - min_y), 0);
+        if (edge < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Tile_renderer::draw_tile(uint32_t tile) {
+    auto left { static_cast<int32_t>(tile % tiles_x) * tile_size };
+    auto top { static_cast<int32_t>(tile / tiles_x) * tile_size };
+    for (uint32_t index : m_bins[tile]) {
+        Rasterizer::Setup setup { m_setups[index] };
+        if (Rasterizer::clip(setup, left, top, left + tile_size - 1, top + tile_size - 1)) {
+            m_rasterizer.draw(setup);
+        }
+    }
+}
+
+bool Tile_renderer::take_tile(uint32_t thread, uint32_t& tile) {
+    {
+        Queue& own { *m_queues[thread] };
+        std::lock_guard lock { own.mutex };
+        if (own.front < own.tiles.size()) {
+            tile = own.tiles.back();
+            own.tiles.pop_back();
+            return true;
+        }
+        own.tiles.clear();
+        own.front = 0;
+    }
+
+    for (uint32_t i { 1 }; i < m_thread_count; i++) {
+        Queue& victim { *m_queues[(thread + i) % m_thread_count] };
+        std::lock_guard lock { victim.mutex };
+        if (victim.front < victim.tiles.size()) {
+            tile = victim.tiles[victim.front++];
+            return true;
+        }
+    }
+    return false;
+}
+
+void Tile_renderer::work(uint32_t thread) {
+    uint32_t tile {};
+    while (take_tile(thread, tile)) {
+        draw_tile(tile);
+        m_tiles_left.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void Tile_renderer::run_worker(uint32_t thread) {
+    uint32_t generation {};
+    while (true) {
+        m_generation.wait(generation, std::memory_order_acquire);
+        generation = m_generation.load(std::memory_order_acquire);
+        if (m_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        work(thread);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "Rasterizer.h"
+#include "Vram.h"
+
+// Draws triangles on several threads. Triangles are set up as they arrive
+// and sorted into bins of 32x32 pixel tiles. A flush hands the tiles to a
+// pool of threads that steal tiles from each other once their own run out.
+// Each tile draws its triangles in the order they arrived, so every pixel
+// comes out exactly as it would from a single Rasterizer.
+class Tile_renderer {
+public:
+    // The thread that flushes counts as one of the threads
+    Tile_renderer(Rasterizer& rasterizer, uint32_t thread_count);
+    ~Tile_renderer();
+
+    void draw_triangle(const Rasterizer::Draw_settings& settings, const Rasterizer::Triangle& triangle);
+    void draw_triangles(const Rasterizer::Draw_settings& settings, std::span<const Rasterizer::Triangle> triangles);
+    // Draws everything binned so far and waits for it to finish
+    void flush();
+
+    uint32_t get_thread_count() const { return m_thread_count; }
+private:
+    static constexpr int32_t tile_size { 32 };
+    static constexpr uint32_t tiles_x { Vram::width / tile_size };
+    static constexpr uint32_t tiles_y { Vram::height / tile_size };
+    static constexpr uint32_t tile_count { tiles_x * tiles_y };
+    // Flushed once this many triangles are waiting
+    static constexpr size_t max_batch { 4096 };
+    // Flushes touching no more tiles than this are drawn without the pool
+    static constexpr size_t min_pool_tiles { 4 };
+
+    // Tiles for one thread. The owner takes from the back and thieves from
+    // the front.
+    struct Queue {
+        std::mutex mutex {};
+        std::vector<uint32_t> tiles {};
+        size_t front {};
+    };
+
+    Rasterizer& m_rasterizer;
+    uint32_t m_thread_count {};
+
+    std::vector<Rasterizer::Setup> m_setups {};
+    // Indices into m_setups, in arrival order
+    std::array<std::vector<uint32_t>, tile_count> m_bins {};
+    // Tiles with a non-empty bin
+    std::vector<uint32_t> m_binned_tiles {};
+    std::bitset<tile_count> m_drawn_tiles {};
+    // Tiles the binned triangles read texels or CLUT entries from
+    std::bitset<tile_count> m_sampled_tiles {};
+
+    std::vector<std::unique_ptr<Queue>> m_queues {};
+    std::atomic<uint32_t> m_tiles_left {};
+    std::atomic<uint32_t> m_generation {};
+    std::atomic<bool> m_stopping {};
+    std::vector<std::thread> m_workers {};
+
+    // Tiles a triangle reads texels and CLUT entries from
+    static std::bitset<tile_count> sampled_tiles(const Rasterizer::Setup& setup);
+    static std::bitset<tile_count> bounding_tiles(const Rasterizer::Setup& setup);
+    static bool covers_tile(const Rasterizer::Setup& setup, uint32_t tile);
+    void draw_tile(uint32_t tile);
+    bool take_tile(uint32_t thread, uint32_t& tile);
+    void work(uint32_t thread);
+    void run_worker(uint32_t thread);
+};
@@ -0,0 +1,186 @@
+#include "Timers.h"
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "Memory.h"
+
+Timers::Timers(Scheduler& scheduler, Interrupt_controller& interrupts)
+    : m_scheduler { scheduler }, m_interrupts { interrupts } {
+    for (uint32_t i { 0 }; i < m_counters.size(); i++) {
+        m_scheduler.set_handler(event_for(i), [this, i](uint64_t cycles_late) { fire_irq(i, cycles_late); });
+    }
+}
+
+uint32_t Timers::read(uint32_t physical_address) {
+    uint32_t offset { Memory::Map::timers.offset(physical_address) };
+    uint32_t index { offset >> 4 };
+    Counter& counter { m_counters[index] };
+
+    switch (offset & 0xc) {
+        case 0x0: {
+            catch_up(counter, m_scheduler.now());
+            return counter.value;
+        }
+        case 0x4: {
+            catch_up(counter, m_scheduler.now());
+            uint16_t mode { counter.mode };
+            // The reached flags clear once they have been read
+            counter.mode &= ~(Mode::reached_target | Mode::reached_overflow);
+            return mode;
+        }
+        case 0x8: {
+            return counter.target;
+        }
+    }
+
+    LOG_WARNING("[TIMERS] Read from unused register 0x{:x}", physical_address);
+    return 0;
+}
+
+void Timers::write(uint32_t physical_address, uint32_t value) {
+    uint32_t offset { Memory::Map::timers.offset(physical_address) };
+    uint32_t index { offset >> 4 };
+    Counter& counter { m_counters[index] };
+
+    catch_up(counter, m_scheduler.now());
+    switch (offset & 0xc) {
+        case 0x0: {
+            counter.value = static_cast<uint16_t>(value);
+            break;
+        }
+        case 0x4: {
+            // Writing the mode restarts the counter from 0
+            counter.mode = (counter.mode & (Mode::reached_target | Mode::reached_overflow))
+                | (value & Mode::writable) | Mode::no_irq_request;
+            counter.value = 0;
+            counter.base_cycle = m_scheduler.now();
+            counter.cycles_per_tick = cycles_per_tick(index);
+            counter.irq_fired = false;
+            if (value & 0x1) {
+                LOG_WARNING("[TIMERS] Timer {} sync modes are not supported, counting freely", index);
+            }
+            break;
+        }
+        case 0x8: {
+            counter.target = static_cast<uint16_t>(value);
+            break;
+        }
+        default: {
+            LOG_WARNING("[TIMERS] Write to unused register 0x{:x}", physical_address);
+            return;
+        }
+    }
+    schedule_irq(index);
+}
+
+uint32_t Timers::cycles_per_tick(uint32_t index) const {
+    uint32_t source { static_cast<uint32_t>((m_counters[index].mode & Mode::clock_source) >> 8) };
+    switch (index) {
+        case 0: return (source & 1) ? cycles_per_dot : 1;
+        case 1: return (source & 1) ? cycles_per_hblank : 1;
+        default: return (source & 2) ? 8 : 1;
+    }
+}
+
+void Timers::catch_up(Counter& counter, uint64_t cycle) {
+    uint64_t ticks { (cycle - counter.base_cycle) / counter.cycles_per_tick };
+    if (ticks == 0) {
+        return;
+    }
+
+    if (ticks_until(counter, counter.target) <= ticks) {
+        counter.mode |= Mode::reached_target;
+    }
+    if (ticks_until(counter, 0xffff) <= ticks) {
+        counter.mode |= Mode::reached_overflow;
+    }
+    counter.value = advance(counter, ticks);
+    // Keep the part of a tick that has already gone by
+    counter.base_cycle += ticks * counter.cycles_per_tick;
+}
+
+// Schedules the next target or overflow interrupt the mode asks for, if any
+void Timers::schedule_irq(uint32_t index) {
+    const Counter& counter { m_counters[index] };
+    bool one_shot_done { counter.irq_fired && !(counter.mode & Mode::irq_repeat) };
+
+    uint64_t ticks { never };
+    if ((counter.mode & Mode::irq_on_target) && !one_shot_done) {
+        ticks = std::min(ticks, ticks_until(counter, counter.target));
+    }
+    if ((counter.mode & Mode::irq_on_overflow) && !one_shot_done) {
+        ticks = std::min(ticks, ticks_until(counter, 0xffff));
+    }
+
+    if (ticks == never) {
+        m_scheduler.cancel(event_for(index));
+        return;
+    }
+    m_scheduler.schedule_at(event_for(index), counter.base_cycle + ticks * counter.cycles_per_tick);
+}
+
+void Timers::fire_irq(uint32_t index, uint64_t cycles_late) {
+    Counter& counter { m_counters[index] };
+    // Only up to the interrupt, the next one may already be due as well
+    catch_up(counter, m_scheduler.now() - cycles_late);
+    counter.irq_fired = true;
+
+    // In pulse mode the request line only drops for a few cycles, so it
+    // reads back as idle. In toggle mode only the falling edge interrupts.
+    bool request { true };
+    if (counter.mode & Mode::irq_toggle) {
+        counter.mode ^= Mode::no_irq_request;
+        request = !(counter.mode & Mode::no_irq_request);
+    }
+    if (request) {
+        m_interrupts.request(static_cast<Interrupt_controller::Source>(
+            static_cast<uint32_t>(Interrupt_controller::Source::timer_0) + index));
+    }
+
+    schedule_irq(index);
+}
+
+uint16_t Timers::wrap_value(const Counter& counter) {
+    return (counter.mode & Mode::reset_on_target) ? counter.target : 0xffff;
+}
+
+// Ticks from the counter's value until it next holds the given value. A
+// counter above its wrap value first runs up to 0xffff.
+uint64_t Timers::ticks_until(const Counter& counter, uint16_t value) {
+    uint64_t current { counter.value };
+    uint64_t wrap { wrap_value(counter) };
+
+    if (current <= wrap) {
+        if (value > wrap) {
+            return never;
+        }
+        if (value > current) {
+            return value - current;
+        }
+        return wrap - current + 1 + value;
+    }
+
+    if (value > current) {
+        return value - current;
+    }
+    if (value <= wrap) {
+        return 0xffff - current + 1 + value;
+    }
+    return never;
+}
+
+uint16_t Timers::advance(const Counter& counter, uint64_t ticks) {
+    uint64_t current { counter.value };
+    uint64_t wrap { wrap_value(counter) };
+
+    if (current > wrap) {
+        uint64_t to_overflow { 0x10000 - current };
+        if (ticks < to_overflow) {
+            return static_cast<uint16_t>(current + ticks);
+        }
+        ticks -= to_overflow;
+        current = 0;
+    }
+    return static_cast<uint16_t>((current + ticks) % (wrap + 1));
+}
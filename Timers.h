@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+#include "Interrupt_controller.h"
+#include "Scheduler.h"
+
+// The three root counters. Nothing ticks them: each counter remembers its
+// value at some cycle and works out the current value from the scheduler's
+// clock when it is read or written. Target and overflow interrupts are
+// scheduled for the cycle they happen on.
+class Timers {
+public:
+    Timers(Scheduler& scheduler, Interrupt_controller& interrupts);
+
+    // Register accesses from the bus.
+    // 0x1f801100 + 0x10 * n -> counter value, + 4 -> mode, + 8 -> target
+    uint32_t read(uint32_t physical_address);
+    void write(uint32_t physical_address, uint32_t value);
+
+    // Approximations until the GPU keeps video timing: the dot clock of a
+    // 320 pixel wide mode and an NTSC scanline, in CPU cycles.
+    static constexpr uint32_t cycles_per_dot { 5 };
+    static constexpr uint32_t cycles_per_hblank { 2172 };
+private:
+    struct Mode {
+        static constexpr uint16_t reset_on_target { 1 << 3 };
+        static constexpr uint16_t irq_on_target { 1 << 4 };
+        static constexpr uint16_t irq_on_overflow { 1 << 5 };
+        static constexpr uint16_t irq_repeat { 1 << 6 };
+        static constexpr uint16_t irq_toggle { 1 << 7 };
+        static constexpr uint16_t clock_source { 3 << 8 };
+        // Active low
+        static constexpr uint16_t no_irq_request { 1 << 10 };
+        static constexpr uint16_t reached_target { 1 << 11 };
+        static constexpr uint16_t reached_overflow { 1 << 12 };
+        static constexpr uint16_t writable { 0x3ff };
+    };
+
+    struct Counter {
+        // Value the counter had at base_cycle
+        uint16_t value {};
+        uint16_t target {};
+        uint16_t mode { Mode::no_irq_request };
+        uint64_t base_cycle {};
+        uint32_t cycles_per_tick { 1 };
+        // A one shot interrupt has gone off since the mode was written
+        bool irq_fired {};
+    };
+
+    static constexpr uint64_t never { std::numeric_limits<uint64_t>::max() };
+
+    Scheduler& m_scheduler;
+    Interrupt_controller& m_interrupts;
+    std::array<Counter, 3> m_counters {};
+
+    static Scheduler::Event event_for(uint32_t index) {
+        return static_cast<Scheduler::Event>(static_cast<uint32_t>(Scheduler::Event::timer_0) + index);
+    }
+
+    uint32_t cycles_per_tick(uint32_t index) const;
+    // Brings the counter's value and reached flags up to the given cycle
+    void catch_up(Counter& counter, uint64_t cycle);
+    void schedule_irq(uint32_t index);
+    void fire_irq(uint32_t index, uint64_t cycles_late);
+
+    // Value at which the counter goes back to 0
+    static uint16_t wrap_value(const Counter& counter);
+    static uint64_t ticks_until(const Counter& counter, uint16_t value);
+    static uint16_t advance(const Counter& counter, uint64_t ticks);
+};
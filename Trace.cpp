@@ -0,0 +1,235 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+Trace_writer::Trace_writer(const std::string& path) {
+	m_file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_file < 0) {
+		LOG_ERROR("[TRACE] Could not open {}", path);
+		return;
+	}
+
+	// The first window is mapped up front, the header fills its first record
+	m_active = map_window(0);
+	if (!m_active.data) {
+		close(m_file);
+		m_file = -1;
+		return;
+	}
+	Trace_header header {
+		Trace_header::expected_magic,
+		Trace_header::current_version,
+		sizeof(Trace_record),
+		0
+	};
+	std::memcpy(m_active.data, &header, sizeof(header));
+	m_cursor = m_active.data + sizeof(Trace_header);
+	m_window_end = m_active.data + m_window_size;
+
+	m_thread = std::thread { [this] { map_windows(); } };
+}
+
+Trace_writer::~Trace_writer() {
+	if (!is_open()) {
+		return;
+	}
+
+	{
+		std::lock_guard lock { m_mutex };
+		m_stopping = true;
+	}
+	m_condition.notify_one();
+	m_thread.join();
+
+	uint64_t count { record_count() };
+	unmap_window(m_active);
+	unmap_window(m_next);
+	unmap_window(m_retired);
+
+	// Drop the unused tail of the last window, then fill in the final count
+	if (ftruncate(m_file, static_cast<off_t>(sizeof(Trace_header) + count * sizeof(Trace_record))) != 0) {
+		LOG_ERROR("[TRACE] Failed to finish the trace file");
+	}
+	write_record_count(count);
+	close(m_file);
+}
+
+// The header's first window may still be mapped, which is fine: the mapping
+// is shared, so it sees the write.
+void Trace_writer::write_record_count(uint64_t count) {
+	if (pwrite(m_file, &count, sizeof(count), offsetof(Trace_header, record_count)) != sizeof(count)) {
+		LOG_ERROR("[TRACE] Failed to update the record count");
+	}
+}
+
+uint64_t Trace_writer::record_count() const {
+	uint64_t bytes { m_active.file_offset + static_cast<uint64_t>(m_cursor - m_active.data) };
+	return (bytes - sizeof(Trace_header)) / sizeof(Trace_record);
+}
+
+// Swaps in the window the mapping thread has prepared. Normally it is ready
+// long before the active one fills up.
+void Trace_writer::next_window() {
+	std::unique_lock lock { m_mutex };
+	m_condition.wait(lock, [this] { return m_next_ready; });
+
+	m_retired = m_active;
+	m_active = m_next;
+	m_next = {};
+	m_next_ready = false;
+	lock.unlock();
+	m_condition.notify_one();
+
+	m_cursor = m_active.data;
+	m_window_end = m_active.data + m_window_size;
+}
+
+// Runs on the mapping thread. Keeps one window mapped ahead of the active one
+// and unmaps the one that was just filled.
+void Trace_writer::map_windows() {
+	uint64_t next_offset { m_window_size };
+	std::unique_lock lock { m_mutex };
+	while (true) {
+		m_condition.wait(lock, [this] { return m_stopping || !m_next_ready; });
+		if (m_stopping) {
+			return;
+		}
+
+		Window retired { m_retired };
+		m_retired = {};
+		lock.unlock();
+
+		// Everything up to the end of the window that just filled is written
+		if (retired.data) {
+			write_record_count((retired.file_offset + m_window_size - sizeof(Trace_header)) / sizeof(Trace_record));
+		}
+		unmap_window(retired);
+		Window next { map_window(next_offset) };
+		if (!next.data) {
+			LOG_ERROR("[TRACE] Out of space for the trace file");
+			std::exit(1);
+		}
+		next_offset += m_window_size;
+
+		lock.lock();
+		m_next = next;
+		m_next_ready = true;
+		m_condition.notify_one();
+	}
+}
+
+Trace_writer::Window Trace_writer::map_window(uint64_t file_offset) {
+	if (ftruncate(m_file, static_cast<off_t>(file_offset + m_window_size)) != 0) {
+		return {};
+	}
+
+	int flags { MAP_SHARED };
+#ifdef MAP_POPULATE
+	// Fault the pages in here rather than on the emulation thread
+	flags |= MAP_POPULATE;
+#endif
+	void* data { mmap(nullptr, m_window_size, PROT_READ | PROT_WRITE, flags, m_file, static_cast<off_t>(file_offset)) };
+	if (data == MAP_FAILED) {
+		return {};
+	}
+	return { static_cast<std::byte*>(data), file_offset };
+}
+
+void Trace_writer::unmap_window(Window& window) {
+	if (window.data) {
+		munmap(window.data, m_window_size);
+		window = {};
+	}
+}
+
+Trace_reader::Trace_reader(const std::string& path) {
+	int file { open(path.c_str(), O_RDONLY) };
+	if (file < 0) {
+		m_error = "could not open " + path;
+		return;
+	}
+
+	struct stat status {};
+	if (fstat(file, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(Trace_header)) {
+		m_error = path + " is too small to be a trace";
+		close(file);
+		return;
+	}
+
+	m_size = static_cast<size_t>(status.st_size);
+	void* data { mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0) };
+	close(file);
+	if (data == MAP_FAILED) {
+		m_error = "could not map " + path;
+		return;
+	}
+
+	Trace_header header {};
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != Trace_header::expected_magic
+		|| header.version != Trace_header::current_version
+		|| header.record_size != sizeof(Trace_record)) {
+		m_error = path + " is not a trace this version can read";
+		munmap(data, m_size);
+		return;
+	}
+
+	m_data = static_cast<const std::byte*>(data);
+	const auto* records { reinterpret_cast<const Trace_record*>(m_data + sizeof(Trace_header)) };
+	size_t available { (m_size - sizeof(Trace_header)) / sizeof(Trace_record) };
+	size_t count { std::min<size_t>(header.record_count, available) };
+	// A trace that was never finished goes on past its count. Every record
+	// executed has a pc or an instruction, so the zero filled rest of the
+	// last window is left out.
+	if (count < available) {
+		const Trace_record* last { std::find_if(std::make_reverse_iterator(records + available),
+			std::make_reverse_iterator(records + count),
+			[](const Trace_record& record) { return record != Trace_record {}; }).base() };
+		count = static_cast<size_t>(last - records);
+	}
+	m_records = { records, count };
+}
+
+Trace_reader::~Trace_reader() {
+	if (m_data) {
+		munmap(const_cast<std::byte*>(m_data), m_size);
+	}
+}
+
+#else
+
+Trace_writer::Trace_writer(const std::string& path) {
+	LOG_ERROR("[TRACE] Tracing is not supported on this host, not writing {}", path);
+}
+
+Trace_writer::~Trace_writer() = default;
+
+uint64_t Trace_writer::record_count() const {
+	return 0;
+}
+
+void Trace_writer::next_window() {}
+void Trace_writer::map_windows() {}
+Trace_writer::Window Trace_writer::map_window(uint64_t) { return {}; }
+void Trace_writer::unmap_window(Window&) {}
+
+Trace_reader::Trace_reader(const std::string& path) {
+	m_error = "traces are not supported on this host, cannot read " + path;
+}
+
+Trace_reader::~Trace_reader() = default;
+
+#endif
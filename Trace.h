@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+
+// One executed instruction. Records are fixed size so a trace can be indexed
+// and diffed without parsing.
+struct Trace_record {
+	enum Flags : uint8_t {
+		register_write = 1 << 0,
+		memory_read = 1 << 1,
+		memory_write = 1 << 2,
+	};
+
+	uint32_t pc {};
+	uint32_t instruction {};
+	// Value written to the destination register, loads included
+	uint32_t register_value {};
+	uint32_t memory_address {};
+	uint32_t memory_value {};
+	uint8_t destination {};
+	uint8_t flags {};
+	// Access width in bytes
+	uint8_t memory_width {};
+	uint8_t reserved {};
+
+	friend bool operator==(const Trace_record&, const Trace_record&) = default;
+};
+static_assert(sizeof(Trace_record) == 24);
+
+// Starts every trace file. Exactly one record long, so records stay aligned
+// to their size within the file. It is written when the file is opened, and
+// record_count is brought up to date each time a window fills and when the
+// writer is destroyed. A run that exits without destroying it, as the fatal
+// error paths do, leaves more records after the count, followed by the zero
+// filled rest of the last window.
+struct Trace_header {
+	std::array<char, 8> magic {};
+	uint32_t version {};
+	uint32_t record_size {};
+	uint64_t record_count {};
+
+	static constexpr std::array<char, 8> expected_magic { 'S', 'P', 'S', 'X', 'T', 'R', 'C', '\0' };
+	static constexpr uint32_t current_version { 1 };
+};
+static_assert(sizeof(Trace_header) == sizeof(Trace_record));
+
+// Streams records into a file through two mmapped windows. Records are
+// copied into the active window while a background thread maps the next one
+// ahead of time and unmaps the one before, so appending is a memcpy and a
+// compare nearly all of the time.
+class Trace_writer {
+public:
+	explicit Trace_writer(const std::string& path);
+	~Trace_writer();
+
+	Trace_writer(const Trace_writer&) = delete;
+	Trace_writer& operator=(const Trace_writer&) = delete;
+
+	bool is_open() const { return m_file >= 0; }
+
+	void append(const Trace_record& record) {
+		if (m_cursor == m_window_end) {
+			next_window();
+		}
+		std::memcpy(m_cursor, &record, sizeof(record));
+		m_cursor += sizeof(record);
+	}
+
+	uint64_t record_count() const;
+private:
+	// A multiple of both the record size and the host page size
+	static constexpr uint64_t m_window_size { sizeof(Trace_record) * 4096 * 170 };
+
+	struct Window {
+		std::byte* data {};
+		uint64_t file_offset {};
+	};
+
+	int m_file { -1 };
+	Window m_active {};
+	std::byte* m_cursor {};
+	std::byte* m_window_end {};
+
+	// Shared with the mapping thread
+	std::mutex m_mutex {};
+	std::condition_variable m_condition {};
+	Window m_next {};
+	Window m_retired {};
+	bool m_next_ready {};
+	bool m_stopping {};
+	std::thread m_thread {};
+
+	void next_window();
+	void map_windows();
+	void write_record_count(uint64_t count);
+	Window map_window(uint64_t file_offset);
+	void unmap_window(Window& window);
+};
+
+// Maps a trace file for reading. Records past the header's count are read
+// up to the last one that isn't all zero, so unfinished traces can be read.
+class Trace_reader {
+public:
+	explicit Trace_reader(const std::string& path);
+	~Trace_reader();
+
+	Trace_reader(const Trace_reader&) = delete;
+	Trace_reader& operator=(const Trace_reader&) = delete;
+
+	bool is_open() const { return m_data != nullptr; }
+	const std::string& error() const { return m_error; }
+
+	std::span<const Trace_record> records() const { return m_records; }
+private:
+	const std::byte* m_data {};
+	size_t m_size {};
+	std::span<const Trace_record> m_records {};
+	std::string m_error {};
+};
@@ -0,0 +1,80 @@
+#include "Vram.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    // Within one row, 8 pixels at a time
+    void store_pixels(uint16_t* destination, const uint16_t* source, uint32_t count, Vram::Mask mask) {
+        if (mask.set_bits == 0 && !mask.check) {
+            std::memmove(destination, source, count * sizeof(uint16_t));
+            return;
+        }
+
+        uint32_t i { 0 };
+#if defined(__SSE2__)
+        const __m128i set_bits { _mm_set1_epi16(static_cast<short>(mask.set_bits)) };
+        for (; i + 8 <= count; i += 8) {
+            __m128i pixels { _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)), set_bits) };
+            if (mask.check) {
+                __m128i old_pixels { _mm_loadu_si128(reinterpret_cast<const __m128i*>(destination + i)) };
+                // All ones in the lanes whose mask bit is set
+                __m128i keep { _mm_srai_epi16(old_pixels, 15) };
+                pixels = _mm_or_si128(_mm_and_si128(keep, old_pixels), _mm_andnot_si128(keep, pixels));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), pixels);
+        }
+#endif
+        for (; i < count; i++) {
+            if (mask.check && (destination[i] & 0x8000)) {
+                continue;
+            }
+            destination[i] = source[i] | mask.set_bits;
+        }
+    }
+}
+
+void Vram::write_run(uint32_t x, uint32_t y, std::span<const uint16_t> pixels, Mask mask) {
+    x &= width - 1;
+    auto count { static_cast<uint32_t>(pixels.size()) };
+    uint32_t first { std::min(count, width - x) };
+    store_pixels(row(y) + x, pixels.data(), first, mask);
+    if (first < count) {
+        store_pixels(row(y), pixels.data() + first, count - first, mask);
+    }
+}
+
+void Vram::read_run(uint32_t x, uint32_t y, std::span<uint16_t> pixels) const {
+    x &= width - 1;
+    auto count { static_cast<uint32_t>(pixels.size()) };
+    uint32_t first { std::min(count, width - x) };
+    std::memcpy(pixels.data(), row(y) + x, first * sizeof(uint16_t));
+    if (first < count) {
+        std::memcpy(pixels.data() + first, row(y), (count - first) * sizeof(uint16_t));
+    }
+}
+
+void Vram::fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t pixel) {
+    x &= Vram::width - 1;
+    uint32_t first { std::min(width, Vram::width - x) };
+    for (uint32_t i { 0 }; i < height; i++) {
+        uint16_t* pixels { row(y + i) };
+        std::fill_n(pixels + x, first, pixel);
+        std::fill_n(pixels, width - first, pixel);
+    }
+}
+
+void Vram::copy(uint32_t source_x, uint32_t source_y, uint32_t x, uint32_t y,
+    uint32_t width, uint32_t height, Mask mask) {
+    std::array<uint16_t, Vram::width> line {};
+    std::span<uint16_t> pixels { line.data(), width };
+    for (uint32_t i { 0 }; i < height; i++) {
+        read_run(source_x, source_y + i, pixels);
+        write_run(x, y + i, pixels, mask);
+    }
+}
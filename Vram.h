@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// The GPU's 1MB of video memory, laid out as 1024x512 16 bit pixels.
+// Coordinates wrap around at the edges like they do on the console.
+class Vram {
+public:
+    static constexpr uint32_t width { 1024 };
+    static constexpr uint32_t height { 512 };
+
+    // How transfers treat the mask bit, bit 15, set by GP0 E6
+    struct Mask {
+        // ORed into every pixel written
+        uint16_t set_bits {};
+        // Pixels that already have it set are left alone
+        bool check {};
+    };
+
+    uint16_t get(uint32_t x, uint32_t y) const { return m_pixels[index(x, y)]; }
+    void set(uint32_t x, uint32_t y, uint16_t pixel) { m_pixels[index(x, y)] = pixel; }
+
+    // Rows are contiguous, so x may run to the end of the row from here
+    uint16_t* row(uint32_t y) { return m_pixels.data() + (y & (height - 1)) * width; }
+    const uint16_t* row(uint32_t y) const { return m_pixels.data() + (y & (height - 1)) * width; }
+    const uint16_t* data() const { return m_pixels.data(); }
+
+    static constexpr uint32_t index(uint32_t x, uint32_t y) {
+        return (y & (height - 1)) * width + (x & (width - 1));
+    }
+
+    // Pixels along a row from (x, y), wrapping at the right edge. Runs are
+    // at most a row long.
+    void write_run(uint32_t x, uint32_t y, std::span<const uint16_t> pixels, Mask mask);
+    void read_run(uint32_t x, uint32_t y, std::span<uint16_t> pixels) const;
+
+    // Rectangles wrap at the right and bottom edges. Fills ignore the mask.
+    void fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t pixel);
+    // Row by row from the top, each row read in full before it is written
+    void copy(uint32_t source_x, uint32_t source_y, uint32_t x, uint32_t y,
+        uint32_t width, uint32_t height, Mask mask);
+private:
+    // Vector code may touch a few pixels past the last one, as a whole
+    // register of 16 pixels or a 32 bit gather of the last pixel
+    static constexpr uint32_t padding { 16 };
+
+    std::vector<uint16_t> m_pixels = std::vector<uint16_t>(width * height + padding);
+};
@@ -0,0 +1,235 @@
+// soulpsx-gpu-compare: checks that batching and threading change no pixel.
+//
+//   soulpsx-gpu-compare [commands] [seed]
+//
+// Sends the same random stream of GP0 packets, GP1 commands and status and
+// GPUREAD reads to several Gpus. The reference runs inline and waits for
+// drawing before every GP1 command, so nothing is batched across one. The
+// others run inline, on the GPU thread and with render threads, and must
+// end with the same VRAM and read back the same words. Packets are split
+// into DMA blocks and single GP0 writes at random. Exits 1 on a difference.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Gpu.h"
+#include "Logger.h"
+
+namespace {
+	constexpr uint32_t gp0_address { 0x1f801810 };
+	constexpr uint32_t gp1_address { 0x1f801814 };
+
+	struct Operation {
+		enum class Kind {
+			gp0,
+			gp1,
+			read_status,
+			read_data,
+		};
+		Kind kind {};
+		uint32_t value {};
+	};
+
+	struct Result {
+		uint64_t vram_hash {};
+		uint64_t read_hash {};
+	};
+
+	uint64_t hash(uint64_t seed, uint32_t value) {
+		return (seed ^ value) * 1099511628211ull;
+	}
+
+	std::vector<Operation> random_operations(std::mt19937& engine, uint32_t count) {
+		auto random = [&] { return static_cast<uint32_t>(engine()); };
+		std::vector<Operation> operations {};
+		auto gp0 = [&](uint32_t word) { operations.push_back({ Operation::Kind::gp0, word }); };
+		auto gp1 = [&](uint32_t word) { operations.push_back({ Operation::Kind::gp1, word }); };
+		auto position = [&] { return random() & 0x01ff03ff; };
+
+		// Drawing area over the whole of VRAM
+		gp0(0xe3000000);
+		gp0(0xe4000000 | (511 << 10) | 1023);
+
+		for (uint32_t i { 0 }; i < count; i++) {
+			uint32_t kind { random() % 100 };
+			if (kind < 50) {
+				// Polygons of every kind, with random texpage and CLUT
+				uint32_t opcode { 0x20 | (random() & 0x1f) };
+				bool shaded { (opcode & 0x10) != 0 };
+				bool textured { (opcode & 0x04) != 0 };
+				uint32_t vertices { (opcode & 0x08) ? 4u : 3u };
+				gp0((opcode << 24) | (random() & 0xffffff));
+				for (uint32_t vertex { 0 }; vertex < vertices; vertex++) {
+					if (vertex > 0 && shaded) {
+						gp0(random() & 0xffffff);
+					}
+					gp0(((random() % 300) << 16) | (random() % 500));
+					if (textured) {
+						uint32_t high { vertex == 0 ? random() % 0x7fff : vertex == 1 ? random() & 0x1ff : 0 };
+						gp0((high << 16) | (random() & 0xffff));
+					}
+				}
+			} else if (kind < 56) {
+				// Lines and polylines
+				uint32_t opcode { 0x40 | (random() & 0x1f) };
+				bool polyline { (opcode & 0x08) != 0 };
+				uint32_t vertices { 2 + (polyline ? random() % 5 : 0) };
+				gp0((opcode << 24) | (random() & 0xffffff));
+				for (uint32_t vertex { 0 }; vertex < vertices; vertex++) {
+					if (vertex > 0 && (opcode & 0x10)) {
+						gp0(random() & 0xffffff);
+					}
+					gp0(position());
+				}
+				if (polyline) {
+					gp0(0x55555555);
+				}
+			} else if (kind < 60) {
+				// Rectangles, with a size word for the variable sized ones
+				uint32_t opcode { 0x60 | (random() & 0x1f) };
+				uint32_t length { 2 + ((opcode & 0x04) ? 1u : 0u) + (((opcode >> 3) & 3) == 0 ? 1u : 0u) };
+				gp0((opcode << 24) | (random() & 0xffffff));
+				for (uint32_t word { 1 }; word < length; word++) {
+					gp0(random() & 0x00ff00ff);
+				}
+			} else if (kind < 63) {
+				gp0(0x02000000 | (random() & 0xffffff));
+				gp0(position());
+				gp0(random() & 0x003f003f);
+			} else if (kind < 66) {
+				gp0(0x80000000);
+				gp0(position());
+				gp0(position());
+				gp0(random() & 0x003f007f);
+			} else if (kind < 69) {
+				uint32_t width { random() % 40 + 1 };
+				uint32_t height { random() % 20 + 1 };
+				gp0(0xa0000000);
+				gp0(position());
+				gp0((height << 16) | width);
+				for (uint32_t word { 0 }; word < (width * height + 1) / 2; word++) {
+					gp0(random());
+				}
+			} else if (kind < 71) {
+				gp0(0xc0000000);
+				gp0(position());
+				gp0(0x00040004);
+				for (uint32_t word { 0 }; word < 8; word++) {
+					operations.push_back({ Operation::Kind::read_data });
+				}
+			} else if (kind < 78) {
+				gp0(0xe1000000 | (random() & 0x7ff));
+			} else if (kind < 81) {
+				gp0(0xe6000000 | (random() & 3));
+			} else if (kind < 84) {
+				gp0(0xe2000000 | (random() & 0xfffff));
+			} else if (kind < 86) {
+				gp0(0xe5000000 | (random() & 0x3fffff));
+			} else if (kind < 88) {
+				gp0(random() % 2 ? 0x00000000 : 0x1f000000);
+			} else if (kind < 97) {
+				operations.push_back({ Operation::Kind::read_status });
+			} else if (kind < 98) {
+				// A reset keeps VRAM but not the drawing area
+				gp1(0x00000000);
+				gp0(0xe3000000);
+				gp0(0xe4000000 | (511 << 10) | 1023);
+			} else {
+				gp1(0x01000000);
+			}
+		}
+		return operations;
+	}
+
+	Result run(const std::vector<Operation>& operations, uint32_t seed, bool threaded, uint32_t render_threads,
+		bool sync_before_gp1) {
+		Gpu gpu {};
+		gpu.set_threaded(threaded);
+		gpu.set_render_threads(render_threads);
+
+		Result result {};
+		std::mt19937 split { seed };
+		std::vector<uint32_t> words {};
+		auto send = [&] {
+			for (size_t i { 0 }; i < words.size();) {
+				size_t length { std::min<size_t>(words.size() - i, split() % 40 + 1) };
+				if (split() % 3 == 0) {
+					for (size_t j { 0 }; j < length; j++) {
+						gpu.write(gp0_address, words[i + j]);
+					}
+				} else {
+					gpu.receive_commands({ words.data() + i, length });
+				}
+				i += length;
+			}
+			words.clear();
+		};
+
+		for (const Operation& operation : operations) {
+			if (operation.kind == Operation::Kind::gp0) {
+				words.push_back(operation.value);
+				continue;
+			}
+			send();
+			switch (operation.kind) {
+				case Operation::Kind::gp1:
+					if (sync_before_gp1) {
+						gpu.sync();
+					}
+					gpu.write(gp1_address, operation.value);
+					break;
+				case Operation::Kind::read_status:
+					result.read_hash = hash(result.read_hash, gpu.read(gp1_address));
+					break;
+				default:
+					result.read_hash = hash(result.read_hash, gpu.read(gp0_address));
+					break;
+			}
+		}
+		send();
+
+		const Vram& vram { gpu.get_vram() };
+		result.vram_hash = 14695981039346656037ull;
+		for (uint32_t i { 0 }; i < Vram::width * Vram::height; i++) {
+			result.vram_hash = hash(result.vram_hash, vram.data()[i]);
+		}
+		return result;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t count { argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 40'000 };
+	uint32_t seed { argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 1 };
+	Logger::set_min_level(Logger::Level::error);
+
+	std::mt19937 random { seed };
+	std::vector<Operation> operations { random_operations(random, count) };
+
+	Result reference { run(operations, seed, false, 1, true) };
+	struct Mode {
+		std::string name {};
+		bool threaded {};
+		uint32_t render_threads {};
+	};
+	const std::vector<Mode> modes {
+		{ "inline", false, 1 },
+		{ "gpu thread", true, 1 },
+		{ "render threads", false, 3 },
+		{ "gpu thread and render threads", true, 3 },
+	};
+
+	bool same { true };
+	for (const Mode& mode : modes) {
+		Result result { run(operations, seed, mode.threaded, mode.render_threads, false) };
+		bool matches { result.vram_hash == reference.vram_hash && result.read_hash == reference.read_hash };
+		std::cout << mode.name << ": " << (matches ? "same" : "DIFFERENT") << std::hex
+			<< " (vram " << result.vram_hash << ", reads " << result.read_hash << ")" << std::dec << '\n';
+		same = same && matches;
+	}
+	return same ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+// soulpsx-headless: runs the emulator without a window, for machines with
+// no display such as CI.
+//
+//   soulpsx-headless [--frames N] [--ppm DIR] [--y4m FILE] [--recompiler] [--pal]
+//                    [--gpu-thread] [--render-threads N] [--stats]
+//
+// Runs unthrottled for N frames, 600 by default, and captures the display
+// after every vblank, as numbered PPM images in DIR or as a Y4M video.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "Frame_writer.h"
+#include "Logger.h"
+#include "System.h"
+
+namespace {
+	int usage() {
+		std::cerr << "usage: soulpsx-headless [--frames N] [--ppm DIR] [--y4m FILE] [--recompiler] [--pal]\n";
+		std::cerr << "                        [--gpu-thread] [--render-threads N] [--stats]\n";
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	auto system { std::make_shared<System>() };
+	system->set_speed_mode(Frame_pacer::Mode::unthrottled);
+
+	uint64_t frames { 600 };
+	std::optional<Frame_writer::Format> format {};
+	std::string path {};
+	bool print_stats { false };
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string_view argument { argv[i] };
+			bool has_value { i + 1 < argc };
+			if (argument == "--frames" && has_value) {
+				frames = std::stoull(argv[++i]);
+			} else if (argument == "--ppm" && has_value) {
+				format = Frame_writer::Format::ppm;
+				path = argv[++i];
+			} else if (argument == "--y4m" && has_value) {
+				format = Frame_writer::Format::y4m;
+				path = argv[++i];
+			} else if (argument == "--recompiler") {
+				system->set_cpu_backend(Cpu::Backend::recompiler);
+			} else if (argument == "--pal") {
+				system->set_video_standard(System::Video_standard::pal);
+			} else if (argument == "--gpu-thread") {
+				system->set_gpu_threaded(true);
+			} else if (argument == "--render-threads" && has_value) {
+				system->set_gpu_render_threads(static_cast<uint32_t>(std::stoul(argv[++i])));
+			} else if (argument == "--stats") {
+				print_stats = true;
+			} else {
+				return usage();
+			}
+		}
+	} catch (const std::exception&) {
+		return usage();
+	}
+
+	std::unique_ptr<Frame_writer> writer {};
+	if (format) {
+		bool pal { system->get_video_standard() == System::Video_standard::pal };
+		writer = std::make_unique<Frame_writer>(*format, path, pal ? 50 : 60'000, pal ? 1 : 1001);
+	}
+
+	auto stats_printed { std::chrono::steady_clock::now() };
+	for (uint64_t frame { 0 }; frame < frames; frame++) {
+		system->run_frame();
+		if (writer) {
+			writer->capture(system->get_vram(), system->get_display());
+		}
+
+		// Once a second of host time, which is many frames unthrottled
+		auto now { std::chrono::steady_clock::now() };
+		if (print_stats && now - stats_printed >= std::chrono::seconds { 1 }) {
+			stats_printed = now;
+			std::cout << system->get_stats().to_string() << std::endl;
+		}
+	}
+
+	bool failed { false };
+	if (writer) {
+		// Frames still queued can fail to write too, so wait for them
+		writer->finish();
+		failed = writer->failed();
+		Frame_writer::Stats stats { writer->get_stats() };
+		writer.reset();
+		if (print_stats) {
+			std::cout << "captured=" << stats.captured << " stalls=" << stats.stalls << std::endl;
+		}
+	}
+	Logger::flush();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+// soulpsx-logger-benchmark: what a log call below the level floor costs.
+//
+//   soulpsx-logger-benchmark [calls]
+//
+// Times LOG_INFO with the runtime floor at warning, which release builds
+// already compile out, against building the message with a stringstream
+// before Logger::log checks the level, the way call sites used to. Nothing
+// is printed by the calls themselves.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "Logger.h"
+
+namespace {
+	template<typename Function>
+	double nanoseconds_per_call(uint64_t calls, Function&& function) {
+		auto start { std::chrono::steady_clock::now() };
+		for (uint64_t i = 0; i < calls; i++) {
+			function(i);
+		}
+		std::chrono::duration<double, std::nano> elapsed { std::chrono::steady_clock::now() - start };
+		return elapsed.count() / static_cast<double>(calls);
+	}
+
+	// Counts the arguments evaluated, which should stay 0 for filtered calls
+	uint64_t evaluated {};
+	uint32_t expensive_argument(uint64_t i) {
+		evaluated++;
+		return static_cast<uint32_t>(i * 2654435761u);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	uint64_t calls { argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50'000'000 };
+	Logger::set_min_level(Logger::Level::warning);
+
+	// Read through a volatile so the address is not known at compile time
+	volatile uint32_t base_address { 0x1f801070 };
+
+	double filtered { nanoseconds_per_call(calls, [&](uint64_t i) {
+		LOG_INFO("[BUS] IRQ Control: reading 0x{:x}", base_address + static_cast<uint32_t>(i));
+	}) };
+	double unevaluated { nanoseconds_per_call(calls, [&](uint64_t i) {
+		LOG_DEBUG("[BUS] IRQ Control: reading 0x{:x}", expensive_argument(i));
+	}) };
+	// Much slower, so a tenth of the calls is enough
+	double stringstream { nanoseconds_per_call(calls / 10, [&](uint64_t i) {
+		std::stringstream message {};
+		message << "[BUS] IRQ Control: reading 0x" << std::hex << base_address + static_cast<uint32_t>(i);
+		Logger::log(Logger::Level::info, message.str());
+	}) };
+
+	std::cout << "compile time floor:      " << Logger::level_as_string(Logger::compile_time_min_level) << '\n';
+	std::cout << "filtered LOG_INFO:       " << filtered << " ns per call\n";
+	std::cout << "filtered LOG_DEBUG:      " << unevaluated << " ns per call, "
+		<< evaluated << " arguments evaluated\n";
+	std::cout << "stringstream, then log:  " << stringstream << " ns per call\n";
+	return evaluated == 0 ? 0 : 1;
+}
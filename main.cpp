@@ -1,3 +1,6 @@
+#include <chrono>
+#include <iostream>
+#include <string>
 #include <thread>
 
 #include "Bios.h"
@@ -12,15 +15,40 @@
 #include "Logger.h"
 #include "System.h"
 
-int main() {
+int main(int argc, char* argv[]) {
 	auto system { std::make_shared<System>() };
+	// Prints System::get_stats() to stdout once a second of host time,
+	// however fast the emulator runs
+	bool print_stats { false };
+	for (int i = 1; i < argc; i++) {
+		std::string_view argument { argv[i] };
+		if (argument == "--recompiler") {
+			system->set_cpu_backend(Cpu::Backend::recompiler);
+		} else if (argument == "--gpu-thread") {
+			system->set_gpu_threaded(true);
+		} else if (argument == "--render-threads" && i + 1 < argc) {
+			system->set_gpu_render_threads(static_cast<uint32_t>(std::stoul(argv[++i])));
+		} else if (argument == "--unthrottled") {
+			system->set_speed_mode(Frame_pacer::Mode::unthrottled);
+		} else if (argument == "--speed" && i + 1 < argc) {
+			system->set_speed_mode(Frame_pacer::Mode::multiplier, std::stod(argv[++i]));
+		} else if (argument == "--pal") {
+			system->set_video_standard(System::Video_standard::pal);
+		} else if (argument == "--stats") {
+			print_stats = true;
+		} else if (argument == "--trace" && i + 1 < argc) {
+			if (!system->start_trace(argv[++i])) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
 	// Gui gui { system, 1280, 720 };
 	// if (gui.init_failed()) {
 	// 	return EXIT_FAILURE;
 	// }
 
+	auto stats_printed { std::chrono::steady_clock::now() };
 	bool quit = false;
-	bool pause = false;
 	while (!quit) {
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
@@ -30,21 +58,24 @@ int main() {
 				quit = true;
 			} else if (event.type == SDL_EVENT_KEY_DOWN) {
 				if (event.key.key == SDLK_P) {
-					pause = !pause;
+					system->pause(!system->paused());
 				}
 				if (event.key.key == SDLK_RIGHT) {
-					if (pause) {
-						system->pause(false);
-						system->run();
-						system->pause(true);
+					if (system->paused()) {
+						system->run_for(1);
 					}
 				}
 			}
 		}
 
-		// system->pause(pause);
-		system->run();
-		// if (!pause) {
+		// SDL is only polled once per emulated frame
+		system->run_frame();
+		auto now { std::chrono::steady_clock::now() };
+		if (print_stats && !system->paused() && now - stats_printed >= std::chrono::seconds { 1 }) {
+			stats_printed = now;
+			std::cout << system->get_stats().to_string() << std::endl;
+		}
+		// if (!system->paused()) {
 		// 	gui.render();
 		// }
 	}
@@ -0,0 +1,539 @@
+// soulpsx-rasterizer-benchmark: kernels per variant against runtime branches.
+//
+//   soulpsx-rasterizer-benchmark [triangles] [repeats]
+//
+// Draws the same small triangles, one primitive flavour at a time, with the
+// Rasterizer's kernels and with the kernels as they were before every
+// variant got its own, which test the flags for each pixel. Both run on
+// each backend the host supports and must draw the same pixels. Times are
+// the best of the repeats and include the triangle setup. Exits 1 if the
+// pixels differ.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Logger.h"
+#include "Rasterizer.h"
+#include "Texture_cache.h"
+#include "Vram.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SOULPSX_RASTERIZER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+	constexpr uint32_t fraction_bits { Rasterizer::fraction_bits };
+
+	constexpr std::array<std::array<int32_t, 4>, 4> dither_table {{
+		{ -4, 0, -3, 1 },
+		{ 2, -2, 3, -1 },
+		{ -3, 1, -4, 0 },
+		{ 3, -1, 2, -2 },
+	}};
+
+	uint32_t blend(uint32_t back, uint32_t front, uint32_t mode) {
+		switch (mode) {
+			case 0: return (back + front) >> 1;
+			case 1: return std::min(back + front, 31u);
+			case 2: return back > front ? back - front : 0;
+			default: return std::min(back + (front >> 2), 31u);
+		}
+	}
+
+	// The flags of a setup's variant, read per pixel
+	struct Flags {
+		bool raw_texture {};
+		bool semi_transparent {};
+		bool textured {};
+		uint32_t blend_mode {};
+		bool dither {};
+		bool check_mask {};
+
+		explicit Flags(uint32_t variant)
+			: raw_texture { (variant & Rasterizer::variant_raw_texture) != 0 },
+			semi_transparent { (variant & Rasterizer::variant_semi_transparent) != 0 },
+			textured { (variant & Rasterizer::variant_textured) != 0 },
+			blend_mode { (variant >> Rasterizer::variant_blend_shift) & 3 },
+			dither { (variant & Rasterizer::variant_dither) != 0 },
+			check_mask { (variant & Rasterizer::variant_check_mask) != 0 } {
+		}
+	};
+
+	// One scalar and one AVX2 kernel for every variant, branching on the
+	// flags inside the pixel loop
+	class Runtime_rasterizer {
+	public:
+		explicit Runtime_rasterizer(Vram& vram) : m_vram { vram } {}
+
+		void draw_scalar(const Rasterizer::Setup& setup);
+		void draw_avx2(const Rasterizer::Setup& setup);
+	private:
+		Vram& m_vram;
+
+		void shade_pixel(const Rasterizer::Setup& setup, int32_t x, int32_t y,
+			const std::array<uint32_t, Rasterizer::attribute_count>& attributes);
+		uint16_t fetch_texel(const Rasterizer::Setup& setup, uint32_t u, uint32_t v) const;
+	};
+
+	void Runtime_rasterizer::draw_scalar(const Rasterizer::Setup& setup) {
+		for (int32_t y { setup.min_y }; y <= setup.max_y; y++) {
+			int32_t row { y - setup.min_y };
+			std::array<int32_t, 3> edge {};
+			for (uint32_t i { 0 }; i < 3; i++) {
+				edge[i] = setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i];
+			}
+			std::array<uint32_t, Rasterizer::attribute_count> attributes {};
+			for (uint32_t i { 0 }; i < Rasterizer::attribute_count; i++) {
+				attributes[i] = setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row);
+			}
+
+			for (int32_t x { setup.min_x }; x <= setup.max_x; x++) {
+				if ((edge[0] | edge[1] | edge[2]) >= 0) {
+					shade_pixel(setup, x, y, attributes);
+				}
+				for (uint32_t i { 0 }; i < 3; i++) {
+					edge[i] += setup.edge_dx[i];
+				}
+				for (uint32_t i { 0 }; i < Rasterizer::attribute_count; i++) {
+					attributes[i] += setup.attribute_dx[i];
+				}
+			}
+		}
+	}
+
+	void Runtime_rasterizer::shade_pixel(const Rasterizer::Setup& setup, int32_t x, int32_t y,
+		const std::array<uint32_t, Rasterizer::attribute_count>& attributes) {
+		Flags flags { setup.variant };
+		uint16_t& pixel { m_vram.row(static_cast<uint32_t>(y))[x] };
+		if (flags.check_mask && (pixel & 0x8000)) {
+			return;
+		}
+
+		std::array<uint32_t, 3> color {};
+		for (uint32_t i { 0 }; i < 3; i++) {
+			color[i] = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[i]) >> fraction_bits, 0, 255));
+		}
+
+		uint16_t texel {};
+		if (flags.textured) {
+			auto u { static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[Rasterizer::tex_u]) >> fraction_bits, 0, 255)) };
+			auto v { static_cast<uint32_t>(std::clamp(static_cast<int32_t>(attributes[Rasterizer::tex_v]) >> fraction_bits, 0, 255)) };
+			texel = fetch_texel(setup, u, v);
+			if (texel == 0) {
+				return;
+			}
+		}
+
+		std::array<uint32_t, 3> result {};
+		for (uint32_t i { 0 }; i < 3; i++) {
+			if (flags.raw_texture) {
+				result[i] = (texel >> (i * 5)) & 0x1f;
+				continue;
+			}
+			int32_t value { static_cast<int32_t>(flags.textured ? (((texel >> (i * 5)) & 0x1f) * color[i]) >> 4 : color[i]) };
+			if (flags.dither) {
+				value += dither_table[y & 3][x & 3];
+			}
+			result[i] = static_cast<uint32_t>(std::clamp(value, 0, 255)) >> 3;
+		}
+
+		if (flags.semi_transparent && (!flags.textured || (texel & 0x8000))) {
+			for (uint32_t i { 0 }; i < 3; i++) {
+				result[i] = blend((pixel >> (i * 5)) & 0x1f, result[i], flags.blend_mode);
+			}
+		}
+
+		pixel = static_cast<uint16_t>(result[0] | (result[1] << 5) | (result[2] << 10) | (texel & 0x8000) | setup.mask_bit);
+	}
+
+	uint16_t Runtime_rasterizer::fetch_texel(const Rasterizer::Setup& setup, uint32_t u, uint32_t v) const {
+		u = (u & setup.window_and_u) | setup.window_or_u;
+		v = (v & setup.window_and_v) | setup.window_or_v;
+		if (setup.texels) {
+			return setup.texels[v * 256 + u];
+		}
+		uint32_t y { setup.page_y + v };
+
+		switch (setup.texture_depth) {
+			case 0: {
+				uint16_t indices { m_vram.get(setup.page_x + (u >> 2), y) };
+				uint32_t index { (indices >> ((u & 3) * 4)) & 0xfu };
+				return m_vram.get(setup.clut_x + index, setup.clut_y);
+			}
+			case 1: {
+				uint16_t indices { m_vram.get(setup.page_x + (u >> 1), y) };
+				uint32_t index { (indices >> ((u & 1) * 8)) & 0xffu };
+				return m_vram.get(setup.clut_x + index, setup.clut_y);
+			}
+			default: {
+				return m_vram.get(setup.page_x + u, y);
+			}
+		}
+	}
+
+#ifdef SOULPSX_RASTERIZER_AVX2
+	__attribute__((target("avx2")))
+	__m256i gather_pixels(const uint16_t* base, __m256i indices) {
+		return _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(base), indices, 2),
+			_mm256_set1_epi32(0xffff));
+	}
+
+	__attribute__((target("avx2")))
+	__m256i shift_right(__m256i value, uint32_t count) {
+		return _mm256_srl_epi32(value, _mm_cvtsi32_si128(static_cast<int>(count)));
+	}
+
+	__attribute__((target("avx2")))
+	__m256i to_byte_range(__m256i fixed_point) {
+		__m256i value { _mm256_sra_epi32(fixed_point, _mm_cvtsi32_si128(static_cast<int>(fraction_bits))) };
+		return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+	}
+
+	__attribute__((target("avx2")))
+	__m256i blend_lanes(__m256i back, __m256i front, uint32_t mode) {
+		__m256i max_channel { _mm256_set1_epi32(31) };
+		switch (mode) {
+			case 0: return _mm256_srli_epi32(_mm256_add_epi32(back, front), 1);
+			case 1: return _mm256_min_epi32(_mm256_add_epi32(back, front), max_channel);
+			case 2: return _mm256_max_epi32(_mm256_sub_epi32(back, front), _mm256_setzero_si256());
+			default: return _mm256_min_epi32(_mm256_add_epi32(back, _mm256_srli_epi32(front, 2)), max_channel);
+		}
+	}
+
+	__attribute__((target("avx2")))
+	void Runtime_rasterizer::draw_avx2(const Rasterizer::Setup& setup) {
+		constexpr uint32_t attribute_count { Rasterizer::attribute_count };
+		Flags flags { setup.variant };
+		const __m256i lane { _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7) };
+		const __m256i zero { _mm256_setzero_si256() };
+		const __m256i channel_mask { _mm256_set1_epi32(0x1f) };
+		const __m256i pixel_mask { _mm256_set1_epi32(0x8000) };
+		const uint16_t* vram { m_vram.data() };
+
+		__m256i edge_step[3] {};
+		for (uint32_t i { 0 }; i < 3; i++) {
+			edge_step[i] = _mm256_set1_epi32(setup.edge_dx[i] * 8);
+		}
+		__m256i attribute_step[attribute_count] {};
+		for (uint32_t i { 0 }; i < attribute_count; i++) {
+			attribute_step[i] = _mm256_set1_epi32(static_cast<int>(setup.attribute_dx[i] * 8));
+		}
+
+		for (int32_t y { setup.min_y }; y <= setup.max_y; y++) {
+			int32_t row { y - setup.min_y };
+			uint16_t* pixels { m_vram.row(static_cast<uint32_t>(y)) };
+
+			__m256i edge[3] {};
+			for (uint32_t i { 0 }; i < 3; i++) {
+				int32_t start { setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i] };
+				edge[i] = _mm256_add_epi32(_mm256_set1_epi32(start), _mm256_mullo_epi32(lane, _mm256_set1_epi32(setup.edge_dx[i])));
+			}
+			__m256i attributes[attribute_count] {};
+			for (uint32_t i { 0 }; i < attribute_count; i++) {
+				uint32_t start { setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row) };
+				attributes[i] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(start)),
+					_mm256_mullo_epi32(lane, _mm256_set1_epi32(static_cast<int>(setup.attribute_dx[i]))));
+			}
+
+			std::array<int32_t, 12> dither_row {};
+			for (uint32_t i { 0 }; i < dither_row.size(); i++) {
+				dither_row[i] = dither_table[y & 3][i & 3];
+			}
+
+			int32_t x { setup.min_x };
+			for (; x + 7 <= setup.max_x; x += 8) {
+				__m256i outside { _mm256_or_si256(_mm256_or_si256(edge[0], edge[1]), edge[2]) };
+				__m256i covered { _mm256_xor_si256(_mm256_cmpgt_epi32(zero, outside), _mm256_set1_epi32(-1)) };
+
+				if (!_mm256_testz_si256(covered, covered)) {
+					__m128i packed_destination { _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x)) };
+					__m256i destination { _mm256_cvtepu16_epi32(packed_destination) };
+					__m256i write { covered };
+					if (flags.check_mask) {
+						write = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(destination, pixel_mask), pixel_mask), write);
+					}
+
+					__m256i texel { zero };
+					if (flags.textured) {
+						__m256i u { to_byte_range(attributes[Rasterizer::tex_u]) };
+						__m256i v { to_byte_range(attributes[Rasterizer::tex_v]) };
+						u = _mm256_or_si256(_mm256_and_si256(u, _mm256_set1_epi32(static_cast<int>(setup.window_and_u))),
+							_mm256_set1_epi32(static_cast<int>(setup.window_or_u)));
+						v = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi32(static_cast<int>(setup.window_and_v))),
+							_mm256_set1_epi32(static_cast<int>(setup.window_or_v)));
+
+						__m256i texel_y { _mm256_and_si256(_mm256_add_epi32(v, _mm256_set1_epi32(static_cast<int>(setup.page_y))),
+							_mm256_set1_epi32(Vram::height - 1)) };
+						__m256i row_start { _mm256_slli_epi32(texel_y, 10) };
+						__m256i page_x { _mm256_set1_epi32(static_cast<int>(setup.page_x)) };
+						__m256i column_mask { _mm256_set1_epi32(Vram::width - 1) };
+
+						if (setup.texels) {
+							texel = gather_pixels(setup.texels, _mm256_add_epi32(_mm256_slli_epi32(v, 8), u));
+						} else if (setup.texture_depth == 2) {
+							__m256i column { _mm256_and_si256(_mm256_add_epi32(page_x, u), column_mask) };
+							texel = gather_pixels(vram, _mm256_add_epi32(row_start, column));
+						} else {
+							bool four_bit { setup.texture_depth == 0 };
+							__m256i column { _mm256_and_si256(_mm256_add_epi32(page_x,
+								four_bit ? _mm256_srli_epi32(u, 2) : _mm256_srli_epi32(u, 1)), column_mask) };
+							__m256i indices { gather_pixels(vram, _mm256_add_epi32(row_start, column)) };
+							__m256i shift { four_bit
+								? _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(3)), 2)
+								: _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(1)), 3) };
+							__m256i index { _mm256_and_si256(_mm256_srlv_epi32(indices, shift), _mm256_set1_epi32(four_bit ? 0xf : 0xff)) };
+							__m256i clut_column { _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(setup.clut_x)), index), column_mask) };
+							__m256i clut_row { _mm256_set1_epi32(static_cast<int>(setup.clut_y << 10)) };
+							texel = gather_pixels(vram, _mm256_add_epi32(clut_row, clut_column));
+						}
+						write = _mm256_andnot_si256(_mm256_cmpeq_epi32(texel, zero), write);
+					}
+
+					if (!_mm256_testz_si256(write, write)) {
+						__m256i dither { flags.dither
+							? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither_row.data() + (x & 3)))
+							: zero };
+						__m256i result[3] {};
+						for (uint32_t i { 0 }; i < 3; i++) {
+							if (flags.raw_texture) {
+								result[i] = _mm256_and_si256(shift_right(texel, i * 5), channel_mask);
+								continue;
+							}
+							__m256i value { to_byte_range(attributes[i]) };
+							if (flags.textured) {
+								__m256i texel_channel { _mm256_and_si256(shift_right(texel, i * 5), channel_mask) };
+								value = _mm256_srli_epi32(_mm256_mullo_epi32(texel_channel, value), 4);
+							}
+							value = _mm256_add_epi32(value, dither);
+							value = _mm256_min_epi32(_mm256_max_epi32(value, zero), _mm256_set1_epi32(255));
+							result[i] = _mm256_srli_epi32(value, 3);
+						}
+
+						if (flags.semi_transparent) {
+							__m256i blended_lanes { flags.textured
+								? _mm256_cmpeq_epi32(_mm256_and_si256(texel, pixel_mask), pixel_mask)
+								: _mm256_set1_epi32(-1) };
+							for (uint32_t i { 0 }; i < 3; i++) {
+								__m256i back { _mm256_and_si256(shift_right(destination, i * 5), channel_mask) };
+								result[i] = _mm256_blendv_epi8(result[i], blend_lanes(back, result[i], flags.blend_mode), blended_lanes);
+							}
+						}
+
+						__m256i color { _mm256_or_si256(result[0], _mm256_or_si256(_mm256_slli_epi32(result[1], 5), _mm256_slli_epi32(result[2], 10))) };
+						color = _mm256_or_si256(color, _mm256_and_si256(texel, pixel_mask));
+						color = _mm256_or_si256(color, _mm256_set1_epi32(setup.mask_bit));
+
+						__m256i merged { _mm256_blendv_epi8(destination, color, write) };
+						__m128i packed { _mm_packus_epi32(_mm256_castsi256_si128(merged), _mm256_extracti128_si256(merged, 1)) };
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x), packed);
+					}
+				}
+
+				for (uint32_t i { 0 }; i < 3; i++) {
+					edge[i] = _mm256_add_epi32(edge[i], edge_step[i]);
+				}
+				for (uint32_t i { 0 }; i < attribute_count; i++) {
+					attributes[i] = _mm256_add_epi32(attributes[i], attribute_step[i]);
+				}
+			}
+
+			int32_t offset { x - setup.min_x };
+			std::array<int32_t, 3> tail_edge {};
+			for (uint32_t i { 0 }; i < 3; i++) {
+				tail_edge[i] = setup.edge[i] + setup.edge_dy[i] * row - setup.edge_bias[i] + setup.edge_dx[i] * offset;
+			}
+			std::array<uint32_t, attribute_count> tail_attributes {};
+			for (uint32_t i { 0 }; i < attribute_count; i++) {
+				tail_attributes[i] = setup.attribute[i] + setup.attribute_dy[i] * static_cast<uint32_t>(row)
+					+ setup.attribute_dx[i] * static_cast<uint32_t>(offset);
+			}
+			for (; x <= setup.max_x; x++) {
+				if ((tail_edge[0] | tail_edge[1] | tail_edge[2]) >= 0) {
+					shade_pixel(setup, x, y, tail_attributes);
+				}
+				for (uint32_t i { 0 }; i < 3; i++) {
+					tail_edge[i] += setup.edge_dx[i];
+				}
+				for (uint32_t i { 0 }; i < attribute_count; i++) {
+					tail_attributes[i] += setup.attribute_dx[i];
+				}
+			}
+		}
+	}
+#else
+	void Runtime_rasterizer::draw_avx2(const Rasterizer::Setup& setup) {
+		draw_scalar(setup);
+	}
+#endif
+
+	// A primitive flavour, as the GP0 opcode bits and E1/E6 state give it
+	struct Case {
+		const char* name {};
+		bool shaded {};
+		bool textured {};
+		bool raw_texture {};
+		bool semi_transparent {};
+		uint16_t texpage {};
+		bool dither {};
+		bool check_mask {};
+		// Texels decoded by the texture cache, rather than read from VRAM
+		bool cached {};
+	};
+
+	// Pages sit in the bottom half of VRAM, below every triangle, so no
+	// triangle samples pixels it draws
+	constexpr std::array<Case, 8> cases {{
+		{ "flat", false, false, false, false, 0x010, false, false, false },
+		{ "gouraud, dither", true, false, false, false, 0x010, true, false, false },
+		{ "gouraud semi, dither", true, false, false, true, 0x030, true, false, false },
+		{ "tex4 cached, modulated", false, true, false, false, 0x018, false, false, true },
+		{ "tex4 cached, raw", false, true, true, false, 0x018, false, false, true },
+		{ "tex8 cached, gouraud dither", true, true, false, false, 0x098, true, false, true },
+		{ "tex15 raw semi", false, true, true, true, 0x158, false, false, false },
+		{ "tex15 modulated, mask check", false, true, false, false, 0x118, false, true, false },
+	}};
+
+	uint64_t hash(const Vram& vram) {
+		uint64_t result { 14695981039346656037ull };
+		for (uint32_t i { 0 }; i < Vram::width * Vram::height; i++) {
+			result = (result ^ vram.data()[i]) * 1099511628211ull;
+		}
+		return result;
+	}
+
+	// Small triangles scattered over the top half of VRAM
+	std::vector<Rasterizer::Triangle> make_triangles(const Case& flavour, uint32_t count, const uint16_t* texels) {
+		std::mt19937 engine { 7 };
+		auto random = [&] { return static_cast<uint32_t>(engine()); };
+		auto vertex = [&](int32_t x, int32_t y) {
+			return Rasterizer::Vertex { x, y, random() & 0xffffff, static_cast<uint8_t>(random()), static_cast<uint8_t>(random()) };
+		};
+
+		std::vector<Rasterizer::Triangle> triangles(count);
+		for (Rasterizer::Triangle& triangle : triangles) {
+			auto x { static_cast<int32_t>(random() % 960 + 16) };
+			auto y { static_cast<int32_t>(random() % 200 + 16) };
+			auto size { static_cast<int32_t>(random() % 24 + 8) };
+			triangle.vertices = {
+				vertex(x, y),
+				vertex(x + size, y + static_cast<int32_t>(random() % 6)),
+				vertex(x + static_cast<int32_t>(random() % static_cast<uint32_t>(size)), y + size),
+			};
+			triangle.shaded = flavour.shaded;
+			triangle.textured = flavour.textured;
+			triangle.raw_texture = flavour.raw_texture;
+			triangle.semi_transparent = flavour.semi_transparent;
+			triangle.texpage = flavour.texpage;
+			triangle.clut = 480 << 6;
+			triangle.texels = texels;
+		}
+		return triangles;
+	}
+
+	// Best time of the repeats in milliseconds, each drawn from the same VRAM
+	template<typename Function>
+	double best_time(Vram& vram, const Vram& start, uint32_t repeats, Function&& draw) {
+		double best { 1e30 };
+		for (uint32_t i { 0 }; i < repeats; i++) {
+			vram = start;
+			auto begin { std::chrono::steady_clock::now() };
+			draw();
+			std::chrono::duration<double, std::milli> elapsed { std::chrono::steady_clock::now() - begin };
+			best = std::min(best, elapsed.count());
+		}
+		return best;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	auto count { static_cast<uint32_t>(argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20'000) };
+	auto repeats { static_cast<uint32_t>(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 7) };
+	Logger::set_min_level(Logger::Level::error);
+
+	Vram vram {};
+	std::mt19937 engine { 1 };
+	for (uint32_t y { 0 }; y < Vram::height; y++) {
+		for (uint32_t x { 0 }; x < Vram::width; x++) {
+			vram.set(x, y, static_cast<uint16_t>(engine()));
+		}
+	}
+	const Vram start { vram };
+
+	Texture_cache texture_cache { vram };
+	Rasterizer rasterizer { vram };
+	Runtime_rasterizer runtime { vram };
+
+	std::vector<Rasterizer::Backend> backends { Rasterizer::Backend::scalar };
+	if (Rasterizer::best_backend() == Rasterizer::Backend::avx2) {
+		backends.push_back(Rasterizer::Backend::avx2);
+	}
+
+	std::cout << std::left << std::setw(30) << "case" << std::setw(8) << "backend"
+		<< std::right << std::setw(12) << "runtime ms" << std::setw(12) << "variant ms" << std::setw(10) << "speedup" << '\n';
+	std::cout << std::fixed << std::setprecision(2);
+
+	bool same { true };
+	std::array<double, 2> runtime_total {};
+	std::array<double, 2> variant_total {};
+	for (const Case& flavour : cases) {
+		const uint16_t* texels { flavour.cached ? texture_cache.lookup(flavour.texpage, 480 << 6, { 0, 0, -1, -1 }) : nullptr };
+		std::vector<Rasterizer::Triangle> triangles { make_triangles(flavour, count, texels) };
+		Rasterizer::Draw_settings settings {};
+		settings.area_right = Vram::width - 1;
+		settings.area_bottom = Vram::height - 1;
+		settings.dither = flavour.dither;
+		settings.check_mask = flavour.check_mask;
+
+		for (Rasterizer::Backend backend : backends) {
+			bool avx2 { backend == Rasterizer::Backend::avx2 };
+			rasterizer.set_backend(backend);
+
+			double runtime_time { best_time(vram, start, repeats, [&] {
+				for (const Rasterizer::Triangle& triangle : triangles) {
+					Rasterizer::Setup setup {};
+					if (!Rasterizer::setup_triangle(settings, triangle, setup)) {
+						continue;
+					}
+					if (avx2) {
+						runtime.draw_avx2(setup);
+					} else {
+						runtime.draw_scalar(setup);
+					}
+				}
+			}) };
+			uint64_t runtime_hash { hash(vram) };
+			double variant_time { best_time(vram, start, repeats, [&] {
+				rasterizer.draw_triangles(settings, triangles);
+			}) };
+			uint64_t variant_hash { hash(vram) };
+
+			std::cout << std::left << std::setw(30) << flavour.name << std::setw(8) << (avx2 ? "avx2" : "scalar")
+				<< std::right << std::setw(12) << runtime_time << std::setw(12) << variant_time
+				<< std::setw(9) << runtime_time / variant_time << 'x';
+			if (runtime_hash != variant_hash) {
+				std::cout << "  DIFFERENT PIXELS";
+				same = false;
+			}
+			std::cout << '\n';
+			runtime_total[avx2] += runtime_time;
+			variant_total[avx2] += variant_time;
+		}
+	}
+	vram = start;
+
+	for (Rasterizer::Backend backend : backends) {
+		bool avx2 { backend == Rasterizer::Backend::avx2 };
+		std::cout << std::left << std::setw(30) << "total" << std::setw(8) << (avx2 ? "avx2" : "scalar")
+			<< std::right << std::setw(12) << runtime_total[avx2] << std::setw(12) << variant_total[avx2]
+			<< std::setw(9) << runtime_total[avx2] / variant_total[avx2] << "x\n";
+	}
+	return same ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// soulpsx-rasterizer-compare: checks the AVX2 kernels against the scalar ones.
+//
+//   soulpsx-rasterizer-compare [triangles] [seed]
+//
+// Draws the same random triangles into two copies of VRAM, one with each
+// backend, and stops at the first triangle whose pixels differ. Pages and
+// CLUTs are placed anywhere, including under the triangle itself. Exits 1
+// on a difference, and 2 if the host has no AVX2 to compare against.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "Rasterizer.h"
+#include "Vram.h"
+
+namespace {
+	Rasterizer::Draw_settings random_settings(std::mt19937& random) {
+		Rasterizer::Draw_settings settings {};
+		settings.area_left = static_cast<int32_t>(random() % 200);
+		settings.area_top = static_cast<int32_t>(random() % 100);
+		settings.area_right = std::min(1023, settings.area_left + 200 + static_cast<int32_t>(random() % 900));
+		settings.area_bottom = std::min(511, settings.area_top + 100 + static_cast<int32_t>(random() % 400));
+		settings.dither = random() & 1;
+		settings.set_mask = random() % 4 == 0;
+		settings.check_mask = random() % 4 == 0;
+		if (random() % 3 == 0) {
+			settings.window_mask_x = static_cast<uint8_t>(random() % 32);
+			settings.window_mask_y = static_cast<uint8_t>(random() % 32);
+			settings.window_offset_x = static_cast<uint8_t>(random() % 32);
+			settings.window_offset_y = static_cast<uint8_t>(random() % 32);
+		}
+		return settings;
+	}
+
+	Rasterizer::Triangle random_triangle(std::mt19937& random) {
+		Rasterizer::Triangle triangle {};
+		// Mostly small triangles, with some large enough to cover a page
+		int32_t size { random() % 4 == 0 ? 600 : 80 };
+		int32_t center_x { static_cast<int32_t>(random() % 1100) - 40 };
+		int32_t center_y { static_cast<int32_t>(random() % 560) - 20 };
+		for (Rasterizer::Vertex& vertex : triangle.vertices) {
+			vertex.x = center_x + static_cast<int32_t>(random() % size) - size / 2;
+			vertex.y = center_y + static_cast<int32_t>(random() % size) - size / 2;
+			vertex.color = random() & 0xffffff;
+			vertex.u = static_cast<uint8_t>(random());
+			vertex.v = static_cast<uint8_t>(random());
+		}
+		triangle.shaded = random() & 1;
+		triangle.textured = random() & 1;
+		triangle.raw_texture = random() & 1;
+		triangle.semi_transparent = random() & 1;
+		triangle.texpage = static_cast<uint16_t>(random() & 0x1ff);
+		triangle.clut = static_cast<uint16_t>(random() & 0x7fff);
+		return triangle;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	uint64_t triangles { argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20'000 };
+	uint32_t seed { argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 1 };
+
+	if (Rasterizer::best_backend() != Rasterizer::Backend::avx2) {
+		std::cerr << "This host has no AVX2 kernels to compare\n";
+		return 2;
+	}
+
+	std::mt19937 random { seed };
+	Vram scalar_vram {};
+	Vram avx2_vram {};
+	Rasterizer scalar { scalar_vram };
+	Rasterizer avx2 { avx2_vram };
+	scalar.set_backend(Rasterizer::Backend::scalar);
+	avx2.set_backend(Rasterizer::Backend::avx2);
+
+	for (uint32_t y { 0 }; y < Vram::height; y++) {
+		for (uint32_t x { 0 }; x < Vram::width; x++) {
+			auto pixel { static_cast<uint16_t>(random()) };
+			scalar_vram.set(x, y, pixel);
+			avx2_vram.set(x, y, pixel);
+		}
+	}
+
+	for (uint64_t i { 0 }; i < triangles; i++) {
+		Rasterizer::Draw_settings settings { random_settings(random) };
+		Rasterizer::Triangle triangle { random_triangle(random) };
+		scalar.draw_triangle(settings, triangle);
+		avx2.draw_triangle(settings, triangle);
+
+		if (std::equal(scalar_vram.data(), scalar_vram.data() + Vram::width * Vram::height, avx2_vram.data())) {
+			continue;
+		}
+		for (uint32_t index { 0 }; index < Vram::width * Vram::height; index++) {
+			if (scalar_vram.data()[index] != avx2_vram.data()[index]) {
+				std::cout << "triangle " << i << " differs first at (" << index % Vram::width << ", "
+					<< index / Vram::width << "): scalar 0x" << std::hex << scalar_vram.data()[index]
+					<< ", avx2 0x" << avx2_vram.data()[index] << std::dec << ", texpage 0x" << std::hex
+					<< triangle.texpage << ", clut 0x" << triangle.clut << std::dec << '\n';
+				return 1;
+			}
+		}
+	}
+
+	std::cout << triangles << " triangles drew the same pixels with both backends\n";
+	return 0;
+}
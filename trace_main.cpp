@@ -0,0 +1,209 @@
+// soulpsx-trace: reads the binary traces written by Cpu::start_trace.
+//
+//   soulpsx-trace dump <trace> [--from N] [--count N] [--pc ADDR] [--reg REG] [--addr ADDR]
+//   soulpsx-trace diff <expected> <actual> [--context N]
+//
+// diff prints the first record where the traces disagree and exits with 1,
+// or exits with 0 when they match.
+
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "Instruction.h"
+#include "Trace.h"
+
+namespace {
+	struct Options {
+		uint64_t from {};
+		uint64_t count { std::numeric_limits<uint64_t>::max() };
+		std::optional<uint32_t> pc {};
+		std::optional<Register> reg {};
+		std::optional<uint32_t> address {};
+		uint64_t context { 8 };
+	};
+
+	int usage() {
+		std::cerr << "usage: soulpsx-trace dump <trace> [--from N] [--count N] [--pc ADDR] [--reg REG] [--addr ADDR]\n";
+		std::cerr << "       soulpsx-trace diff <expected> <actual> [--context N]\n";
+		return 2;
+	}
+
+	std::optional<uint32_t> parse_number(std::string_view text) {
+		try {
+			return static_cast<uint32_t>(std::stoul(std::string { text }, nullptr, 0));
+		} catch (const std::exception&) {
+			return std::nullopt;
+		}
+	}
+
+	// Takes a register name such as t0, or its number
+	std::optional<Register> parse_register(std::string_view text) {
+		for (uint32_t i { 0 }; i < 32; i++) {
+			if (Instruction::register_name(static_cast<Register>(i)) == text) {
+				return static_cast<Register>(i);
+			}
+		}
+		if (auto number { parse_number(text) }; number && *number < 32) {
+			return static_cast<Register>(*number);
+		}
+		return std::nullopt;
+	}
+
+	bool parse_options(std::span<char*> arguments, Options& options) {
+		for (size_t i { 0 }; i < arguments.size(); i++) {
+			std::string_view flag { arguments[i] };
+			if (i + 1 >= arguments.size()) {
+				std::cerr << "missing value for " << flag << '\n';
+				return false;
+			}
+			std::string_view value { arguments[++i] };
+
+			std::optional<uint32_t> number { parse_number(value) };
+			if (flag == "--reg") {
+				options.reg = parse_register(value);
+				if (!options.reg) {
+					std::cerr << "unknown register " << value << '\n';
+					return false;
+				}
+			} else if (!number) {
+				std::cerr << "bad value for " << flag << ": " << value << '\n';
+				return false;
+			} else if (flag == "--from") {
+				options.from = *number;
+			} else if (flag == "--count") {
+				options.count = *number;
+			} else if (flag == "--pc") {
+				options.pc = *number;
+			} else if (flag == "--addr") {
+				options.address = *number;
+			} else if (flag == "--context") {
+				options.context = *number;
+			} else {
+				std::cerr << "unknown option " << flag << '\n';
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool matches(const Trace_record& record, const Options& options) {
+		if (options.pc && record.pc != *options.pc) {
+			return false;
+		}
+		if (options.reg && (!(record.flags & Trace_record::register_write)
+			|| record.destination != static_cast<uint8_t>(*options.reg))) {
+			return false;
+		}
+		if (options.address && (!(record.flags & (Trace_record::memory_read | Trace_record::memory_write))
+			|| record.memory_address != *options.address)) {
+			return false;
+		}
+		return true;
+	}
+
+	std::string format_record(uint64_t index, const Trace_record& record) {
+		Instruction instruction { record.instruction, record.pc };
+		std::string line { std::format("{:>10} {:08x}: {}  {:<28}", index, record.pc, instruction.as_hex(), instruction.to_string()) };
+
+		if (record.flags & Trace_record::register_write) {
+			line += std::format(" {}={:08x}",
+				Instruction::register_name(static_cast<Register>(record.destination)), record.register_value);
+		}
+		if (record.flags & Trace_record::memory_read) {
+			line += std::format(" [{:08x}]->{:0{}x}", record.memory_address, record.memory_value, record.memory_width * 2);
+		}
+		if (record.flags & Trace_record::memory_write) {
+			line += std::format(" [{:08x}]<-{:0{}x}", record.memory_address, record.memory_value, record.memory_width * 2);
+		}
+		return line;
+	}
+
+	std::optional<std::deque<Trace_reader>> open_traces(std::span<char*> paths) {
+		std::deque<Trace_reader> traces {};
+		for (const char* path : paths) {
+			Trace_reader& trace { traces.emplace_back(path) };
+			if (!trace.is_open()) {
+				std::cerr << "soulpsx-trace: " << trace.error() << '\n';
+				return std::nullopt;
+			}
+		}
+		return traces;
+	}
+
+	int dump(const Trace_reader& trace, const Options& options) {
+		auto records { trace.records() };
+		uint64_t printed { 0 };
+		for (uint64_t i { options.from }; i < records.size() && printed < options.count; i++) {
+			if (matches(records[i], options)) {
+				std::cout << format_record(i, records[i]) << '\n';
+				printed++;
+			}
+		}
+		return 0;
+	}
+
+	int diff(const Trace_reader& expected, const Trace_reader& actual, const Options& options) {
+		auto expected_records { expected.records() };
+		auto actual_records { actual.records() };
+		uint64_t length { std::min(expected_records.size(), actual_records.size()) };
+
+		uint64_t index { 0 };
+		while (index < length && expected_records[index] == actual_records[index]) {
+			index++;
+		}
+
+		if (index == length) {
+			if (expected_records.size() == actual_records.size()) {
+				std::cout << "traces match (" << length << " records)\n";
+				return 0;
+			}
+			std::cout << "traces match for " << length << " records, then one of them ends ("
+				<< expected_records.size() << " vs " << actual_records.size() << " records)\n";
+			return 1;
+		}
+
+		std::cout << "traces diverge at record " << index << '\n';
+		for (uint64_t i { index > options.context ? index - options.context : 0 }; i < index; i++) {
+			std::cout << "  " << format_record(i, expected_records[i]) << '\n';
+		}
+		std::cout << "- " << format_record(index, expected_records[index]) << '\n';
+		std::cout << "+ " << format_record(index, actual_records[index]) << '\n';
+		return 1;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::span<char*> arguments { argv + 1, static_cast<size_t>(argc > 0 ? argc - 1 : 0) };
+	if (arguments.empty()) {
+		return usage();
+	}
+
+	std::string_view command { arguments[0] };
+	size_t path_count { command == "diff" ? 2u : 1u };
+	if ((command != "dump" && command != "diff") || arguments.size() < 1 + path_count) {
+		return usage();
+	}
+
+	Options options {};
+	if (!parse_options(arguments.subspan(1 + path_count), options)) {
+		return usage();
+	}
+
+	auto traces { open_traces(arguments.subspan(1, path_count)) };
+	if (!traces) {
+		return 2;
+	}
+
+	if (command == "dump") {
+		return dump((*traces)[0], options);
+	}
+	return diff((*traces)[0], (*traces)[1], options);
+}